@@ -5,18 +5,202 @@
 #include "ppport.h"
 
 #include <stdint.h>
+#include <inttypes.h>
+#include <sys/time.h>
 #include "define.h"
 #include "type.h"
 #include "proto.h"
 #include "decode.h"
 #include "encode.h"
+#include "eventloop.h"
+#include "streams.h"
+#include "ringcounter.h"
+#include "token.h"
 
 typedef struct {
     int column_count;
     int uniq_column_count;
     struct cc_column *columns;
+    int pk_count;       /* Columns of the partition key, for bind metadata of prepared statements */
+    int *pk_indexes;
 } Cassandra__Client__RowMeta;
 
+typedef struct cc_loop Cassandra__Client__EventLoop;
+
+typedef struct cc_streams Cassandra__Client__StreamTable;
+typedef struct cc_ring_counter Cassandra__Client__RingCounter;
+
+/* Appends the [short] value count and the values of a row to dest. With_names writes each value
+   as a [string] name followed by the [bytes], as used by the named values flag. */
+static void encode_row(pTHX_ SV *dest, Cassandra__Client__RowMeta *row_meta, SV *row, int with_names)
+{
+    int column_count, i, use_hash;
+    AV *row_a;
+    HV *row_h;
+
+    if (UNLIKELY(row == NULL))
+        croak("row must be passed");
+    if (UNLIKELY(!SvROK(row)))
+        croak("encode: argument must be a reference");
+
+    column_count = row_meta->column_count;
+
+    if (SvTYPE(SvRV(row)) == SVt_PVAV) {
+        row_a = (AV*)SvRV(row);
+        use_hash = 0;
+        if (UNLIKELY((av_len(row_a)+1) != column_count))
+            croak("row encoder expected %d column(s), but got %d", column_count, ((int)av_len(row_a))+1);
+
+    } else if (SvTYPE(SvRV(row)) == SVt_PVHV) {
+        row_h = (HV*)SvRV(row);
+        use_hash = 1;
+        if (UNLIKELY(HvUSEDKEYS(row_h) != row_meta->uniq_column_count))
+            croak("row encoder expected %d column(s), but got %d", row_meta->uniq_column_count, (int)HvUSEDKEYS(row_h));
+
+    } else {
+        croak("encode: argument must be an ARRAY or HASH reference");
+    }
+
+    pack_short(aTHX_ dest, column_count);
+
+    for (i = 0; i < column_count; i++) {
+        struct cc_column *column = &row_meta->columns[i];
+        SV *cell;
+
+        if (!use_hash) {
+            SV **maybe_cell = av_fetch(row_a, i, 0);
+            if (UNLIKELY(maybe_cell == NULL))
+                croak("row encoder error. bailing out");
+            cell = *maybe_cell;
+
+        } else {
+            HE *ent = hv_fetch_ent(row_h, column->name, 0, column->name_hash);
+            if (UNLIKELY(!ent)) {
+                croak("missing value for required entry <%s>", SvPV_nolen(column->name));
+            }
+            cell = HeVAL(ent);
+        }
+
+        if (with_names) {
+            STRLEN name_len;
+            char *name = SvPV(column->name, name_len);
+            pack_short(aTHX_ dest, name_len);
+            sv_catpvn(dest, name, name_len);
+        }
+
+        encode_cell(aTHX_ dest, cell, &column->type);
+    }
+}
+
+/* Last timestamp handed out by next_timestamp(), so that we never go back in time or hand out
+   duplicates, even if the clock does. */
+static int64_t last_timestamp = 0;
+
+static int64_t next_timestamp()
+{
+    struct timeval tv;
+    int64_t now;
+
+    gettimeofday(&tv, NULL);
+    now = ((int64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+    if (now <= last_timestamp)
+        now = last_timestamp + 1;
+    last_timestamp = now;
+    return now;
+}
+
+static SV *int64_sv(pTHX_ int64_t value)
+{
+#ifdef CAN_64BIT
+    return newSViv(value);
+#else
+    return newSVpvf("%" PRId64, value);
+#endif
+}
+
+static int64_t sv_int64(pTHX_ SV *sv)
+{
+#ifdef CAN_64BIT
+    return SvIV(sv);
+#else
+    return strtoll(SvPV_nolen(sv), NULL, 10);
+#endif
+}
+
+/* The token of the partition that a row of bind values is for, to route the query by. Undef if
+   the statement has no partition key, or a part of it is missing or null: then it can go anywhere,
+   and encoding the row will complain if it's wrong. Composite keys are hashed as the server does,
+   each part as a [short] length, the value and a zero byte. */
+static SV *row_routing_token(pTHX_ Cassandra__Client__RowMeta *row_meta, SV *row)
+{
+    SV *key, *value;
+    AV *row_a = NULL;
+    HV *row_h = NULL;
+    int i;
+
+    if (!row_meta->pk_count || !row || !SvROK(row))
+        return newSV(0);
+
+    if (SvTYPE(SvRV(row)) == SVt_PVAV) {
+        row_a = (AV*)SvRV(row);
+        if ((av_len(row_a)+1) != row_meta->column_count)
+            return newSV(0);
+    } else if (SvTYPE(SvRV(row)) == SVt_PVHV) {
+        row_h = (HV*)SvRV(row);
+    } else {
+        return newSV(0);
+    }
+
+    key = sv_2mortal(newSVpvs(""));
+    value = sv_2mortal(newSVpvs(""));
+
+    for (i = 0; i < row_meta->pk_count; i++) {
+        struct cc_column *column = &row_meta->columns[row_meta->pk_indexes[i]];
+        SV *cell = NULL;
+        STRLEN len;
+        char *ptr;
+
+        if (row_a) {
+            SV **maybe_cell = av_fetch(row_a, row_meta->pk_indexes[i], 0);
+            cell = maybe_cell ? *maybe_cell : NULL;
+        } else {
+            HE *ent = hv_fetch_ent(row_h, column->name, 0, column->name_hash);
+            cell = ent ? HeVAL(ent) : NULL;
+        }
+        if (!cell || !SvOK(cell))
+            return newSV(0);
+
+        /* Encoded as [bytes], so the value follows an [int] length */
+        SvCUR_set(value, 0);
+        encode_cell(aTHX_ value, cell, &column->type);
+        ptr = SvPV(value, len);
+        if (UNLIKELY(len < 4))
+            return newSV(0);
+
+        if (row_meta->pk_count == 1)
+            return int64_sv(aTHX_ cc_murmur3_token((unsigned char*)ptr+4, len-4));
+
+        if (UNLIKELY(len-4 > 0xffff))
+            return newSV(0);
+        pack_short(aTHX_ key, len-4);
+        sv_catpvn(key, ptr+4, len-4);
+        sv_catpvn(key, "", 1);
+    }
+
+    {
+        STRLEN len;
+        char *ptr = SvPV(key, len);
+        return int64_sv(aTHX_ cc_murmur3_token((unsigned char*)ptr, len));
+    }
+}
+
+static Cassandra__Client__RowMeta *row_meta_from_sv(pTHX_ SV *sv)
+{
+    if (UNLIKELY(!sv_isobject(sv) || !sv_derived_from(sv, "Cassandra::Client::RowMetaPtr")))
+        croak("Expected a Cassandra::Client::RowMetaPtr instance");
+    return INT2PTR(Cassandra__Client__RowMeta*, SvIV(SvRV(sv)));
+}
+
 MODULE = Cassandra::Client  PACKAGE = Cassandra::Client::Protocol
 PROTOTYPES: DISABLE
 
@@ -28,7 +212,8 @@ unpack_metadata(protocol_version, is_result, data)
   PPCODE:
     STRLEN pos, size;
     unsigned char *ptr;
-    int32_t flags, column_count, uniq_column_count;
+    STRLEN pk_pos;
+    int32_t flags, column_count, uniq_column_count, pk_count;
     Cassandra__Client__RowMeta *row_meta;
 
     ST(0) = &PL_sv_undef; /* Will have our RowMeta instance */
@@ -45,15 +230,18 @@ unpack_metadata(protocol_version, is_result, data)
     flags = unpack_int(aTHX_ ptr, size, &pos);
     column_count = unpack_int(aTHX_ ptr, size, &pos);
 
+    pk_count = 0;
+    pk_pos = 0;
     if (protocol_version >= 4 && !is_result) {
-        int i, pk_count;
+        int i;
 
         pk_count = unpack_int(aTHX_ ptr, size, &pos);
         if (UNLIKELY(pk_count < 0))
             croak("Protocol error: pk_count<0");
 
+        /* Read them again once we have somewhere to put them */
+        pk_pos = pos;
         for (i = 0; i < pk_count; i++) {
-            // Read the short, but throw it away for now.
             unpack_short(aTHX_ ptr, size, &pos);
         }
     }
@@ -76,9 +264,9 @@ unpack_metadata(protocol_version, is_result, data)
         have_global_spec = flags & CC_METADATA_FLAG_GLOBAL_TABLES_SPEC;
 
         if (have_global_spec) {
-            global_keyspace = unpack_string_sv(aTHX_ ptr, size, &pos);
+            global_keyspace = cc_name_intern(aTHX_ ptr, size, &pos, NULL);
             sv_2mortal(global_keyspace);
-            global_table = unpack_string_sv(aTHX_ ptr, size, &pos);
+            global_table = cc_name_intern(aTHX_ ptr, size, &pos, NULL);
             sv_2mortal(global_table);
         }
 
@@ -103,12 +291,12 @@ unpack_metadata(protocol_version, is_result, data)
                 column->table = global_table;
                 SvREFCNT_inc(column->table);
             } else {
-                column->keyspace = unpack_string_sv(aTHX_ ptr, size, &pos);
-                column->table = unpack_string_sv(aTHX_ ptr, size, &pos);
+                column->keyspace = cc_name_intern(aTHX_ ptr, size, &pos, NULL);
+                column->table = cc_name_intern(aTHX_ ptr, size, &pos, NULL);
             }
 
-            column->name = unpack_string_sv_hash(aTHX_ ptr, size, &pos, &column->name_hash);
-            unpack_type(aTHX_ ptr, size, &pos, &column->type);
+            column->name = cc_name_intern(aTHX_ ptr, size, &pos, &column->name_hash);
+            column->type_entry = cc_type_intern(aTHX_ ptr, size, &pos, &column->type);
             if (!hv_exists_ent(name_hash, column->name, column->name_hash)) {
                 uniq_column_count++;
                 hv_store_ent(name_hash, column->name, &PL_sv_undef, column->name_hash);
@@ -116,19 +304,180 @@ unpack_metadata(protocol_version, is_result, data)
         }
 
         row_meta->uniq_column_count = uniq_column_count;
+
+        if (pk_count > 0 && pk_count <= column_count) {
+            int pk_valid = 1;
+            Newxz(row_meta->pk_indexes, pk_count, int);
+            for (i = 0; i < pk_count; i++) {
+                row_meta->pk_indexes[i] = unpack_short(aTHX_ ptr, size, &pk_pos);
+                if (row_meta->pk_indexes[i] >= column_count)
+                    pk_valid = 0;
+            }
+            /* Without a usable partition key we just can't route, that's not worth failing for */
+            if (pk_valid)
+                row_meta->pk_count = pk_count;
+        }
     }
 
     sv_chop(data, (char*)ptr+pos);
 
     XSRETURN(2);
 
+SV*
+murmur3_token(key)
+    SV *key
+  CODE:
+    STRLEN len;
+    char *ptr = SvPV(key, len);
+    RETVAL = int64_sv(aTHX_ cc_murmur3_token((unsigned char*)ptr, len));
+  OUTPUT:
+    RETVAL
+
+SV*
+token_sort_key(token)
+    SV *token
+  CODE:
+    /* Eight bytes that sort (as strings) like the signed token does, which doesn't depend on our
+       integers being 64 bits wide */
+    uint64_t value = (uint64_t)sv_int64(aTHX_ token) ^ UINT64_C(0x8000000000000000);
+    unsigned char out[8];
+    int i;
+    for (i = 7; i >= 0; i--) {
+        out[i] = value & 0xff;
+        value >>= 8;
+    }
+    RETVAL = newSVpvn((char*)out, 8);
+  OUTPUT:
+    RETVAL
+
+int
+scylla_shard(token, nr_shards, ignore_msb)
+    SV *token
+    int nr_shards
+    int ignore_msb
+  CODE:
+    RETVAL = cc_scylla_shard(sv_int64(aTHX_ token), nr_shards, ignore_msb);
+  OUTPUT:
+    RETVAL
+
+SV*
+next_timestamp()
+  CODE:
+    RETVAL = int64_sv(aTHX_ next_timestamp());
+  OUTPUT:
+    RETVAL
+
+SV*
+pack_batch(batch_type, queries, consistency, serial_consistency, timestamp, named_values)
+    int batch_type
+    AV *queries
+    int consistency
+    SV *serial_consistency
+    SV *timestamp
+    int named_values
+  CODE:
+    int i, query_count, flags;
+    STRLEN size_estimate;
+    unsigned char buf[8];
+
+    query_count = av_len(queries) + 1;
+    if (UNLIKELY(query_count > 0xffff))
+        croak("pack_batch: too many queries in batch (%d)", query_count);
+
+    /* Same kind of estimate as in encode(): it only determines how much we allocate up front */
+    size_estimate = 3 + 2 + 1 + 2 + 8;
+    for (i = 0; i < query_count; i++) {
+        SV **entry = av_fetch(queries, i, 0);
+        if (entry && SvROK(*entry) && SvTYPE(SvRV(*entry)) == SVt_PVAV) {
+            SV **encoder = av_fetch((AV*)SvRV(*entry), 1, 0);
+            size_estimate += 1 + 2 + 16 + 2;
+            if (encoder && sv_isobject(*encoder))
+                size_estimate += row_meta_from_sv(aTHX_ *encoder)->column_count * 12;
+        }
+    }
+
+    RETVAL = newSV(size_estimate);
+    sv_2mortal(RETVAL); /* We may croak below */
+    sv_setpvn(RETVAL, "", 0);
+
+    buf[0] = (unsigned char)batch_type;
+    sv_catpvn(RETVAL, (char*)buf, 1);
+    pack_short(aTHX_ RETVAL, query_count);
+
+    for (i = 0; i < query_count; i++) {
+        SV **entry, **id, **encoder, **params;
+        AV *entry_a;
+        STRLEN id_len;
+        char *id_ptr;
+
+        entry = av_fetch(queries, i, 0);
+        if (UNLIKELY(!entry || !SvROK(*entry) || SvTYPE(SvRV(*entry)) != SVt_PVAV))
+            croak("pack_batch: queries must be [id, encoder, params] arrayrefs");
+        entry_a = (AV*)SvRV(*entry);
+
+        id = av_fetch(entry_a, 0, 0);
+        encoder = av_fetch(entry_a, 1, 0);
+        params = av_fetch(entry_a, 2, 0);
+        if (UNLIKELY(!id || !encoder))
+            croak("pack_batch: queries must be [id, encoder, params] arrayrefs");
+
+        buf[0] = 1; /* kind: prepared */
+        sv_catpvn(RETVAL, (char*)buf, 1);
+
+        id_ptr = SvPV(*id, id_len);
+        pack_short(aTHX_ RETVAL, id_len);
+        sv_catpvn(RETVAL, id_ptr, id_len);
+
+        if (params && SvOK(*params)) {
+            encode_row(aTHX_ RETVAL, row_meta_from_sv(aTHX_ *encoder), *params, named_values);
+        } else {
+            pack_short(aTHX_ RETVAL, 0);
+        }
+    }
+
+    flags = 0;
+    if (SvOK(serial_consistency))
+        flags |= CC_BATCH_FLAG_SERIAL_CONSISTENCY;
+    if (SvOK(timestamp))
+        flags |= CC_BATCH_FLAG_DEFAULT_TIMESTAMP;
+    if (named_values)
+        flags |= CC_BATCH_FLAG_NAMED_VALUES;
+
+    pack_short(aTHX_ RETVAL, consistency);
+    buf[0] = (unsigned char)flags;
+    sv_catpvn(RETVAL, (char*)buf, 1);
+
+    if (flags & CC_BATCH_FLAG_SERIAL_CONSISTENCY)
+        pack_short(aTHX_ RETVAL, SvIV(serial_consistency));
+
+    if (flags & CC_BATCH_FLAG_DEFAULT_TIMESTAMP) {
+        int64_t ts;
+        int j;
+#ifdef CAN_64BIT
+        ts = SvIV(timestamp);
+#else
+        ts = SvIOK(timestamp) ? SvIV(timestamp) : strtoll(SvPV_nolen(timestamp), NULL, 10);
+#endif
+        for (j = 7; j >= 0; j--) {
+            buf[j] = ts & 0xff;
+            ts >>= 8;
+        }
+        sv_catpvn(RETVAL, (char*)buf, 8);
+    }
+
+    SvREFCNT_inc(RETVAL);
+
+  OUTPUT:
+    RETVAL
+
 MODULE = Cassandra::Client  PACKAGE = Cassandra::Client::RowMetaPtr
 
 AV*
-decode(self, data, use_hashes)
+decode(self, data, use_hashes, flags=0)
     Cassandra::Client::RowMeta *self
     SV *data
     int use_hashes
+    int flags
   CODE:
     STRLEN size, pos;
     unsigned char *ptr;
@@ -165,7 +514,7 @@ decode(self, data, use_hashes)
                 SV *decoded = newSV(0);
                 hv_store_ent(this_row, columns[j].name, decoded, columns[j].name_hash);
 
-                decode_cell(aTHX_ ptr, size, &pos, &columns[j].type, decoded);
+                decode_cell(aTHX_ ptr, size, &pos, &columns[j].type, flags, decoded);
             }
 
         } else {
@@ -176,7 +525,7 @@ decode(self, data, use_hashes)
                 SV *decoded = newSV(0);
                 av_push(this_row, decoded);
 
-                decode_cell(aTHX_ ptr, size, &pos, &columns[j].type, decoded);
+                decode_cell(aTHX_ ptr, size, &pos, &columns[j].type, flags, decoded);
             }
         }
     }
@@ -189,67 +538,27 @@ encode(self, row)
     Cassandra::Client::RowMeta *self
     SV* row
   CODE:
-    int column_count, i, use_hash;
     STRLEN size_estimate;
-    AV *row_a;
-    HV *row_h;
-
-    if (UNLIKELY(row == NULL))
-        croak("row must be passed");
-    if (UNLIKELY(!SvROK(row)))
-        croak("encode: argument must be a reference");
-
-    column_count = self->column_count;
-
-    if (SvTYPE(SvRV(row)) == SVt_PVAV) {
-        row_a = (AV*)SvRV(row);
-        use_hash = 0;
-        if (UNLIKELY((av_len(row_a)+1) != column_count))
-            croak("row encoder expected %d column(s), but got %d", column_count, ((int)av_len(row_a))+1);
-
-    } else if (SvTYPE(SvRV(row)) == SVt_PVHV) {
-        row_h = (HV*)SvRV(row);
-        use_hash = 1;
-        if (UNLIKELY(HvUSEDKEYS(row_h) != self->uniq_column_count))
-            croak("row encoder expected %d column(s), but got %d", self->uniq_column_count, (int)HvUSEDKEYS(row_h));
-
-    } else {
-        croak("encode: argument must be an ARRAY or HASH reference");
-    }
 
     /* Rough estimate. We only use it to predict Sv size, we don't rely on it being accurate.
        If we overshoot, we waste some memory, and if we undershoot we copy a bit too often. */
-    size_estimate = 2 + (column_count * 12);
+    size_estimate = 2 + (self->column_count * 12);
     if (size_estimate <= 0) /* overflows aren't impossible, I guess */
         size_estimate = 0; /* wing it */
 
     RETVAL = newSV(size_estimate);
     sv_setpvn(RETVAL, "", 0);
-    pack_short(aTHX_ RETVAL, column_count);
-
-    if (!use_hash) {
-        for (i = 0; i < column_count; i++) {
-            SV **maybe_cell = av_fetch(row_a, i, 0);
-            if (UNLIKELY(maybe_cell == NULL))
-                croak("row encoder error. bailing out");
-            encode_cell(aTHX_ RETVAL, *maybe_cell, &self->columns[i].type);
-        }
-
-    } else {
-        for (i = 0; i < column_count; i++) {
-            struct cc_column *column;
-            HE *ent;
-
-            column = &self->columns[i];
-            ent = hv_fetch_ent(row_h, column->name, 0, column->name_hash);
-            if (UNLIKELY(!ent)) {
-                croak("missing value for required entry <%s>", SvPV_nolen(column->name));
-            }
+    encode_row(aTHX_ RETVAL, self, row, 0);
 
-            encode_cell(aTHX_ RETVAL, HeVAL(ent), &column->type);
-        }
-    }
+  OUTPUT:
+    RETVAL
 
+SV*
+routing_token(self, row)
+    Cassandra::Client::RowMeta *self
+    SV* row
+  CODE:
+    RETVAL = row_routing_token(aTHX_ self, row);
   OUTPUT:
     RETVAL
 
@@ -278,7 +587,237 @@ DESTROY(self)
         SvREFCNT_dec(column->keyspace);
         SvREFCNT_dec(column->table);
         SvREFCNT_dec(column->name);
-        cc_type_destroy(aTHX_ &column->type);
+        if (column->type_entry)
+            cc_type_release(aTHX_ column->type_entry);
+        else
+            cc_type_destroy(aTHX_ &column->type);
     }
     Safefree(self->columns);
+    Safefree(self->pk_indexes);
     Safefree(self);
+
+MODULE = Cassandra::Client  PACKAGE = Cassandra::Client::EventLoopPtr
+
+Cassandra::Client::EventLoop*
+new(class)
+    SV *class
+  CODE:
+    RETVAL = cc_loop_new(aTHX);
+  OUTPUT:
+    RETVAL
+
+void
+add(self, fd, connection, read_buffer)
+    Cassandra::Client::EventLoop *self
+    int fd
+    SV *connection
+    SV *read_buffer
+  CODE:
+    cc_loop_add(aTHX_ self, fd, connection, SvOK(read_buffer) ? read_buffer : NULL);
+
+void
+remove(self, fd)
+    Cassandra::Client::EventLoop *self
+    int fd
+  CODE:
+    cc_loop_remove(aTHX_ self, fd);
+
+void
+watch_read(self, fd, enable)
+    Cassandra::Client::EventLoop *self
+    int fd
+    int enable
+  CODE:
+    cc_loop_watch(aTHX_ self, fd, CC_LOOP_READ, enable);
+
+void
+watch_write(self, fd, enable)
+    Cassandra::Client::EventLoop *self
+    int fd
+    int enable
+  CODE:
+    cc_loop_watch(aTHX_ self, fd, CC_LOOP_WRITE, enable);
+
+SV*
+deadline(self, fd, stream_id, timeout)
+    Cassandra::Client::EventLoop *self
+    int fd
+    int stream_id
+    double timeout
+  CODE:
+    RETVAL = cc_loop_deadline(aTHX_ self, fd, stream_id, timeout);
+  OUTPUT:
+    RETVAL
+
+void
+timer(self, callback, wait)
+    Cassandra::Client::EventLoop *self
+    SV *callback
+    double wait
+  CODE:
+    cc_loop_timer(aTHX_ self, callback, wait);
+
+void
+run(self)
+    Cassandra::Client::EventLoop *self
+  CODE:
+    cc_loop_run(aTHX_ self);
+
+void
+stop(self)
+    Cassandra::Client::EventLoop *self
+  CODE:
+    self->stop = 1;
+
+void
+DESTROY(self)
+    Cassandra::Client::EventLoop *self
+  CODE:
+    cc_loop_destroy(aTHX_ self);
+
+MODULE = Cassandra::Client  PACKAGE = Cassandra::Client::StreamTablePtr
+
+Cassandra::Client::StreamTable*
+new(class, limit)
+    SV *class
+    int limit
+  CODE:
+    RETVAL = cc_streams_new(aTHX_ limit);
+  OUTPUT:
+    RETVAL
+
+int
+acquire(self, callback)
+    Cassandra::Client::StreamTable *self
+    SV *callback
+  CODE:
+    RETVAL = cc_streams_acquire(aTHX_ self, callback);
+  OUTPUT:
+    RETVAL
+
+void
+set_deadline(self, id, deadline)
+    Cassandra::Client::StreamTable *self
+    int id
+    SV *deadline
+  CODE:
+    cc_streams_set_deadline(aTHX_ self, id, deadline);
+
+SV*
+release(self, id)
+    Cassandra::Client::StreamTable *self
+    int id
+  PREINIT:
+    int state;
+  CODE:
+    state = (id >= 0 && id < self->size) ? self->slots[id].state : CC_STREAM_FREE;
+    RETVAL = cc_streams_release(aTHX_ self, id);
+    if (!RETVAL) {
+        if (state != CC_STREAM_ORPHANED)
+            warn("BUG: received response for unknown stream");
+        RETVAL = &PL_sv_undef;
+    }
+  OUTPUT:
+    RETVAL
+
+SV*
+timeout(self, id)
+    Cassandra::Client::StreamTable *self
+    int id
+  CODE:
+    RETVAL = cc_streams_orphan(aTHX_ self, id);
+    if (!RETVAL)
+        RETVAL = &PL_sv_undef;
+  OUTPUT:
+    RETVAL
+
+void
+drain(self)
+    Cassandra::Client::StreamTable *self
+  PREINIT:
+    AV *callbacks;
+    SSize_t i, count;
+  PPCODE:
+    callbacks = (AV*)sv_2mortal((SV*)cc_streams_drain(aTHX_ self));
+    count = av_len(callbacks) + 1;
+    EXTEND(SP, count);
+    for (i = 0; i < count; i++)
+        PUSHs(*av_fetch(callbacks, i, 0));
+
+int
+active(self)
+    Cassandra::Client::StreamTable *self
+  CODE:
+    RETVAL = self->active;
+  OUTPUT:
+    RETVAL
+
+int
+orphaned(self)
+    Cassandra::Client::StreamTable *self
+  CODE:
+    RETVAL = self->orphaned;
+  OUTPUT:
+    RETVAL
+
+double
+sent_at(self, id)
+    Cassandra::Client::StreamTable *self
+    int id
+  CODE:
+    RETVAL = cc_streams_sent_at(self, id);
+  OUTPUT:
+    RETVAL
+
+void
+DESTROY(self)
+    Cassandra::Client::StreamTable *self
+  CODE:
+    cc_streams_destroy(aTHX_ self);
+
+MODULE = Cassandra::Client  PACKAGE = Cassandra::Client::RingCounterPtr
+
+Cassandra::Client::RingCounter*
+new(class, window, size)
+    SV *class
+    double window
+    int size
+  CODE:
+    RETVAL = cc_ring_counter_new(aTHX_ window, size);
+  OUTPUT:
+    RETVAL
+
+void
+add(self, success, now=-1)
+    Cassandra::Client::RingCounter *self
+    int success
+    double now
+  CODE:
+    cc_ring_counter_add(self, now < 0 ? cc_ring_counter_now() : now, success);
+
+void
+totals(self, now=-1)
+    Cassandra::Client::RingCounter *self
+    double now
+  PPCODE:
+    /* Returns (total, success) */
+    cc_ring_counter_advance(self, now < 0 ? cc_ring_counter_now() : now);
+    EXTEND(SP, 2);
+    mPUSHu(self->total);
+    mPUSHu(self->success);
+
+void
+DESTROY(self)
+    Cassandra::Client::RingCounter *self
+  CODE:
+    cc_ring_counter_destroy(aTHX_ self);
+
+MODULE = Cassandra::Client  PACKAGE = Cassandra::Client
+
+IV
+_sv_count()
+  CODE:
+    /* Number of live SVs, used by the codec benchmarks */
+    RETVAL = PL_sv_count;
+  OUTPUT:
+    RETVAL
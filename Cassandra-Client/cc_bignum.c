@@ -5,242 +5,334 @@
 #include "cc_bignum.h"
 
 /* I needed a bignum library but couldn't use GMP because I can't assume it's installed everywhere.
-   Since the amount of things I need to do is really small, I rolled my own. */
-
-void cc_bignum_init_bytes(struct cc_bignum *bn, unsigned char *bytes, size_t length)
-{
-    if (length > 0) {
-        bn->number = malloc(length);
-        bn->length = length;
-        memcpy(bn->number, bytes, length);
-        if (bn->number[length-1] & 0x80) {
-            int i;
-            for (i = 0; i < bn->length; i++) {
-                bn->number[i] = ~bn->number[i];
-            }
-            bn->is_negative = 1;
-            cc_bignum_add(bn, 1);
-        } else {
-            bn->is_negative = 0;
-        }
-    } else {
-        bn->number = calloc(1, 1);
-        bn->length = 1;
-        bn->is_negative = 0;
-    }
-}
+   Since the amount of things I need to do is really small, I rolled my own.
 
-void cc_bignum_init_string(struct cc_bignum *bn, char *string, size_t length)
-{
-    size_t pos = 0;
-
-    bn->number = calloc(1, 1);
-    bn->length = 1;
-    bn->is_negative = 0;
+   Numbers are stored as sign and magnitude, in 32-bit limbs. Conversions to and from decimal work
+   nine digits at a time, and all storage is sized up front: numbers that fit in the inline limbs
+   don't allocate at all, bigger ones allocate exactly once. */
 
-    if (string[pos] == '-') {
-        pos++;
-        bn->is_negative = 1;
-    } else if (string[pos] == '+') {
-        pos++;
-    }
+#define CC_BIGNUM_CHUNK 1000000000U
+#define CC_BIGNUM_CHUNK_DIGITS 9
 
-    for (; pos < length; pos++) {
-        cc_bignum_mul(bn, 10);
-        cc_bignum_add(bn, string[pos]-'0');
+static void cc_bignum_init(struct cc_bignum *bn, size_t capacity)
+{
+    if (capacity <= CC_BIGNUM_INLINE_LIMBS) {
+        bn->limbs = bn->inline_limbs;
+        bn->capacity = CC_BIGNUM_INLINE_LIMBS;
+    } else {
+        bn->limbs = malloc(capacity * sizeof(uint32_t));
+        assert(bn->limbs);
+        bn->capacity = capacity;
     }
+    bn->length = 0;
+    bn->is_negative = 0;
 }
 
-void cc_bignum_destroy(struct cc_bignum *bn)
+static void cc_bignum_normalize(struct cc_bignum *bn)
 {
-    if (bn->number)
-        free(bn->number);
-    bn->number = NULL;
+    while (bn->length > 0 && bn->limbs[bn->length-1] == 0)
+        bn->length--;
+    if (bn->length == 0)
+        bn->is_negative = 0;
 }
 
-void cc_bignum_copy(struct cc_bignum *out, struct cc_bignum *in)
+/* n = n * mul + add */
+static void cc_bignum_mul_add(struct cc_bignum *n, uint32_t mul, uint32_t add)
 {
-    out->length = in->length;
-    out->number = calloc(1, in->length);
-    memcpy(out->number, in->number, in->length);
-    out->is_negative = in->is_negative;
-}
+    size_t i;
+    uint64_t carry = add;
 
-void cc_bignum_move(struct cc_bignum *out, struct cc_bignum *in)
-{
-    out->length = in->length;
-    out->number = in->number;
-    out->is_negative = in->is_negative;
-    in->number = NULL;
-    in->length = 0;
-    in->is_negative = 0;
+    for (i = 0; i < n->length; i++) {
+        carry += (uint64_t)n->limbs[i] * mul;
+        n->limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry) {
+        assert(n->length < n->capacity);
+        n->limbs[n->length++] = (uint32_t)carry;
+    }
 }
 
-/*  https://stackoverflow.com/a/10525503 */
-uint32_t cc_bignum_divide_8bit(struct cc_bignum *n, uint8_t d, struct cc_bignum *out)
+/* n = n / d, returns the remainder */
+static uint32_t cc_bignum_divmod(uint32_t *limbs, size_t *length, uint32_t d)
 {
     size_t i;
-    uint32_t temp;
+    uint64_t rem = 0;
 
-    temp = 0;
-    out->number = calloc(1, n->length);
-    i = n->length;
+    i = *length;
     while (i > 0) {
         i--;
-        temp <<= 8;
-        temp |= n->number[i];
-        out->number[i] = temp / d;
-        temp -= out->number[i] * d;
+        rem = (rem << 32) | limbs[i];
+        limbs[i] = (uint32_t)(rem / d);
+        rem %= d;
     }
+    while (*length > 0 && limbs[*length-1] == 0)
+        (*length)--;
+
+    return (uint32_t)rem;
+}
+
+/* Big-endian two's complement, as used by the varint type */
+void cc_bignum_init_bytes(struct cc_bignum *bn, const unsigned char *bytes, size_t length)
+{
+    size_t i, limb_count;
+    int negative;
 
-    out->length = n->length;
-    out->is_negative = n->is_negative;
+    limb_count = (length + 3) / 4;
+    cc_bignum_init(bn, limb_count ? limb_count : 1);
+    if (!length)
+        return;
+
+    negative = (bytes[0] & 0x80) != 0;
+    memset(bn->limbs, negative ? 0xff : 0, limb_count * sizeof(uint32_t));
+    for (i = 0; i < length; i++) {
+        size_t byte_pos = length - 1 - i;
+        uint32_t shift = (i % 4) * 8;
+        bn->limbs[i / 4] = (bn->limbs[i / 4] & ~(0xffU << shift)) | ((uint32_t)bytes[byte_pos] << shift);
+    }
+    bn->length = limb_count;
+
+    if (negative) {
+        uint64_t carry = 1;
+        for (i = 0; i < limb_count; i++) {
+            carry += (uint32_t)~bn->limbs[i];
+            bn->limbs[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        bn->is_negative = 1;
+    }
 
-    /* Probably not correct when the number is negative. But good enough for our use cases. */
-    return temp;
+    cc_bignum_normalize(bn);
 }
 
-void cc_bignum_mul(struct cc_bignum *n, uint8_t mul)
+/* Returns 0 on success, or -1 if the string contains anything other than an optional sign and digits */
+int cc_bignum_init_string(struct cc_bignum *bn, const char *string, size_t length)
 {
-    size_t i;
-    uint32_t temp;
-
-    temp = 0;
-    i = 0;
-    while (i < n->length) {
-        temp += (n->number[i] * mul);
-        n->number[i] = temp % 256;
-        temp >>= 8;
-        i++;
+    size_t pos = 0, digits, chunk_len;
+    int negative = 0;
+
+    if (length > 0 && string[0] == '-') {
+        pos++;
+        negative = 1;
+    } else if (length > 0 && string[0] == '+') {
+        pos++;
     }
-    if (temp) {
-        assert(temp < 256);
-        n->length++;
-        n->number = realloc(n->number, n->length);
-        n->number[i] = temp;
+
+    /* Each chunk of nine digits is below 2^30, so it never needs more than one limb */
+    digits = length - pos;
+    cc_bignum_init(bn, digits / CC_BIGNUM_CHUNK_DIGITS + 2);
+
+    chunk_len = digits % CC_BIGNUM_CHUNK_DIGITS;
+    if (!chunk_len)
+        chunk_len = CC_BIGNUM_CHUNK_DIGITS;
+
+    while (pos < length) {
+        uint32_t chunk = 0, mul = 1;
+        size_t end = pos + chunk_len;
+        for (; pos < end; pos++) {
+            if (string[pos] < '0' || string[pos] > '9')
+                return -1;
+            chunk = chunk * 10 + (string[pos] - '0');
+            mul *= 10;
+        }
+        cc_bignum_mul_add(bn, mul, chunk);
+        chunk_len = CC_BIGNUM_CHUNK_DIGITS;
     }
+
+    bn->is_negative = negative;
+    cc_bignum_normalize(bn);
+    return 0;
 }
 
-void cc_bignum_add(struct cc_bignum *n, uint8_t howmuch)
+static int cc_bignum_hex_value(char c)
 {
-    int i;
-    uint8_t carry;
-    carry = howmuch;
-    if (!carry)
-        return;
-    for (i = 0; i < n->length; i++) {
-        if (n->number[i] < 256-carry) {
-            n->number[i] += carry;
-            return;
-        } else {
-            n->number[i] += carry;
-            carry = 1;
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/* Parses [+-]0x..., as produced by cc_bignum_hexify and understood by Math::BigInt. Returns 0 on
+   success, or -1 if the string isn't a valid hex number */
+int cc_bignum_init_hex(struct cc_bignum *bn, const char *string, size_t length)
+{
+    size_t pos = 0, end, i;
+    int negative = 0;
+
+    if (length > 0 && string[0] == '-') {
+        pos++;
+        negative = 1;
+    } else if (length > 0 && string[0] == '+') {
+        pos++;
+    }
+
+    cc_bignum_init(bn, (length - pos) / 8 + 1);
+    if (length - pos < 3 || string[pos] != '0' || (string[pos+1] != 'x' && string[pos+1] != 'X'))
+        return -1;
+    pos += 2;
+
+    /* Eight hex digits per limb, starting at the least significant end */
+    end = length;
+    while (end > pos) {
+        uint32_t limb = 0;
+        size_t start = end - pos > 8 ? end - 8 : pos;
+        for (i = start; i < end; i++) {
+            int v = cc_bignum_hex_value(string[i]);
+            if (v < 0)
+                return -1;
+            limb = (limb << 4) | v;
         }
+        bn->limbs[bn->length++] = limb;
+        end = start;
     }
-    n->number = realloc(n->number, n->length+1);
-    n->length++;
-    n->number[i] = carry;
+
+    bn->is_negative = negative;
+    cc_bignum_normalize(bn);
+    return 0;
+}
+
+void cc_bignum_destroy(struct cc_bignum *bn)
+{
+    if (bn->limbs && bn->limbs != bn->inline_limbs)
+        free(bn->limbs);
+    bn->limbs = NULL;
+    bn->length = 0;
 }
 
 int cc_bignum_is_zero(struct cc_bignum *n)
 {
-    int i;
-    if (n->length == 1 && n->number[0] == 0)
-        return 1;
-    for (i = 0; i < n->length; i++) {
-        if (n->number[i] != 0)
-            return 0;
-    }
-    return 1;
+    return n->length == 0;
 }
 
-/*
-  void cc_bignum_dump(struct cc_bignum *bn)
-  {
-      int i;
-      printf("BN: ");
-      for (i = 0; i < bn->length; i++) {
-          printf("%.2x ", bn->number[i]);
-      }
-      printf("\n");
-  }
-*/
+/* Upper bound for cc_bignum_stringify, including the sign and the terminating NUL */
+size_t cc_bignum_string_size(struct cc_bignum *bn)
+{
+    /* log10(2^32) < 10 */
+    return bn->length * 10 + 3;
+}
 
-void cc_bignum_stringify(struct cc_bignum *bn, char *out, size_t outlen)
+size_t cc_bignum_stringify(struct cc_bignum *bn, char *out, size_t outlen)
 {
-    struct cc_bignum cur;
-    size_t i, j, tmp_buf_len;
-    char *tmp_buf;
+    uint32_t scratch_inline[CC_BIGNUM_INLINE_LIMBS];
+    uint32_t *scratch;
+    size_t scratch_len, pos, len;
+
+    assert(outlen >= cc_bignum_string_size(bn));
 
     if (cc_bignum_is_zero(bn)) {
         out[0] = '0';
         out[1] = 0;
-        assert(outlen >= 2);
-        return;
+        return 1;
     }
 
-    tmp_buf_len = bn->length*4 + 2;
-    tmp_buf = calloc(1, tmp_buf_len);
+    scratch = bn->length <= CC_BIGNUM_INLINE_LIMBS ? scratch_inline : malloc(bn->length * sizeof(uint32_t));
+    assert(scratch);
+    memcpy(scratch, bn->limbs, bn->length * sizeof(uint32_t));
+    scratch_len = bn->length;
 
-    cc_bignum_copy(&cur, bn);
-    i = 0;
-
-    while (!cc_bignum_is_zero(&cur)) {
-        struct cc_bignum new;
-        uint8_t remain = cc_bignum_divide_8bit(&cur, 10, &new);
-        cc_bignum_destroy(&cur);
-        cc_bignum_move(&cur, &new);
-        tmp_buf[i++] = '0' + remain;
-        assert(i < tmp_buf_len);
+    /* Fill the buffer from the end, nine digits per division */
+    pos = outlen - 1;
+    out[pos] = 0;
+    while (scratch_len > 0) {
+        uint32_t chunk = cc_bignum_divmod(scratch, &scratch_len, CC_BIGNUM_CHUNK);
+        int i;
+        for (i = 0; i < CC_BIGNUM_CHUNK_DIGITS && (scratch_len > 0 || chunk); i++) {
+            out[--pos] = '0' + (chunk % 10);
+            chunk /= 10;
+        }
     }
-
     if (bn->is_negative)
-        tmp_buf[i++] = '-';
+        out[--pos] = '-';
 
-    assert(i < outlen);
+    len = outlen - 1 - pos;
+    memmove(out, out + pos, len + 1);
 
-    for (j = 0; j < i; j++) {
-        out[j] = tmp_buf[i-j-1];
-    }
-    out[i] = 0;
+    if (scratch != scratch_inline)
+        free(scratch);
 
-    free(tmp_buf);
-    cc_bignum_destroy(&cur);
+    return len;
 }
 
-size_t cc_bignum_byteify(struct cc_bignum *bn, unsigned char *out, size_t outlen)
+/* Upper bound for cc_bignum_hexify, including the sign, the 0x prefix and the terminating NUL */
+size_t cc_bignum_hex_size(struct cc_bignum *bn)
 {
-    struct cc_bignum copy;
-    size_t needed_bytes;
-    cc_bignum_copy(&copy, bn);
+    return bn->length * 8 + 5;
+}
 
-    assert(copy.length < outlen);
+size_t cc_bignum_hexify(struct cc_bignum *bn, char *out, size_t outlen)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t i, pos = 0;
+    int started = 0;
 
-    if (copy.is_negative) {
-        int i;
-        for (i = 0; i < copy.length; i++) {
-            copy.number[i] = ~copy.number[i];
+    assert(outlen >= cc_bignum_hex_size(bn));
+
+    if (bn->is_negative)
+        out[pos++] = '-';
+    out[pos++] = '0';
+    out[pos++] = 'x';
+
+    i = bn->length;
+    while (i > 0) {
+        int shift;
+        i--;
+        for (shift = 28; shift >= 0; shift -= 4) {
+            int v = (bn->limbs[i] >> shift) & 0xf;
+            if (v || started) {
+                out[pos++] = digits[v];
+                started = 1;
+            }
         }
-        cc_bignum_add(&copy, 1);
-        out[copy.length] = 0xff;
-    } else {
-        out[copy.length] = 0;
     }
+    if (!started)
+        out[pos++] = '0';
 
-    memcpy(out, copy.number, copy.length);
+    out[pos] = 0;
+    return pos;
+}
 
-    needed_bytes = copy.length+1;
-    while (needed_bytes > 1) {
-        if (out[needed_bytes-1] == out[copy.length]) {
-            if ((out[needed_bytes-1]&0x80) == (out[needed_bytes-2]&0x80)) {
-                needed_bytes--;
-                continue;
-            }
+/* Upper bound for cc_bignum_byteify */
+size_t cc_bignum_byte_size(struct cc_bignum *bn)
+{
+    return bn->length * 4 + 1;
+}
+
+/* Minimal big-endian two's complement */
+size_t cc_bignum_byteify(struct cc_bignum *bn, unsigned char *out, size_t outlen)
+{
+    size_t i, total, start;
+    uint64_t carry;
+    unsigned char sign;
+
+    assert(outlen >= cc_bignum_byte_size(bn));
+
+    total = bn->length * 4 + 1;
+    sign = bn->is_negative ? 0xff : 0;
+    out[0] = sign;
+
+    carry = 1;
+    for (i = 0; i < bn->length; i++) {
+        uint32_t limb = bn->limbs[i];
+        unsigned char *p = out + total - 4 * (i + 1);
+        if (bn->is_negative) {
+            carry += (uint32_t)~limb;
+            limb = (uint32_t)carry;
+            carry >>= 32;
         }
-        break;
+        p[0] = limb >> 24;
+        p[1] = limb >> 16;
+        p[2] = limb >> 8;
+        p[3] = limb;
     }
 
-    cc_bignum_destroy(&copy);
+    /* Drop leading bytes that only repeat the sign */
+    start = 0;
+    while (start < total - 1 && out[start] == sign && (out[start+1] & 0x80) == (sign & 0x80))
+        start++;
 
-    return needed_bytes;
+    memmove(out, out + start, total - start);
+    return total - start;
 }
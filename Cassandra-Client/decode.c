@@ -15,24 +15,65 @@ static void decode_bigint  (pTHX_ unsigned char *input, STRLEN len, struct cc_ty
 #endif
 static void decode_blob    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
 static void decode_boolean (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_date    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_decimal (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
+static void decode_date    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
+static void decode_decimal (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
 static void decode_double  (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
 static void decode_float   (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
 static void decode_inet    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
 static void decode_int     (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_list    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_map     (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
+static void decode_list    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
+static void decode_map     (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
 static void decode_smallint(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_time    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
+static void decode_time    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
 static void decode_tinyint (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_tuple   (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_udt     (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
+static void decode_tuple   (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
+static void decode_udt     (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
 static void decode_utf8    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
 static void decode_uuid    (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
-static void decode_varint  (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output);
+static void decode_varint  (pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output);
 
-void decode_cell(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_type *type, SV *output)
+/* Collection elements are mostly small strings and ints. For those we can skip the generic path:
+ * build the SV in one go, instead of creating an empty one and upgrading it. Returns NULL (without
+ * moving *pos) when the element needs decode_cell. Never croaks after allocating, so the caller
+ * doesn't need to own the SV first. */
+static SV *decode_simple_element(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_type *type)
+{
+    unsigned char *bytes;
+    STRLEN bytes_len, start;
+
+    switch (type->type_id) {
+    case CC_TYPE_VARCHAR:
+    case CC_TYPE_TEXT:
+    case CC_TYPE_ASCII:
+    case CC_TYPE_BLOB:
+    case CC_TYPE_INT:
+        break;
+    default:
+        return NULL;
+    }
+
+    start = *pos;
+    if (unpack_bytes(aTHX_ input, len, pos, &bytes, &bytes_len) != 0)
+        return newSV(0);
+
+    switch (type->type_id) {
+    case CC_TYPE_VARCHAR:
+    case CC_TYPE_TEXT:
+        return newSVpvn_flags((char*)bytes, bytes_len, SVf_UTF8);
+    case CC_TYPE_ASCII:
+    case CC_TYPE_BLOB:
+        return newSVpvn((char*)bytes, bytes_len);
+    case CC_TYPE_INT:
+        if (bytes_len == 4)
+            return newSViv((int32_t)ntohl(*(uint32_t*)bytes));
+        break;
+    }
+
+    *pos = start;
+    return NULL;
+}
+
+void decode_cell(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_type *type, int flags, SV *output)
 {
     unsigned char *bytes;
     STRLEN bytes_len;
@@ -64,7 +105,7 @@ void decode_cell(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_
 
         case CC_TYPE_SET:
         case CC_TYPE_LIST:
-            decode_list(aTHX_ bytes, bytes_len, type, output);
+            decode_list(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         case CC_TYPE_UUID:
@@ -81,7 +122,7 @@ void decode_cell(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_
             break;
 
         case CC_TYPE_DECIMAL:
-            decode_decimal(aTHX_ bytes, bytes_len, type, output);
+            decode_decimal(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         case CC_TYPE_VARINT:
@@ -91,27 +132,27 @@ void decode_cell(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_
         case CC_TYPE_SMALLINT:
         case CC_TYPE_TINYINT:
         case CC_TYPE_INT:
-            decode_varint(aTHX_ bytes, bytes_len, type, output);
+            decode_varint(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         case CC_TYPE_DATE:
-            decode_date(aTHX_ bytes, bytes_len, type, output);
+            decode_date(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         case CC_TYPE_TIME:
-            decode_time(aTHX_ bytes, bytes_len, type, output);
+            decode_time(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         case CC_TYPE_MAP:
-            decode_map(aTHX_ bytes, bytes_len, type, output);
+            decode_map(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         case CC_TYPE_UDT:
-            decode_udt(aTHX_ bytes, bytes_len, type, output);
+            decode_udt(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         case CC_TYPE_TUPLE:
-            decode_tuple(aTHX_ bytes, bytes_len, type, output);
+            decode_tuple(aTHX_ bytes, bytes_len, type, flags, output);
             break;
 
         default:
@@ -246,7 +287,7 @@ void decode_inet(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, S
     }
 }
 
-void decode_list(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+void decode_list(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
     struct cc_type *inner_type;
     int i;
@@ -269,13 +310,22 @@ void decode_list(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, S
     sv_setsv(output, the_rv);
     SvREFCNT_dec(the_rv);
 
+    /* Every element takes at least four bytes, so a corrupt count can't make us allocate much */
+    if (num_elements > 0 && num_elements <= (len - 4) / 4)
+        av_extend(the_list, num_elements - 1);
+
     pos = 4;
 
     for (i = 0; i < num_elements; i++) {
-        SV *decoded = newSV(0);
-        av_push(the_list, decoded);
+        SV *decoded = decode_simple_element(aTHX_ input, len, &pos, inner_type);
+        if (decoded) {
+            av_push(the_list, decoded);
+            continue;
+        }
 
-        decode_cell(aTHX_ input, len, &pos, inner_type, decoded);
+        decoded = newSV(0);
+        av_push(the_list, decoded);
+        decode_cell(aTHX_ input, len, &pos, inner_type, flags, decoded);
     }
 }
 
@@ -291,33 +341,62 @@ void decode_uuid(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, S
         input[12], input[13], input[14], input[15]);
 }
 
-void decode_decimal(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+/* Writes v right-aligned ending at end, zero-padded to at least min_digits. Returns the start */
+static char *format_digits(char *end, uint64_t v, int min_digits)
+{
+    char *p = end;
+    do {
+        *--p = '0' + (v % 10);
+        v /= 10;
+        min_digits--;
+    } while (v || min_digits > 0);
+    return p;
+}
+
+void decode_decimal(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
     union {
         unsigned char bytes[4];
         int32_t scale;
     } bytes_or_scale;
+    int64_t exponent;
 
     if (UNLIKELY(len < 5))
         croak("decode_decimal: len < 5");
 
     memcpy(bytes_or_scale.bytes, input, 4);
     bswap4(bytes_or_scale.bytes);
-    bytes_or_scale.scale *= -1;
 
-    decode_varint(aTHX_ input+4, len-4, type, output);
-    if (bytes_or_scale.scale != 0) {
-        char *sign;
-        if (bytes_or_scale.scale > 0) {
-            sign = "+";
-        } else {
-            sign = "";
-        }
-        sv_catpvf(output, "e%s%d", sign, bytes_or_scale.scale);
+    if (flags & CC_DECODE_DECIMAL_PAIR) {
+        AV *pair;
+        SV *unscaled, *the_rv;
+
+        pair = newAV();
+        the_rv = newRV_noinc((SV*)pair);
+        sv_setsv(output, the_rv);
+        SvREFCNT_dec(the_rv);
+
+        unscaled = newSV(0);
+        av_push(pair, unscaled);
+        av_push(pair, newSViv(bytes_or_scale.scale));
+        decode_varint(aTHX_ input+4, len-4, type, flags, unscaled);
+        return;
+    }
+
+    /* A hex mantissa followed by an exponent would just be confusing */
+    decode_varint(aTHX_ input+4, len-4, type, flags & ~CC_DECODE_VARINT_HEX, output);
+
+    exponent = -(int64_t)bytes_or_scale.scale;
+    if (exponent != 0) {
+        char buf[16], *p;
+        p = format_digits(buf+16, exponent > 0 ? exponent : -exponent, 1);
+        *--p = exponent > 0 ? '+' : '-';
+        *--p = 'e';
+        sv_catpvn(output, p, buf+16-p);
     }
 }
 
-void decode_varint(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+void decode_varint(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
     if (UNLIKELY(len <= 0)) {
         croak("decode_varint: len <= 0");
@@ -346,150 +425,121 @@ void decode_varint(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type,
         decode_bigint(aTHX_ input, len, type, output);
 #endif
     } else {
-        unsigned char *tmp;
-        char *tmpout;
         struct cc_bignum bn;
-        int i;
-
-        Newxz(tmpout, (len*4)+2, char);
+        size_t size;
+        char *out;
 
-        Newxz(tmp, len, unsigned char);
-        for (i = 0; i < len; i++) {
-            tmp[len-i-1] = (unsigned char)input[i];
-        }
+        cc_bignum_init_bytes(&bn, input, len);
 
-        cc_bignum_init_bytes(&bn, tmp, len);
-
-        cc_bignum_stringify(&bn, tmpout, (len*4)+2);
-        sv_setpv(output, tmpout);
+        /* Stringify straight into the output SV */
+        size = (flags & CC_DECODE_VARINT_HEX) ? cc_bignum_hex_size(&bn) : cc_bignum_string_size(&bn);
+        sv_setpvn(output, "", 0);
+        out = SvGROW(output, size);
+        if (flags & CC_DECODE_VARINT_HEX)
+            SvCUR_set(output, cc_bignum_hexify(&bn, out, size));
+        else
+            SvCUR_set(output, cc_bignum_stringify(&bn, out, size));
 
         cc_bignum_destroy(&bn);
-        Safefree(tmp);
-        Safefree(tmpout);
     }
 }
 
-/* fun fact: fmod() doesn't actually implement the modulo operation... */
-double fmod_properly(double x, double y)
-{
-    double mod = fmod(x, y);
-    if (mod < 0)
-        mod += y;
-    return mod;
-}
-
-void decode_date(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+void decode_date(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
-    uint32_t ind;
-    double f, e, J, h, g, Y, M, D;
+    int64_t days, z, era, doe, yoe, doy, mp, y, m, d;
+    char buf[32], *p;
 
     if (UNLIKELY(len != 4))
         croak("decode_date: len != 4");
 
-    ind = ntohl(*(uint32_t*)input);
-
-    /* This is why unit tests exist. :-) */
-    J = ind;
-    J -= 0x80000000 - 2440588;
+    /* Days since the epoch, stored with a 2^31 bias */
+    days = (int64_t)ntohl(*(uint32_t*)input) - 0x80000000LL;
 
-    f = J + 1401 + floor((floor((4 * J + 274277) / 146097) * 3) / 4) - 38;
-    e = (4 * f) + 3;
-    g = floor(fmod_properly(e, 1461) / 4);
-    h = 5 * g + 2;
-    D = floor(fmod_properly(h, 153) / 5) + 1;
-    M = fmod_properly((floor(h / 153) + 2), 12) + 1;
-    Y = floor(e / 1461) - 4716 + floor((12 + 2 - M) / 12);
+    if (flags & CC_DECODE_DATE_DAYS) {
+        sv_setiv(output, (IV)days);
+        return;
+    }
 
-    sv_setpvf(output, "%.0lf-%02.0lf-%02.0lf", Y, M, D);
+    /* Proleptic Gregorian calendar, see http://howardhinnant.github.io/date_algorithms.html#civil_from_days */
+    z = days + 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = z - era * 146097;
+    yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    doy = doe - (365*yoe + yoe/4 - yoe/100);
+    mp = (5*doy + 2) / 153;
+    d = doy - (153*mp + 2)/5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2);
+
+    p = format_digits(buf+32, d, 2);
+    *--p = '-';
+    p = format_digits(p, m, 2);
+    *--p = '-';
+    p = format_digits(p, y < 0 ? -y : y, 1);
+    if (y < 0)
+        *--p = '-';
+
+    sv_setpvn(output, p, buf+32-p);
 }
 
-#ifdef CAN_64BIT
-void decode_time(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+void decode_time(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
-    int64_t nano, seconds, hours, minutes;
-    STRLEN pvlen;
-    char *result;
-
-    union {
-        unsigned char bytes[8];
-        int64_t bigint;
-    } bytes_or_bigint;
+    int64_t value, nano, seconds, hours, minutes;
+    char buf[32], *p, *end;
+    int i;
 
     if (UNLIKELY(len != 8))
         croak("decode_time: len != 8");
 
-    memcpy(bytes_or_bigint.bytes, input, 8);
-    bswap8(bytes_or_bigint.bytes);
+    value = 0;
+    for (i = 0; i < 8; i++)
+        value = (value << 8) | input[i];
 
-    if (UNLIKELY(bytes_or_bigint.bigint < 0 || bytes_or_bigint.bigint > 86399999999999))
+    if (UNLIKELY(value < 0 || value > 86399999999999LL))
         croak("decode_time: invalid value");
 
-    nano =    bytes_or_bigint.bigint % 1000000000;
-    seconds = bytes_or_bigint.bigint / 1000000000;
-    hours =   seconds / 3600;
-    minutes = (seconds % 3600) / 60;
-    seconds = seconds % 60;
-
-    sv_setpvf(output, "%lld:%.2lld:%.2lld.%lld", hours, minutes, seconds, nano);
-    result = SvPV(output, pvlen);
-    while (result[pvlen-1] == '0')
-        pvlen--;
-    if (result[pvlen-1] == '.')
-        pvlen--;
-    SvCUR_set(output, pvlen);
-}
+    if (flags & CC_DECODE_TIME_NANOSECONDS) {
+#ifdef CAN_64BIT
+        sv_setiv(output, (IV)value);
 #else
-/* 32bit compat */
-void decode_time(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
-{
-    int32_t nano, seconds, hours, minutes;
-    char *txt;
-    char workbuf[20];
-    STRLEN txt_len;
-
-    decode_varint(aTHX_ input, len, type, output);
-    /* output now contains a string represending the ns since midnight */
-
-    txt = SvPV(output, txt_len);
-    if (txt_len > 14) {
-        croak("decode_time: invalid value");
-    }
-
-    if (txt_len <= 9) {
-        memset(workbuf, 0, 20);
-        memcpy(workbuf, txt, txt_len);
-        seconds = 0;
-        nano = atoi(workbuf);
-    } else {
-        memset(workbuf, 0, 20);
-        memcpy(workbuf, txt+txt_len-9, 9);
-        nano = atoi(workbuf);
-        memset(workbuf, 0, 20);
-        memcpy(workbuf, txt, txt_len-9);
-        seconds = atoi(workbuf);
+        /* Doubles are exact up to 2^53, which is plenty for a day's worth of nanoseconds */
+        sv_setnv(output, (NV)value);
+#endif
+        return;
     }
 
-    hours   = seconds / 3600;
+    nano =    value % 1000000000;
+    seconds = value / 1000000000;
+    hours =   seconds / 3600;
     minutes = (seconds % 3600) / 60;
     seconds = seconds % 60;
 
-    sv_setpvf(output, "%d:%.2d:%.2d.%d", hours, minutes, seconds, nano);
-    txt = SvPV(output, txt_len);
-    while (txt[txt_len-1] == '0')
-        txt_len--;
-    if (txt[txt_len-1] == '.')
-        txt_len--;
-    SvCUR_set(output, txt_len);
+    /* Format as H:MM:SS.fraction, dropping trailing zeroes from the fraction */
+    end = buf+32;
+    p = end;
+    if (nano) {
+        p = format_digits(p, nano, 9);
+        while (end[-1] == '0')
+            end--;
+        *--p = '.';
+    }
+    p = format_digits(p, seconds, 2);
+    *--p = ':';
+    p = format_digits(p, minutes, 2);
+    *--p = ':';
+    p = format_digits(p, hours, 1);
+
+    sv_setpvn(output, p, end-p);
 }
-#endif
 
-void decode_map(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+void decode_map(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
     struct cc_type *key_type, *value_type;
     int i;
     STRLEN pos;
     HV *the_map;
-    SV *the_rv;
+    SV *the_rv, *key;
+    int string_keys, utf8_keys, is_simple;
 
     key_type = &type->inner_type[0];
     value_type = &type->inner_type[1];
@@ -507,23 +557,52 @@ void decode_map(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV
     sv_setsv(output, the_rv);
     SvREFCNT_dec(the_rv);
 
+    if (num_elements > 0 && num_elements <= (len - 4) / 8)
+        hv_ksplit(the_map, num_elements);
+
+    /* Text and blob keys go into the hash straight from the input buffer. Anything else needs
+     * decoding into an SV first; we reuse one for all entries, as the hash copies the key anyway. */
+    string_keys = key_type->type_id == CC_TYPE_VARCHAR || key_type->type_id == CC_TYPE_TEXT ||
+                  key_type->type_id == CC_TYPE_ASCII || key_type->type_id == CC_TYPE_BLOB;
+    utf8_keys = key_type->type_id == CC_TYPE_VARCHAR || key_type->type_id == CC_TYPE_TEXT;
+    key = NULL;
+
     pos = 4;
 
     for (i = 0; i < num_elements; i++) {
-        SV *key, *value;
+        unsigned char *key_bytes;
+        STRLEN key_len, key_pos;
+        SV *value;
+        int have_key;
+
+        key_pos = pos;
+        have_key = string_keys && unpack_bytes(aTHX_ input, len, &pos, &key_bytes, &key_len) == 0;
+        if (!have_key) {
+            pos = key_pos;
+            if (!key)
+                key = sv_newmortal();
+            decode_cell(aTHX_ input, len, &pos, key_type, flags, key);
+        }
 
-        key = newSV(0);
-        sv_2mortal(key);
-        decode_cell(aTHX_ input, len, &pos, key_type, key);
+        value = decode_simple_element(aTHX_ input, len, &pos, value_type);
+        is_simple = value != NULL;
+        if (!is_simple)
+            value = newSV(0);
 
-        value = newSV(0);
-        hv_store_ent(the_map, key, value, 0);
+        if (have_key) {
+            /* A negative length marks the key as UTF-8 */
+            hv_common_key_len(the_map, (char*)key_bytes, utf8_keys ? -(I32)key_len : (I32)key_len,
+                    HV_FETCH_ISSTORE, value, 0);
+        } else {
+            hv_store_ent(the_map, key, value, 0);
+        }
 
-        decode_cell(aTHX_ input, len, &pos, value_type, value);
+        if (!is_simple)
+            decode_cell(aTHX_ input, len, &pos, value_type, flags, value);
     }
 }
 
-void decode_udt(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+void decode_udt(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
     struct cc_udt *udt;
     int i;
@@ -539,6 +618,8 @@ void decode_udt(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV
     udt = type->udt;
     assert(udt && udt->fields);
 
+    hv_ksplit(the_obj, udt->field_count);
+
     pos = 0;
 
     for (i = 0; i < udt->field_count; i++) {
@@ -550,15 +631,19 @@ void decode_udt(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV
         SV *value;
 
         field = &udt->fields[i];
-        value = newSV(0);
+        value = decode_simple_element(aTHX_ input, len, &pos, &field->type);
+        if (value) {
+            hv_store_ent(the_obj, field->name, value, field->name_hash);
+            continue;
+        }
 
+        value = newSV(0);
         hv_store_ent(the_obj, field->name, value, field->name_hash);
-
-        decode_cell(aTHX_ input, len, &pos, &field->type, value);
+        decode_cell(aTHX_ input, len, &pos, &field->type, flags, value);
     }
 }
 
-void decode_tuple(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, SV *output)
+void decode_tuple(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type, int flags, SV *output)
 {
     SV *the_rv;
     AV *the_tuple;
@@ -574,13 +659,21 @@ void decode_tuple(pTHX_ unsigned char *input, STRLEN len, struct cc_type *type,
     tuple = type->tuple;
     assert(tuple);
 
+    if (tuple->field_count > 0)
+        av_extend(the_tuple, tuple->field_count - 1);
+
     pos = 0;
 
     for (i = 0; i < tuple->field_count; i++) {
         struct cc_type *type = &tuple->fields[i];
-        SV *decoded = newSV(0);
-        av_push(the_tuple, decoded);
+        SV *decoded = decode_simple_element(aTHX_ input, len, &pos, type);
+        if (decoded) {
+            av_push(the_tuple, decoded);
+            continue;
+        }
 
-        decode_cell(aTHX_ input, len, &pos, type, decoded);
+        decoded = newSV(0);
+        av_push(the_tuple, decoded);
+        decode_cell(aTHX_ input, len, &pos, type, flags, decoded);
     }
 }
@@ -17,6 +17,16 @@
 #define CC_METADATA_FLAG_HAS_MORE_PAGES     2
 #define CC_METADATA_FLAG_NO_METADATA        4
 
+#define CC_BATCH_FLAG_SERIAL_CONSISTENCY    0x10
+#define CC_BATCH_FLAG_DEFAULT_TIMESTAMP     0x20
+#define CC_BATCH_FLAG_NAMED_VALUES          0x40
+
+/* Alternative output formats for decode_cell. Keep in sync with Cassandra::Client::Protocol */
+#define CC_DECODE_DATE_DAYS                 0x01
+#define CC_DECODE_TIME_NANOSECONDS          0x02
+#define CC_DECODE_DECIMAL_PAIR              0x04
+#define CC_DECODE_VARINT_HEX                0x08
+
 #define CC_TYPE_CUSTOM    0x0000
 #define CC_TYPE_ASCII     0x0001
 #define CC_TYPE_BIGINT    0x0002
@@ -78,11 +88,20 @@ struct cc_tuple {
     struct cc_type *fields;
 };
 
+/* An interned type, shared by every column that has it. See cc_type_intern. */
+struct cc_type_entry {
+    struct cc_type type;
+    U32 refcount;
+    STRLEN key_len;
+    char key[1];
+};
+
 struct cc_column {
     SV *keyspace;
     SV *table;
     SV *name;
     struct cc_type type;
+    struct cc_type_entry *type_entry; /* If set, type is a shallow copy of type_entry->type */
     U32 name_hash;
 };
 
@@ -362,42 +362,98 @@ void encode_inet(pTHX_ SV *dest, SV *src)
     }
 }
 
-void encode_time(pTHX_ SV *dest, SV *src)
+/* A plain (optionally negative) integer in a string, as given for date and time columns in their
+ * numeric formats. Returns false for anything else. */
+static int parse_integer_string(const char *ptr, STRLEN size, int64_t *out)
+{
+    STRLEN i = 0;
+    int negative = 0;
+    int64_t value = 0;
+
+    if (size > 0 && ptr[0] == '-') {
+        negative = 1;
+        i++;
+    }
+    if (i == size || size - i > 18)
+        return 0;
+    for (; i < size; i++) {
+        if (ptr[i] < '0' || ptr[i] > '9')
+            return 0;
+        value = (value * 10) + (ptr[i] - '0');
+    }
+
+    *out = negative ? -value : value;
+    return 1;
+}
+
+static void encode_time_nanoseconds(pTHX_ SV *dest, int64_t value)
 {
     unsigned char out[12];
-    STRLEN size, i, j, k;
-    char *ptr;
-    int numbers[4];
-    int seconds, nano;
+    int i;
+
+    if (UNLIKELY(value < 0 || value > 86399999999999LL))
+        croak("Time '%" IVdf "' is out of range", (IV)value);
 
     memset(out, 0, 12);
     out[3] = 8;
+    for (i = 11; i >= 4; i--) {
+        out[i] = value & 0xff;
+        value >>= 8;
+    }
+    sv_catpvn(dest, (char*)out, 12);
+}
 
-    numbers[0] = numbers[1] = numbers[2] = numbers[3] = 0;
+void encode_time(pTHX_ SV *dest, SV *src)
+{
+    STRLEN size, i;
+    char *orig, *ptr;
+    int64_t numbers[4], value;
+    int j, digits;
+
+    /* Numbers are nanoseconds since midnight, as produced when decoding with CC_DECODE_TIME_NANOSECONDS.
+     * Strings of digits count as numbers too, whatever Perl last used them for. */
+    if ((SvIOK(src) || SvNOK(src)) && !SvPOK(src)) {
+        encode_time_nanoseconds(aTHX_ dest, SvIOK(src) ? (int64_t)SvIV(src) : (int64_t)SvNV(src));
+        return;
+    }
 
-    ptr = SvPV(src, size);
-    for (i = 0, j = 0; i < size; i++) {
-        if (ptr[i] == ':' || ptr[i] == '.') {
+    /* Surrounding whitespace is ignored, as it always has been */
+    orig = SvPV(src, size);
+    ptr = orig;
+    while (size > 0 && isSPACE(ptr[0])) {
+        ptr++;
+        size--;
+    }
+    while (size > 0 && isSPACE(ptr[size-1]))
+        size--;
+
+    if (parse_integer_string(ptr, size, &value)) {
+        encode_time_nanoseconds(aTHX_ dest, value);
+        return;
+    }
+
+    /* Otherwise it has to be H:MM[:SS], with up to nine digits of fractional seconds */
+    numbers[0] = numbers[1] = numbers[2] = numbers[3] = 0;
+    for (i = 0, j = 0, digits = 0; i < size; i++) {
+        if (ptr[i] >= '0' && ptr[i] <= '9') {
+            if (UNLIKELY(++digits > (j == 3 ? 9 : 2)))
+                croak("Time '%s' is invalid", orig);
+            numbers[j] = (numbers[j] * 10) + (ptr[i] - '0');
+        } else if (((ptr[i] == ':' && j < 2) || (ptr[i] == '.' && j == 2)) && digits) {
             j++;
-            k = 0;
-            if (j > 3)
-                croak("Time '%s' is invalid", ptr);
-        } else if (ptr[i] >= '0' && ptr[i] <= '9') {
-            numbers[j] *= 10;
-            numbers[j] += ptr[i]-'0';
-            k++;
+            digits = 0;
+        } else {
+            croak("Time '%s' is invalid", orig);
         }
     }
-    if (j == 3 && numbers[3] > 0) {
-        for (; k<9; k++)
+    if (UNLIKELY(j < 1 || !digits || numbers[1] > 59 || numbers[2] > 59))
+        croak("Time '%s' is invalid", orig);
+    if (j == 3) {
+        for (; digits < 9; digits++)
             numbers[3] *= 10;
     }
 
-    nano = numbers[3];
-    seconds = (((numbers[0]%24) * 3600) + (numbers[1] * 60) + numbers[2]) % 86400;
-    *((int64_t*)(out+4)) = (((int64_t)seconds)*1000000000L) + (int64_t)nano;
-    bswap8(out+4);
-    sv_catpvn(dest, (char*)out, 12);
+    encode_time_nanoseconds(aTHX_ dest, ((((numbers[0] % 24) * 3600) + (numbers[1] * 60) + numbers[2]) * 1000000000LL) + numbers[3]);
 }
 
 static inline int div_properly(int a, int b)
@@ -408,41 +464,59 @@ static inline int div_properly(int a, int b)
     return n;
 }
 
+static void encode_date_days(pTHX_ SV *dest, int64_t days)
+{
+    if (UNLIKELY(days < -2147483648LL || days > 2147483647LL))
+        croak("Date '%" IVdf "' is out of range", (IV)days);
+    pack_int(aTHX_ dest, 4);
+    pack_int(aTHX_ dest, (int32_t)((uint32_t)days ^ 0x80000000U));
+}
+
 void encode_date(pTHX_ SV *dest, SV *src)
 {
-    int negative_year, numbers[3], i, v_a, y, m, jdn;
+    int negative_year, numbers[3], i, v_a, y, m, jdn, digits;
+    int64_t days;
     char *ptr;
     STRLEN size, pos;
 
-    numbers[0] = numbers[1] = numbers[2] = 0;
+    /* Numbers are days since the epoch, as produced when decoding with CC_DECODE_DATE_DAYS. Strings
+     * of digits count as numbers too, whatever Perl last used them for. */
+    if ((SvIOK(src) || SvNOK(src)) && !SvPOK(src)) {
+        encode_date_days(aTHX_ dest, SvIOK(src) ? (int64_t)SvIV(src) : (int64_t)SvNV(src));
+        return;
+    }
 
     ptr = SvPV(src, size);
-    if (UNLIKELY(size < 5))
-        croak("Date '%s' is invalid", ptr);
+    if (parse_integer_string(ptr, size, &days)) {
+        encode_date_days(aTHX_ dest, days);
+        return;
+    }
+
+    /* Otherwise it has to be [-]Y-M-D */
+    numbers[0] = numbers[1] = numbers[2] = 0;
 
     pos = 0;
-    if (ptr[pos] == '-') {
+    if (size > 0 && ptr[pos] == '-') {
         pos++;
         negative_year = 1;
     } else {
         negative_year = 0;
     }
 
-    i = 0;
-    while (pos < size) {
-        if (ptr[pos] == '-') {
-            i++;
-            if (UNLIKELY(i >= 3))
+    for (i = 0, digits = 0; pos < size; pos++) {
+        if (ptr[pos] >= '0' && ptr[pos] <= '9') {
+            if (UNLIKELY(++digits > (i == 0 ? 7 : 2)))
                 croak("Date '%s' is invalid", ptr);
-        } else if (ptr[pos] >= '0' && ptr[pos] <= '9') {
-            numbers[i] *= 10;
-            numbers[i] += ptr[pos] - '0';
+            numbers[i] = (numbers[i] * 10) + (ptr[pos] - '0');
+        } else if (ptr[pos] == '-' && i < 2 && digits) {
+            i++;
+            digits = 0;
         } else {
             croak("Date '%s' is invalid", ptr);
         }
-
-        pos++;
     }
+    if (UNLIKELY(i != 2 || !digits))
+        croak("Date '%s' is invalid", ptr);
 
     if (negative_year)
         numbers[0] *= -1;
@@ -462,14 +536,26 @@ void encode_date(pTHX_ SV *dest, SV *src)
     pack_int(aTHX_ dest, jdn);
 }
 
+/* [+-]0x..., as produced when decoding with CC_DECODE_VARINT_HEX */
+static int is_hex_number(char *ptr, STRLEN size)
+{
+    if (size > 0 && (ptr[0] == '-' || ptr[0] == '+')) {
+        ptr++;
+        size--;
+    }
+    return size > 2 && ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X');
+}
+
 void encode_varint(pTHX_ SV *dest, SV *src, int* int_out)
 {
     char *ptr;
     STRLEN size;
+    int is_hex;
 
     ptr = SvPV(src, size);
+    is_hex = is_hex_number(ptr, size);
 #ifdef CAN_64BIT
-    if (size <= 18) {
+    if (size <= 18 && !is_hex) {
         int i;
         union {
             int64_t number;
@@ -478,7 +564,7 @@ void encode_varint(pTHX_ SV *dest, SV *src, int* int_out)
         stuff.number = SvIV(src);
         bswap8(stuff.bytes);
 #else
-    if (size <= 9) {
+    if (size <= 9 && !is_hex) {
         int i;
         union {
             int32_t number;
@@ -508,27 +594,28 @@ void encode_varint(pTHX_ SV *dest, SV *src, int* int_out)
 
     } else {
         struct cc_bignum bn;
-        unsigned char *tmp, *tmp2;
-        size_t encoded_len, i;
+        STRLEN size_pos = 0;
+        size_t encoded_len, max_len;
+        unsigned char *out;
 
-        cc_bignum_init_string(&bn, ptr, size);
+        if (UNLIKELY((is_hex ? cc_bignum_init_hex(&bn, ptr, size) : cc_bignum_init_string(&bn, ptr, size)) != 0)) {
+            cc_bignum_destroy(&bn);
+            croak("encode_varint: '%s' is not a valid number", ptr);
+        }
 
-        Newxz(tmp, bn.length+2, unsigned char);
-        Newxz(tmp2, bn.length+2, unsigned char);
+        if (!int_out)
+            size_pos = pack_int(aTHX_ dest, 0);
 
-        encoded_len = cc_bignum_byteify(&bn, tmp, bn.length+2);
-        for (i = 0; i < encoded_len; i++) {
-            tmp2[i] = tmp[encoded_len-1-i];
-        }
+        /* Write the bytes straight into dest */
+        max_len = cc_bignum_byte_size(&bn);
+        out = (unsigned char*)SvGROW(dest, SvCUR(dest)+max_len+1) + SvCUR(dest);
+        encoded_len = cc_bignum_byteify(&bn, out, max_len);
+        SvCUR_set(dest, SvCUR(dest)+encoded_len);
 
         if (int_out)
             *int_out= encoded_len;
         else
-            pack_int(aTHX_ dest, encoded_len);
-        sv_catpvn(dest, (char*)tmp2, encoded_len);
-
-        Safefree(tmp);
-        Safefree(tmp2);
+            set_packed_int(aTHX_ dest, size_pos, encoded_len);
 
         cc_bignum_destroy(&bn);
     }
@@ -541,6 +628,23 @@ void encode_decimal(pTHX_ SV *dest, SV *src)
     STRLEN size, size_pos, pos;
     int scale, varint_len;
 
+    /* [ unscaled, scale ], as produced when decoding with CC_DECODE_DECIMAL_PAIR */
+    if (SvROK(src) && SvTYPE(SvRV(src)) == SVt_PVAV) {
+        AV *pair = (AV*)SvRV(src);
+        SV **unscaled, **scale_sv;
+
+        unscaled = av_fetch(pair, 0, 0);
+        scale_sv = av_fetch(pair, 1, 0);
+        if (UNLIKELY(av_len(pair) != 1 || !unscaled || !scale_sv || !SvOK(*unscaled)))
+            croak("encode_decimal: expected [ unscaled, scale ]");
+
+        size_pos = pack_int(aTHX_ dest, 0);
+        pack_int(aTHX_ dest, SvIV(*scale_sv));
+        encode_varint(aTHX_ dest, *unscaled, &varint_len);
+        set_packed_int(aTHX_ dest, size_pos, 4+varint_len);
+        return;
+    }
+
     ptr = SvPV(src, size);
 
     tmp = sv_2mortal(newSV(size));
@@ -552,7 +656,7 @@ void encode_decimal(pTHX_ SV *dest, SV *src)
 
     if (ptr[pos] == '-') {
         pos++;
-        sv_catpvn(tmp, ptr+pos, 1);
+        sv_catpvn(tmp, "-", 1);
     }
     for (; pos < size && ptr[pos] >= '0' && ptr[pos] <= '9'; pos++) {
         /* Main number */
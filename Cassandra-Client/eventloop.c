@@ -0,0 +1,486 @@
+#define PERL_NO_GET_CONTEXT
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include <stdint.h>
+#include "eventloop.h"
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#define CC_LOOP_MAX_EVENTS 64
+#define CC_LOOP_READ_SIZE 16384
+#define CC_LOOP_COMPACT_MIN 1024
+
+static double cc_loop_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* Timer heap */
+static int cc_timer_before(struct cc_loop_timer *a, struct cc_loop_timer *b)
+{
+    if (a->at != b->at)
+        return a->at < b->at;
+    return a->seq < b->seq;
+}
+
+static void cc_heap_sift_up(struct cc_loop *loop, int i)
+{
+    struct cc_loop_timer item = loop->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!cc_timer_before(&item, &loop->heap[parent]))
+            break;
+        loop->heap[i] = loop->heap[parent];
+        i = parent;
+    }
+    loop->heap[i] = item;
+}
+
+static void cc_heap_sift_down(struct cc_loop *loop, int i)
+{
+    struct cc_loop_timer item = loop->heap[i];
+    int len = loop->heap_len;
+    for (;;) {
+        int child = (i * 2) + 1;
+        if (child >= len)
+            break;
+        if (child + 1 < len && cc_timer_before(&loop->heap[child+1], &loop->heap[child]))
+            child++;
+        if (!cc_timer_before(&loop->heap[child], &item))
+            break;
+        loop->heap[i] = loop->heap[child];
+        i = child;
+    }
+    loop->heap[i] = item;
+}
+
+static void cc_timer_free(pTHX_ struct cc_loop_timer *timer)
+{
+    SvREFCNT_dec(timer->callback);
+    SvREFCNT_dec(timer->connection);
+    SvREFCNT_dec(timer->dismissed);
+}
+
+static int cc_timer_is_dismissed(pTHX_ struct cc_loop_timer *timer)
+{
+    return timer->dismissed && SvTRUE(timer->dismissed);
+}
+
+/* Deadlines are dismissed by Perl without telling us, so they stay in the heap until they
+ * expire. Under load that can be a lot of them; every now and then we clean them up. */
+static void cc_heap_compact(pTHX_ struct cc_loop *loop)
+{
+    int i, j;
+    for (i = 0, j = 0; i < loop->heap_len; i++) {
+        if (cc_timer_is_dismissed(aTHX_ &loop->heap[i])) {
+            cc_timer_free(aTHX_ &loop->heap[i]);
+        } else {
+            loop->heap[j++] = loop->heap[i];
+        }
+    }
+    loop->heap_len = j;
+    for (i = (j / 2) - 1; i >= 0; i--)
+        cc_heap_sift_down(loop, i);
+
+    loop->compact_at = j * 2;
+    if (loop->compact_at < CC_LOOP_COMPACT_MIN)
+        loop->compact_at = CC_LOOP_COMPACT_MIN;
+}
+
+static void cc_heap_push(pTHX_ struct cc_loop *loop, struct cc_loop_timer *timer)
+{
+    if (loop->heap_len >= loop->compact_at)
+        cc_heap_compact(aTHX_ loop);
+
+    if (loop->heap_len == loop->heap_size) {
+        loop->heap_size = loop->heap_size ? loop->heap_size * 2 : 64;
+        Renew(loop->heap, loop->heap_size, struct cc_loop_timer);
+    }
+
+    timer->seq = loop->seq++;
+    loop->heap[loop->heap_len] = *timer;
+    cc_heap_sift_up(loop, loop->heap_len);
+    loop->heap_len++;
+}
+
+static void cc_heap_pop(struct cc_loop *loop, struct cc_loop_timer *out)
+{
+    *out = loop->heap[0];
+    loop->heap_len--;
+    if (loop->heap_len > 0) {
+        loop->heap[0] = loop->heap[loop->heap_len];
+        cc_heap_sift_down(loop, 0);
+    }
+}
+
+/* Callbacks into Perl. Like EV, we don't let exceptions escape the loop: they'd leave our state
+ * (and the caller's) in an unknown condition. Instead they go to $Cassandra::Client::AsyncEpoll::DIED,
+ * which is our equivalent of $EV::DIED. */
+static void cc_loop_handle_died(pTHX)
+{
+    SV *died;
+
+    if (LIKELY(!SvTRUE(ERRSV)))
+        return;
+
+    died = get_sv("Cassandra::Client::AsyncEpoll::DIED", 0);
+    if (died && SvOK(died)) {
+        dSP;
+        PUSHMARK(SP);
+        PUTBACK;
+        call_sv(died, G_DISCARD | G_VOID | G_EVAL | G_KEEPERR);
+    } else {
+        warn("Cassandra::Client::AsyncEpoll: error in callback (ignoring): %" SVf, SVfARG(ERRSV));
+    }
+    sv_setpvs(ERRSV, "");
+}
+
+static void cc_loop_call_method(pTHX_ SV *obj, const char *method, int with_id, int id)
+{
+    dSP;
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    XPUSHs(obj);
+    if (with_id)
+        mXPUSHi(id);
+    PUTBACK;
+
+    call_method(method, G_DISCARD | G_EVAL);
+    cc_loop_handle_died(aTHX);
+
+    FREETMPS;
+    LEAVE;
+}
+
+static void cc_loop_call_sv(pTHX_ SV *callback)
+{
+    dSP;
+    ENTER;
+    SAVETMPS;
+    PUSHMARK(SP);
+    PUTBACK;
+
+    call_sv(callback, G_DISCARD | G_EVAL | G_NOARGS);
+    cc_loop_handle_died(aTHX);
+
+    FREETMPS;
+    LEAVE;
+}
+
+/* Native read-ahead: append whatever the socket has to the connection's read buffer, and only
+ * report readiness to Perl when at least one complete frame is buffered (or when the socket has
+ * something else to say, like EOF or an error, which Perl will discover on its own read). */
+static int cc_loop_read_ahead(pTHX_ struct cc_loop_fd *f, int fd)
+{
+    SV *buffer = f->read_buffer;
+    STRLEN cur;
+    ssize_t got;
+    unsigned char *ptr;
+    uint32_t body_length;
+
+    if (!SvPOK(buffer))
+        sv_setpvn(buffer, "", 0);
+    cur = SvCUR(buffer);
+    SvGROW(buffer, cur + CC_LOOP_READ_SIZE + 1);
+
+    got = read(fd, SvPVX(buffer) + cur, CC_LOOP_READ_SIZE);
+    if (got == 0)
+        return 1;
+    if (got < 0)
+        return !(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+
+    cur += got;
+    SvCUR_set(buffer, cur);
+    *SvEND(buffer) = '\0';
+
+    {
+        SV **bytes_read = hv_fetchs((HV*)SvRV(f->connection), "bytes_read", 0);
+        if (bytes_read && SvOK(*bytes_read))
+            sv_setiv(*bytes_read, SvIV(*bytes_read) + got);
+    }
+
+    if (cur < 9)
+        return 0;
+
+    ptr = (unsigned char*)SvPVX(buffer);
+    memcpy(&body_length, ptr + 5, 4);
+    body_length = ntohl(body_length);
+
+    return cur >= 9 + (STRLEN)body_length;
+}
+
+struct cc_loop *cc_loop_new(pTHX)
+{
+    struct cc_loop *loop;
+    int epfd;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        croak("cc_loop_new: epoll_create1 failed: %s", strerror(errno));
+
+    Newxz(loop, 1, struct cc_loop);
+    loop->epfd = epfd;
+    loop->compact_at = CC_LOOP_COMPACT_MIN;
+    return loop;
+}
+
+void cc_loop_destroy(pTHX_ struct cc_loop *loop)
+{
+    int i;
+    for (i = 0; i < loop->fds_size; i++) {
+        SvREFCNT_dec(loop->fds[i].connection);
+        SvREFCNT_dec(loop->fds[i].read_buffer);
+    }
+    for (i = 0; i < loop->heap_len; i++) {
+        cc_timer_free(aTHX_ &loop->heap[i]);
+    }
+    close(loop->epfd);
+    Safefree(loop->fds);
+    Safefree(loop->heap);
+    Safefree(loop);
+}
+
+void cc_loop_add(pTHX_ struct cc_loop *loop, int fd, SV *connection, SV *read_buffer)
+{
+    struct epoll_event ev;
+
+    if (UNLIKELY(fd < 0))
+        croak("cc_loop_add: invalid file descriptor");
+    if (UNLIKELY(!SvROK(connection) || SvTYPE(SvRV(connection)) != SVt_PVHV))
+        croak("cc_loop_add: connection must be a HASH-based object");
+
+    if (fd >= loop->fds_size) {
+        int new_size = loop->fds_size ? loop->fds_size : 16;
+        while (new_size <= fd)
+            new_size *= 2;
+        Renew(loop->fds, new_size, struct cc_loop_fd);
+        Zero(loop->fds + loop->fds_size, new_size - loop->fds_size, struct cc_loop_fd);
+        loop->fds_size = new_size;
+    }
+
+    if (UNLIKELY(loop->fds[fd].connection != NULL))
+        croak("cc_loop_add: file descriptor %d is already registered", fd);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = 0;
+    ev.data.fd = fd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        croak("cc_loop_add: epoll_ctl failed: %s", strerror(errno));
+
+    loop->fds[fd].connection = newSVsv(connection);
+    loop->fds[fd].read_buffer = (read_buffer && SvROK(read_buffer)) ? SvREFCNT_inc(SvRV(read_buffer)) : NULL;
+    loop->fds[fd].events = 0;
+    loop->fd_count++;
+}
+
+void cc_loop_remove(pTHX_ struct cc_loop *loop, int fd)
+{
+    struct cc_loop_fd *f;
+    SV *connection;
+    int i, undismissed = 0;
+
+    if (fd < 0 || fd >= loop->fds_size || !loop->fds[fd].connection)
+        return;
+
+    f = &loop->fds[fd];
+    connection = f->connection;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+
+    /* Drop the connection's deadlines, so that we don't keep it alive until they expire */
+    for (i = 0; i < loop->heap_len; i++) {
+        struct cc_loop_timer *timer = &loop->heap[i];
+        if (timer->connection && SvRV(timer->connection) == SvRV(connection)) {
+            if (!cc_timer_is_dismissed(aTHX_ timer))
+                undismissed = 1;
+            SvREFCNT_dec(timer->dismissed);
+            timer->dismissed = newSViv(1);
+        }
+    }
+    if (undismissed)
+        warn("In unregister(): not all timeouts were dismissed!");
+    cc_heap_compact(aTHX_ loop);
+
+    f->connection = NULL;
+    SvREFCNT_dec(f->read_buffer);
+    f->read_buffer = NULL;
+    f->events = 0;
+    loop->fd_count--;
+
+    SvREFCNT_dec(connection);
+}
+
+void cc_loop_watch(pTHX_ struct cc_loop *loop, int fd, uint32_t events, int enable)
+{
+    struct cc_loop_fd *f;
+    struct epoll_event ev;
+    uint32_t new_events;
+
+    if (UNLIKELY(fd < 0 || fd >= loop->fds_size || !loop->fds[fd].connection))
+        croak("cc_loop_watch: file descriptor %d is not registered", fd);
+
+    f = &loop->fds[fd];
+    new_events = enable ? (f->events | events) : (f->events & ~events);
+    if (new_events == f->events)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (new_events & CC_LOOP_READ ? EPOLLIN : 0) | (new_events & CC_LOOP_WRITE ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+        croak("cc_loop_watch: epoll_ctl failed: %s", strerror(errno));
+    f->events = new_events;
+}
+
+SV *cc_loop_deadline(pTHX_ struct cc_loop *loop, int fd, int stream_id, double timeout)
+{
+    struct cc_loop_timer timer;
+    SV *dismissed;
+
+    if (UNLIKELY(fd < 0 || fd >= loop->fds_size || !loop->fds[fd].connection))
+        croak("cc_loop_deadline: file descriptor %d is not registered", fd);
+
+    dismissed = newSViv(0);
+
+    memset(&timer, 0, sizeof(timer));
+    timer.at = cc_loop_now() + timeout;
+    timer.connection = newSVsv(loop->fds[fd].connection);
+    timer.dismissed = SvREFCNT_inc(dismissed);
+    timer.stream_id = stream_id;
+    timer.fd = fd;
+    cc_heap_push(aTHX_ loop, &timer);
+
+    return newRV_noinc(dismissed);
+}
+
+void cc_loop_timer(pTHX_ struct cc_loop *loop, SV *callback, double wait)
+{
+    struct cc_loop_timer timer;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.at = cc_loop_now() + (wait > 0 ? wait : 0);
+    timer.callback = newSVsv(callback);
+    cc_heap_push(aTHX_ loop, &timer);
+}
+
+static void cc_loop_run_timers(pTHX_ struct cc_loop *loop)
+{
+    double now = cc_loop_now();
+
+    loop->pass++;
+    while (!loop->stop && loop->heap_len && loop->heap[0].at <= now) {
+        struct cc_loop_timer timer;
+        cc_heap_pop(loop, &timer);
+
+        if (timer.callback) {
+            cc_loop_call_sv(aTHX_ timer.callback);
+        } else if (!cc_timer_is_dismissed(aTHX_ &timer)) {
+            /* Like AsyncEV, read whatever the socket has first (once per connection), as the
+             * answer may have arrived in time without us having dispatched it yet */
+            struct cc_loop_fd *f = &loop->fds[timer.fd]; /* The fds array never shrinks */
+            if (f->connection && SvRV(f->connection) == SvRV(timer.connection) && f->read_pass != loop->pass) {
+                f->read_pass = loop->pass;
+                cc_loop_call_method(aTHX_ timer.connection, "can_read", 0, 0);
+            }
+            if (!cc_timer_is_dismissed(aTHX_ &timer))
+                cc_loop_call_method(aTHX_ timer.connection, "can_timeout", 1, timer.stream_id);
+        }
+
+        cc_timer_free(aTHX_ &timer);
+    }
+}
+
+static void cc_loop_dispatch(pTHX_ struct cc_loop *loop, int fd, uint32_t revents)
+{
+    SV *connection;
+    struct cc_loop_fd *f;
+
+    if (fd >= loop->fds_size || !loop->fds[fd].connection)
+        return;
+
+    f = &loop->fds[fd];
+    connection = SvREFCNT_inc(f->connection);
+
+    if ((f->events & CC_LOOP_READ) && (revents & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+        if (!f->read_buffer || cc_loop_read_ahead(aTHX_ f, fd))
+            cc_loop_call_method(aTHX_ connection, "can_read", 0, 0);
+    }
+
+    /* can_read may have unregistered us, or even replaced us with a different connection */
+    f = &loop->fds[fd];
+    if (f->connection == connection && (f->events & CC_LOOP_WRITE) && (revents & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+        cc_loop_call_method(aTHX_ connection, "can_write", 0, 0);
+    }
+
+    SvREFCNT_dec(connection);
+}
+
+void cc_loop_run(pTHX_ struct cc_loop *loop)
+{
+    struct epoll_event events[CC_LOOP_MAX_EVENTS];
+
+    if (UNLIKELY(loop->running))
+        croak("cc_loop_run: loop is already running");
+
+    loop->running = 1;
+    loop->stop = 0;
+
+    while (!loop->stop && (loop->fd_count || loop->heap_len)) {
+        int i, count, timeout_ms = -1;
+
+        if (loop->heap_len) {
+            double wait = loop->heap[0].at - cc_loop_now();
+            timeout_ms = wait <= 0 ? 0 : (int)(wait * 1000) + 1;
+        }
+
+        count = epoll_wait(loop->epfd, events, CC_LOOP_MAX_EVENTS, timeout_ms);
+        if (count < 0) {
+            if (errno != EINTR) {
+                loop->running = 0;
+                croak("cc_loop_run: epoll_wait failed: %s", strerror(errno));
+            }
+            count = 0;
+        }
+
+        PERL_ASYNC_CHECK();
+
+        /* Like EV, finish the whole batch even if a callback stopped us: epoll reports ready
+         * descriptors in the same order every time, so bailing out early could starve the
+         * ones at the end of the list forever. */
+        for (i = 0; i < count; i++) {
+            cc_loop_dispatch(aTHX_ loop, events[i].data.fd, events[i].events);
+        }
+
+        cc_loop_run_timers(aTHX_ loop);
+    }
+
+    loop->running = 0;
+}
+
+#else /* __linux__ */
+
+struct cc_loop *cc_loop_new(pTHX)
+{
+    croak("The epoll event loop is only available on Linux");
+}
+
+void cc_loop_destroy(pTHX_ struct cc_loop *loop) { }
+void cc_loop_add(pTHX_ struct cc_loop *loop, int fd, SV *connection, SV *read_buffer) { }
+void cc_loop_remove(pTHX_ struct cc_loop *loop, int fd) { }
+void cc_loop_watch(pTHX_ struct cc_loop *loop, int fd, uint32_t events, int enable) { }
+SV *cc_loop_deadline(pTHX_ struct cc_loop *loop, int fd, int stream_id, double timeout) { return NULL; }
+void cc_loop_timer(pTHX_ struct cc_loop *loop, SV *callback, double wait) { }
+void cc_loop_run(pTHX_ struct cc_loop *loop) { }
+
+#endif
@@ -0,0 +1,54 @@
+#include <stdint.h>
+#define PERL_NO_GET_CONTEXT
+#include "perl.h"
+
+#ifndef CC_EVENTLOOP_H
+#define CC_EVENTLOOP_H
+
+struct cc_loop_fd {
+    SV *connection;     /* Object implementing can_read/can_write */
+    SV *read_buffer;    /* If set, we read into this buffer ourselves and only wake up Perl for complete frames */
+    uint32_t events;
+    uint64_t read_pass; /* Last pass over the expired deadlines that called can_read on us */
+};
+
+struct cc_loop_timer {
+    double at;
+    uint64_t seq;
+    SV *callback;       /* Plain timer: coderef to invoke */
+    SV *connection;     /* Request deadline: connection to call can_timeout on */
+    SV *dismissed;      /* Request deadline: set to a true value by Perl once the request completed */
+    int stream_id;
+    int fd;
+};
+
+struct cc_loop {
+    int epfd;
+    int stop;
+    int running;
+
+    struct cc_loop_fd *fds;
+    int fds_size;
+    int fd_count;
+
+    struct cc_loop_timer *heap;
+    int heap_len;
+    int heap_size;
+    int compact_at;
+    uint64_t seq;
+    uint64_t pass;
+};
+
+struct cc_loop *cc_loop_new(pTHX);
+void cc_loop_destroy(pTHX_ struct cc_loop *loop);
+void cc_loop_add(pTHX_ struct cc_loop *loop, int fd, SV *connection, SV *read_buffer);
+void cc_loop_remove(pTHX_ struct cc_loop *loop, int fd);
+void cc_loop_watch(pTHX_ struct cc_loop *loop, int fd, uint32_t events, int enable);
+SV *cc_loop_deadline(pTHX_ struct cc_loop *loop, int fd, int stream_id, double timeout);
+void cc_loop_timer(pTHX_ struct cc_loop *loop, SV *callback, double wait);
+void cc_loop_run(pTHX_ struct cc_loop *loop);
+
+#define CC_LOOP_READ  1
+#define CC_LOOP_WRITE 2
+
+#endif
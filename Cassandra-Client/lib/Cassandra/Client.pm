@@ -8,26 +8,39 @@ use warnings;
 
 use Cassandra::Client::AsyncAnyEvent;
 use Cassandra::Client::AsyncEV;
+use Cassandra::Client::AsyncEpoll;
 use Cassandra::Client::Config;
 use Cassandra::Client::Connection;
+use Cassandra::Client::Error::Base;
 use Cassandra::Client::Metadata;
 use Cassandra::Client::Policy::Queue::Default;
+use Cassandra::Client::Policy::Retry::Budget;
 use Cassandra::Client::Policy::Retry::Default;
 use Cassandra::Client::Policy::Retry;
 use Cassandra::Client::Policy::Throttle::Default;
 use Cassandra::Client::Policy::LoadBalancing::Default;
 use Cassandra::Client::Pool;
+use Cassandra::Client::Protocol qw/decode_flags next_timestamp unpack_metadata/;
+use Cassandra::Client::ResultCache;
+use Cassandra::Client::Snapshot;
+use Cassandra::Client::Statement;
 use Cassandra::Client::TLSHandling;
-use Cassandra::Client::Util qw/series whilst/;
+use Cassandra::Client::Util qw/series whilst format_uuid/;
 
 use Clone 0.36 qw/clone/;
 use List::Util qw/shuffle/;
 use AnyEvent::XSPromises qw/deferred/;
 use Time::HiRes ();
-use Ref::Util 0.008 qw/is_ref/;
+use Ref::Util 0.008 qw/is_ref is_plain_arrayref/;
 use Devel::GlobalDestruction 0.11;
 use XSLoader;
 
+use constant RETRY_BASE_DELAY => 0.1;
+use constant RETRY_MAX_DELAY  => 10;
+use constant TRACE_ATTEMPTS   => 5;
+use constant TRACE_RETRY_DELAY => 0.1;
+use constant PARALLEL_CONNECTS => 3;
+
 our $XS_VERSION = ($Cassandra::Client::VERSION || '');
 $XS_VERSION =~ s/\A(\d+)\.(\d+)(\d{3})\z/$1.$2_$3/;
 XSLoader::load(__PACKAGE__, $XS_VERSION);
@@ -39,6 +52,7 @@ sub new {
         connected         => 0,
         connect_callbacks => undef,
         shutdown          => 0,
+        pid               => $$,
 
         active_queries    => 0,
     }, $class;
@@ -49,36 +63,93 @@ sub new {
 
     $self->{throttler}= $options->{throttler} || Cassandra::Client::Policy::Throttle::Default->new();
     $self->{retry_policy}= $options->{retry_policy} || Cassandra::Client::Policy::Retry::Default->new();
+    $self->{retry_budget}= $options->{retry_budget};
     $self->{command_queue}= $options->{command_queue} || Cassandra::Client::Policy::Queue::Default->new();
     $self->{load_balancing_policy}= $options->{load_balancing_policy} || Cassandra::Client::Policy::LoadBalancing::Default->new();
 
-    my $async_class= $options->{anyevent} ? "Cassandra::Client::AsyncAnyEvent" : "Cassandra::Client::AsyncEV";
+    my $async_class= $options->{anyevent} ? "Cassandra::Client::AsyncAnyEvent"
+                   : $options->{epoll}    ? "Cassandra::Client::AsyncEpoll"
+                   :                        "Cassandra::Client::AsyncEV";
     my $async_io= $async_class->new(
         options => $options,
     );
     my $metadata= Cassandra::Client::Metadata->new(
         options => $options,
     );
+    my $snapshot= $options->{snapshot} ? _load_snapshot($options, $metadata) : undef;
     my $pool= Cassandra::Client::Pool->new(
         client   => $self,
         options  => $options,
         metadata => $metadata,
         async_io => $async_io,
         load_balancing_policy => $self->{load_balancing_policy},
+        known_nodes => ($snapshot && !$options->{proxy} ? $snapshot->{nodes} : undef),
     );
     my $tls= $options->{tls} ? Cassandra::Client::TLSHandling->new() : undef;
 
+    if ($options->{result_cache_size}) {
+        $self->{result_cache}= Cassandra::Client::ResultCache->new(max_bytes => $options->{result_cache_size});
+        $self->{result_cache_generation}= 0;
+    }
+
     $self->{options}= $options;
     $self->{async_io}= $async_io;
     $self->{metadata}= $metadata;
     $self->{pool}= $pool;
     $self->{tls}= $tls;
+    $self->{snapshot}= $snapshot;
 
     return $self;
 }
 
+# Fills the prepared statement cache from the snapshot. Statements the server forgot about (or
+# that were never prepared on a node) get an UNPREPARED error, and are then prepared as usual.
+sub _load_snapshot {
+    my ($options, $metadata)= @_;
+
+    my $snapshot= Cassandra::Client::Snapshot->load($options->{snapshot}, $options) or return;
+    for (@{$snapshot->{prepared}}) {
+        my ($query, $id, $raw)= @$_;
+        my $body= $raw;
+        my ($encoder, $decoder);
+        eval {
+            ($encoder)= unpack_metadata($options->{protocol_version}, 0, $body);
+            ($decoder)= unpack_metadata($options->{protocol_version}, 1, $body);
+            1;
+        } or next;
+        $metadata->add_prepared($query, $id, $decoder, $encoder, $raw);
+    }
+
+    return $snapshot;
+}
+
+# Nodes from the snapshot in our datacenter go first: they were good last time, and they're close
+sub _contact_points {
+    my ($self)= @_;
+
+    my @contact_points= shuffle @{$self->{options}{contact_points}};
+    my $snapshot= $self->{snapshot};
+    return @contact_points if !$snapshot || $self->{options}{proxy};
+
+    my $datacenter= $self->{load_balancing_policy}{datacenter} // $snapshot->{datacenter};
+    my @known= shuffle grep {
+        !defined $datacenter || (defined $_->{data_center} && $_->{data_center} eq $datacenter)
+    } values %{$snapshot->{nodes}};
+
+    # And of those, the ones in our rack, if the policy has one
+    my $rack= $self->{load_balancing_policy}{rack};
+    if (defined $rack) {
+        @known= ((grep { ($_->{rack} // '') eq $rack } @known), (grep { ($_->{rack} // '') ne $rack } @known));
+    }
+    @known= map $_->{peer}, @known;
+
+    my %seen;
+    return grep { !$seen{$_}++ } @known, @contact_points;
+}
+
 sub _connect {
     my ($self, $callback)= @_;
+    $self->_after_fork if $self->{pid} != $$;
     return _cb($callback) if $self->{connected};
     return _cb($callback, 'Cannot connect: shutdown() has been called') if $self->{shutdown};
 
@@ -92,49 +163,71 @@ sub _connect {
         return;
     }
 
-    my @contact_points= shuffle @{$self->{options}{contact_points}};
+    my @contact_points= $self->_contact_points;
     my $last_error= "No hosts to connect to";
 
+    # We try a few contact points at once and go with whichever answers first, so a node that is
+    # down or slow doesn't hold us up for a whole connect timeout. The others are cut off as soon
+    # as we have a winner, rather than left to finish their handshake for nothing.
+    my $attempts= 0;
+    my $chosen= 0;
+    my %handshaking; # By contact point
+
     my $next_connect;
     $next_connect= sub {
-        my $contact_point= shift @contact_points;
-        if (!$contact_point) {
+        while (!$chosen && $attempts < PARALLEL_CONNECTS && @contact_points) {
+            my $contact_point= shift @contact_points;
+            $attempts++;
+
+            my $connection= Cassandra::Client::Connection->new(
+                client => $self,
+                options => $self->{options},
+                host => $contact_point,
+                async_io => $self->{async_io},
+                metadata => $self->{metadata},
+            );
+            $handshaking{$contact_point}= $connection;
+
+            my $is_chosen;
+            series([
+                sub {
+                    my ($next)= @_;
+                    $connection->connect($next);
+                },
+                sub {
+                    my ($next)= @_;
+                    delete $handshaking{$contact_point};
+                    $chosen= $is_chosen= 1;
+                    for my $other (keys %handshaking) {
+                        $attempts--;
+                        (delete $handshaking{$other})->shutdown("Not needed");
+                    }
+                    $self->{pool}->init($next, $connection);
+                },
+            ], sub {
+                my $error= shift;
+                return unless $is_chosen || delete $handshaking{$contact_point}; # Cut off, see above
+                $attempts--;
+                $self->{throttler}->count($error);
+                if ($error) {
+                    return unless $next_connect; # Already connected through another contact point
+                    $last_error= "On $contact_point: $error";
+                    $chosen= 0 if $is_chosen;
+                    return $next_connect->();
+                }
+
+                undef $next_connect;
+                $self->{connected}= 1;
+                delete $self->{connecting};
+                _cb($_) for @{delete $self->{connect_callbacks}};
+            });
+        }
+
+        if (!$attempts && !$chosen) {
             delete $self->{connecting};
             undef $next_connect;
             _cb($_, "Unable to connect to any Cassandra server. Last error: $last_error") for @{delete $self->{connect_callbacks}};
-            return;
         }
-
-        my $connection= Cassandra::Client::Connection->new(
-            client => $self,
-            options => $self->{options},
-            host => $contact_point,
-            async_io => $self->{async_io},
-            metadata => $self->{metadata},
-        );
-
-        series([
-            sub {
-                my ($next)= @_;
-                $connection->connect($next);
-            },
-            sub {
-                my ($next)= @_;
-                $self->{pool}->init($next, $connection);
-            },
-        ], sub {
-            my $error= shift;
-            $self->{throttler}->count($error);
-            if ($error) {
-                $last_error= "On $contact_point: $error";
-                return $next_connect->();
-            }
-
-            undef $next_connect;
-            $self->{connected}= 1;
-            delete $self->{connecting};
-            _cb($_) for @{delete $self->{connect_callbacks}};
-        });
     };
     $next_connect->();
 
@@ -145,6 +238,12 @@ sub shutdown {
     my ($self)= @_;
 
     return if $self->{shutdown};
+    $self->_after_fork if $self->{pid} != $$;
+
+    if ($self->{connected} && $self->{options}{snapshot}) {
+        eval { $self->save_snapshot; 1 } or warn "Cassandra::Client: $@";
+    }
+
     $self->{shutdown}= 1;
     $self->{connected}= 0;
 
@@ -153,6 +252,43 @@ sub shutdown {
     return;
 }
 
+sub save_snapshot {
+    my ($self)= @_;
+    my $path= $self->{options}{snapshot} or die "save_snapshot: no snapshot file configured";
+
+    Cassandra::Client::Snapshot->save($path, $self->{options},
+        $self->{load_balancing_policy}{datacenter},
+        $self->{pool}->known_nodes,
+        $self->{metadata}->prepare_cache,
+    );
+
+    return;
+}
+
+# Our sockets, TLS sessions and event loop state are shared with the process we were forked from. Let
+# go of them without telling anyone, so the parent can keep using them, and reconnect lazily. We keep
+# the prepared statement cache and the list of known nodes, so the child can start querying right away.
+sub _after_fork {
+    my ($self)= @_;
+    $self->{pid}= $$;
+
+    $self->{async_io}->after_fork;
+    $self->{pool}->after_fork;
+
+    # Anything still waiting belongs to the parent
+    1 while $self->{command_queue}{has_any} && $self->{command_queue}->dequeue;
+    $self->{connected}= 0;
+    $self->{connect_callbacks}= undef;
+    $self->{active_queries}= 0;
+    delete $self->{connecting};
+    delete $self->{command_callback_scheduled};
+    delete $self->{queue_expiry_scheduled};
+    # Reads the parent has in flight are answered in the parent only
+    delete $self->{inflight_reads};
+
+    return;
+}
+
 sub is_active {
     my ($self)= @_;
     return 0 unless $self->{connected};
@@ -162,6 +298,8 @@ sub is_active {
 sub _disconnected {
     my ($self, $connid)= @_;
     $self->{pool}->remove($connid);
+    # Its in-flight requests no longer count towards max_concurrent_queries_per_node
+    $self->_schedule_command_dequeue if $self->{command_queue}{has_any};
     return;
 }
 
@@ -176,6 +314,14 @@ sub _handle_topology_change {
     }
 }
 
+sub _handle_schema_change {
+    my ($self)= @_;
+    if ($self->{result_cache}) {
+        $self->{result_cache}->clear;
+        $self->{result_cache_generation}++;
+    }
+}
+
 sub _handle_status_change {
     my ($self, $change, $ipaddress)= @_;
     # XXX Ignored, for now
@@ -203,19 +349,156 @@ sub _execute {
     my $attribs_clone= clone($attribs);
     $attribs_clone->{consistency} ||= $self->{options}{default_consistency};
     $attribs_clone->{idempotent}  ||= $self->{options}{default_idempotency};
+    $attribs_clone->{timestamp}   //= next_timestamp() if $self->{options}{client_timestamps};
+    $self->_start_trace($attribs_clone) if $attribs_clone->{tracing} || $self->{options}{trace_sample_rate};
 
     $self->_command("execute_prepared", $callback, [ \$query, clone($params), $attribs_clone ]);
     return;
 }
 
+sub _prepare_statement {
+    my ($self, $callback, $query, $attribs)= @_;
+
+    $self->_prepare(sub {
+        my ($error)= @_;
+        return _cb($callback, $error) if $error;
+        return _cb($callback, undef, Cassandra::Client::Statement->new(
+            client     => $self,
+            query      => $query,
+            prepared   => $self->{metadata}->prepare_cache->{$query},
+            attributes => clone($attribs),
+        ));
+    }, $query);
+    return;
+}
+
+sub _execute_statement {
+    my ($self, $callback, $statement, $params, $attribs)= @_;
+
+    my $attribs_clone= { %{$statement->{attributes}}, ($attribs ? %{clone($attribs)} : ()) };
+    $attribs_clone->{consistency} ||= $self->{options}{default_consistency};
+    $attribs_clone->{idempotent}  ||= $self->{options}{default_idempotency};
+    $attribs_clone->{timestamp}   //= next_timestamp() if $self->{options}{client_timestamps};
+    $self->_start_trace($attribs_clone) if $attribs_clone->{tracing} || $self->{options}{trace_sample_rate};
+
+    $self->_command("execute_prepared", $callback, [ \$statement->{query}, clone($params), $attribs_clone, undef, $statement ]);
+    return;
+}
+
 sub _batch {
     my ($self, $callback, $queries, $attribs)= @_;
 
     my $attribs_clone= clone($attribs);
     $attribs_clone->{consistency} ||= $self->{options}{default_consistency};
     $attribs_clone->{idempotent}  ||= $self->{options}{default_idempotency};
+    $attribs_clone->{timestamp}   //= next_timestamp() if $self->{options}{client_timestamps};
+    $self->_start_trace($attribs_clone) if $attribs_clone->{tracing} || $self->{options}{trace_sample_rate};
+
+    # Statement objects must not be cloned, they hold on to the client and to XS objects
+    my $queries_clone= is_plain_arrayref($queries)
+        ? [ map { is_plain_arrayref($_) ? [ $_->[0], clone($_->[1]) ] : $_ } @$queries ]
+        : $queries;
+
+    $self->_command("execute_batch", $callback, [ $queries_clone, $attribs_clone ]);
+    return;
+}
+
+# Asks the server to trace the query, if the tracing attribute says so or it's picked by
+# trace_sample_rate. The trace collects the client-side timings on the way.
+sub _start_trace {
+    my ($self, $attribs)= @_;
+    my $rate= $self->{options}{trace_sample_rate};
+    return unless $attribs->{tracing} // ($rate && rand() < $rate);
+    $attribs->{_trace}= { start => Time::HiRes::time() };
+    return;
+}
+
+# Once a traced query is done, its timings and the server's account of it go to the trace_hook.
+# The server writes the trace in the background, so we may have to wait a bit for it.
+sub _report_trace {
+    my ($self, $command, $command_info)= @_;
+
+    my $hook= $self->{options}{trace_hook} or return;
+    my $trace= $command_info->{trace};
 
-    $self->_command("execute_batch", $callback, [ clone($queries), $attribs_clone ]);
+    # Seconds between the moments of the last attempt, if it got that far
+    my %at= (%$trace, end => $command_info->{end_time});
+    my %timings;
+    for ([ queue => qw/start dispatched/ ], [ encode => qw/dispatched encoded/ ], [ write => qw/encoded written/ ],
+         [ server => qw/written received/ ], [ decode => qw/received end/ ], [ total => qw/start end/ ]) {
+        my ($phase, $from, $to)= @$_;
+        $timings{$phase}= $at{$to} - $at{$from} if defined $at{$from} && defined $at{$to};
+    }
+
+    my $report= {
+        command  => $command,
+        node     => $trace->{node},
+        trace_id => ($trace->{id} ? format_uuid($trace->{id}) : undef),
+        timings  => \%timings,
+    };
+    return _cb($hook, $report) unless $report->{trace_id};
+
+    $self->_get_trace(sub {
+        my ($error, $server_trace)= @_;
+        if ($error) {
+            $report->{error}= $error;
+        } else {
+            $report->{session}= $server_trace->{session};
+            $report->{events}= $server_trace->{events};
+        }
+        _cb($hook, $report);
+    }, $report->{trace_id});
+    return;
+}
+
+sub _get_trace {
+    my ($self, $callback, $trace_id)= @_;
+
+    my ($session, $attempts)= (undef, 0);
+    series([
+        sub {
+            my ($next)= @_;
+            whilst(
+                sub { !$session && $attempts < TRACE_ATTEMPTS },
+                sub {
+                    my ($wnext)= @_;
+                    series([
+                        sub {
+                            my ($snext)= @_;
+                            return $snext->() unless $attempts++;
+                            $self->{async_io}->timer($snext, TRACE_RETRY_DELAY * $attempts);
+                        },
+                        sub {
+                            my ($snext)= @_;
+                            $self->_execute($snext, "select coordinator, duration, request, parameters, started_at from system_traces.sessions where session_id=?",
+                                [ $trace_id ], { tracing => 0 });
+                        },
+                        sub {
+                            my ($snext, $result)= @_;
+                            # The duration is written last, when the server is done with the query
+                            my ($row)= @{$result->row_hashes};
+                            $session= $row if $row && defined $row->{duration};
+                            $snext->();
+                        },
+                    ], $wnext);
+                },
+                $next,
+            );
+        },
+        sub {
+            my ($next)= @_;
+            return $next->("Trace $trace_id is not available") unless $session;
+            $self->_execute($next, "select activity, source, source_elapsed, thread from system_traces.events where session_id=?",
+                [ $trace_id ], { tracing => 0 });
+        },
+        sub {
+            my ($next, $result)= @_;
+            $next->(undef, { session => $session, events => $result->row_hashes });
+        },
+    ], sub {
+        my ($error, $trace)= @_;
+        _cb($callback, $error, $trace);
+    });
     return;
 }
 
@@ -230,31 +513,50 @@ sub _wait_for_schema_agreement {
 sub _command {
     my ($self, $command, $callback, $args)= @_;
 
+    # Before anything else, so a child doesn't wait on work that belongs to the parent
+    $self->_after_fork if $self->{pid} != $$;
+
+    # A traced query has to reach the server, or there'd be nothing to trace
+    if ($command eq 'execute_prepared' && ($self->{result_cache} || $self->{options}{coalesce_reads}) && !($args->[2] && $args->[2]{_trace})) {
+        $callback= $self->_shortcut_read($callback, $args) or return;
+    }
+
+    my $attribs= $command eq 'execute_prepared' ? $args->[2] : $command eq 'execute_batch' ? $args->[1] : undef;
     my $command_info= {
         start_time => Time::HiRes::time(),
+        priority   => $attribs && $attribs->{priority},
+        trace      => $attribs && $attribs->{_trace},
     };
 
     goto OVERFLOW if $self->{active_queries} >= $self->{options}{max_concurrent_queries};
 
     goto SLOWPATH if !$self->{connected};
 
-    my $connection= $self->{pool}->get_one;
-    goto SLOWPATH if !$connection;
+    my $connection= ($self->{options}{shard_aware} && $command eq 'execute_prepared' && $self->_routed_connection($args))
+        || $self->{pool}->get_one;
+    if (!$connection) {
+        goto OVERFLOW if $self->{pool}{count}; # Every node is at its limit
+        goto SLOWPATH;
+    }
 
-    if (my $error= $self->{throttler}->should_fail()) {
+    if (my $error= $self->{throttler}->should_fail($connection)) {
         return $self->_command_failed($command, $callback, $args, $command_info, $error);
     }
 
     $self->{active_queries}++;
     $connection->$command(sub {
         my ($error, $result)= @_;
-        $self->{throttler}->count($error);
+        $self->{throttler}->count($error, undef, $connection);
 
         $self->{active_queries}--;
         $self->_schedule_command_dequeue if $self->{command_queue}{has_any};
 
-        return $self->_command_failed($command, $callback, $args, $command_info, $error) if $error;
+        if ($error) {
+            $command_info->{node}= $connection->ip_address;
+            return $self->_command_failed($command, $callback, $args, $command_info, $error);
+        }
 
+        $self->{retry_budget}->deposit if $self->{retry_budget};
         $self->_report_stats($command, $command_info);
         return _cb($callback, $error, $result);
     }, @$args);
@@ -268,34 +570,120 @@ OVERFLOW:
     return $self->_command_enqueue($command, $callback, $args, $command_info);
 }
 
+# With shard_aware: the connection to the node and shard that own the partition the query is for.
+# Only possible once the statement is prepared, as the server tells us the partition key then.
+sub _routed_connection {
+    my ($self, $args)= @_;
+    my ($queryref, $params, undef, undef, $statement)= @$args;
+    return unless $params;
+
+    my $prepared= $statement ? $statement->prepared_entry : $self->{metadata}->prepare_cache->{$$queryref};
+    return unless $prepared;
+    my $token= eval { $prepared->{encoder}->routing_token($params) } // return; # Bad values are for the query to report
+    my $connection= $self->{pool}->get_for_token($token) or return;
+
+    my $limit= $self->{options}{max_concurrent_queries_per_node};
+    return if $limit && $self->{pool}->node_in_flight($connection->ip_address) >= $limit;
+    return $connection;
+}
+
+# Identifies a read by its statement, encoded parameters, and the attributes that affect the
+# result. Only possible once the statement is prepared, as we need its encoder.
+sub _read_key {
+    my ($self, $args)= @_;
+    my ($queryref, $params, $attribs)= @$args;
+
+    my $prepared= $self->{metadata}->prepare_cache->{$$queryref} or return;
+    return eval {
+        join "\0", $$queryref,
+            ($params ? $prepared->{encoder}->encode($params) : ''),
+            $attribs->{consistency} // '',
+            $attribs->{page_size} // '',
+            $attribs->{page} // '',
+            ($attribs->{decode} ? decode_flags($attribs->{decode}) : '');
+    }; # If that fails, let the query itself report the problem
+}
+
+# Reads that can skip (part of) the trip to the server. With a cache_ttl attribute, the result may
+# come from the result cache, or is stored there once it arrives. With coalesce_reads, a SELECT
+# identical to one still in flight doesn't go to the server, but waits for the first one and gets
+# the same ResultSet. Returns the callback to run the query with, or nothing if it's been handled.
+sub _shortcut_read {
+    my ($self, $callback, $args)= @_;
+    my ($queryref, undef, $attribs)= @$args;
+
+    my $cache= $attribs->{cache_ttl} && $self->{result_cache};
+    my $coalesce= $self->{options}{coalesce_reads} && $$queryref =~ /\A\s*select\b/i;
+    return $callback unless $cache || $coalesce;
+
+    my $key= $self->_read_key($args) // return $callback;
+
+    if ($cache) {
+        if (my $result= $cache->get($key)) {
+            _cb($callback, undef, $result);
+            return;
+        }
+
+        my $ttl= $attribs->{cache_ttl};
+        my $inner= $callback;
+        my $generation= $self->{result_cache_generation};
+        $callback= sub {
+            my ($error, $result)= @_;
+            # Don't store results that may predate a schema change
+            $cache->put($key, $result, $ttl) if !$error && $result && $generation == $self->{result_cache_generation};
+            $inner->(@_);
+        };
+    }
+
+    if ($coalesce) {
+        if (my $waiting= $self->{inflight_reads}{$key}) {
+            push @$waiting, $callback;
+            return;
+        }
+
+        my $waiting= $self->{inflight_reads}{$key}= [ $callback ];
+        $callback= sub {
+            delete $self->{inflight_reads}{$key};
+            _cb($_, @_) for @$waiting;
+        };
+    }
+
+    return $callback;
+}
+
 sub _command_slowpath {
     my ($self, $command, $callback, $args, $command_info)= @_;
 
     $self->{active_queries}++;
 
+    my $connection;
     series([
         sub {
             my ($next)= @_;
             $self->_connect($next);
         }, sub {
             my ($next)= @_;
-            $self->{pool}->get_one_cb($next);
+            $self->{pool}->get_one_cb($next, $command_info->{avoid});
         }, sub {
-            my ($next, $connection)= @_;
-            if (my $error= $self->{throttler}->should_fail()) {
+            (my $next, $connection)= @_;
+            if (my $error= $self->{throttler}->should_fail($connection)) {
                 return $next->($error);
             }
             $connection->$command($next, @$args);
         }
     ], sub {
         my ($error, $result)= @_;
-        $self->{throttler}->count($error);
+        $self->{throttler}->count($error, undef, $connection);
 
         $self->{active_queries}--;
         $self->_schedule_command_dequeue if $self->{command_queue}{has_any};
 
-        return $self->_command_failed($command, $callback, $args, $command_info, $error) if $error;
+        if ($error) {
+            $command_info->{node}= $connection && $connection->ip_address;
+            return $self->_command_failed($command, $callback, $args, $command_info, $error);
+        }
 
+        $self->{retry_budget}->deposit if $self->{retry_budget};
         $self->_report_stats($command, $command_info);
         return _cb($callback, $error, $result);
     });
@@ -307,9 +695,15 @@ sub _command_retry {
 
     $command_info->{retries}++;
 
-    my $delay= 0.1 * (2 ** $command_info->{retries});
+    # Decorrelated jitter: random, but growing with every retry, so clients that failed at the
+    # same time don't all come back at the same time
+    my $delay= $command_info->{retry_delay} || RETRY_BASE_DELAY;
+    $delay= RETRY_BASE_DELAY + rand($delay * 3 - RETRY_BASE_DELAY);
+    $delay= RETRY_MAX_DELAY if $delay > RETRY_MAX_DELAY;
+    $command_info->{retry_delay}= $delay;
+
     $self->{async_io}->timer(sub {
-        if ($self->{active_queries} >= $self->{options}{max_concurrent_queries}) {
+        if ($self->{active_queries} >= $self->{options}{max_concurrent_queries} || !$self->{pool}->has_capacity) {
             $self->_command_enqueue($command, $callback, $args, $command_info);
         } else {
             $self->_command_slowpath($command, $callback, $args, $command_info);
@@ -338,8 +732,11 @@ sub _command_failed {
             $retry_decision= Cassandra::Client::Policy::Retry::rethrow;
         }
 
-        if ($retry_decision && $retry_decision eq 'retry') {
-            return $self->_command_retry($command, $callback, $args, $command_info);
+        if ($retry_decision && ($retry_decision eq 'retry' || $retry_decision eq 'try_next_host')) {
+            if (!$self->{retry_budget} || $self->{retry_budget}->withdraw) {
+                $command_info->{avoid}= ($retry_decision eq 'try_next_host' || $error->do_retry) ? $command_info->{node} : undef;
+                return $self->_command_retry($command, $callback, $args, $command_info);
+            }
         }
     }
 
@@ -349,20 +746,57 @@ sub _command_failed {
 
 sub _command_enqueue {
     my ($self, $command, $callback, $args, $command_info)= @_;
-    if (my $error= $self->{command_queue}->enqueue([$command, $callback, $args, $command_info])) {
+
+    # Waiting in the queue counts towards request_timeout, or a node that never frees up would keep
+    # us waiting forever
+    $command_info->{queue_deadline}= Time::HiRes::time() + $self->{options}{request_timeout};
+
+    my $item= [$command, $callback, $args, $command_info];
+    if (my $error= $self->{command_queue}->enqueue($item)) {
         return $self->_command_failed($command, $callback, $args, $command_info, "Cannot $command: $error");
     }
+    $self->_schedule_queue_expiry;
     return;
 }
 
+# A single timer, for whichever queued command expires first
+sub _schedule_queue_expiry {
+    my ($self)= @_;
+    return if $self->{queue_expiry_scheduled};
+    my $deadline= $self->{command_queue}->next_deadline // return;
+
+    $self->{queue_expiry_scheduled}= 1;
+    my $wait= $deadline - Time::HiRes::time();
+    $self->{async_io}->timer(sub {
+        delete $self->{queue_expiry_scheduled};
+        $self->_command_expired(@$_) for $self->{command_queue}->expire(Time::HiRes::time());
+        $self->_schedule_queue_expiry;
+    }, $wait > 0 ? $wait : 0);
+}
+
+sub _command_expired {
+    my ($self, $command, $callback, $args, $command_info)= @_;
+    $self->_report_stats($command, $command_info);
+    $callback->(Cassandra::Client::Error::Base->new(
+        message         => "Request timed out in the command queue",
+        is_timeout      => 1,
+        request_error   => 1,
+    ));
+}
+
 sub _schedule_command_dequeue {
     my ($self)= @_;
     unless ($self->{command_callback_scheduled}++) {
         $self->{async_io}->later(sub {
             delete $self->{command_callback_scheduled};
 
-            while ($self->{command_queue}{has_any} && $self->{active_queries} < $self->{options}{max_concurrent_queries}) {
+            while ($self->{command_queue}{has_any} && $self->{active_queries} < $self->{options}{max_concurrent_queries} && $self->{pool}->has_capacity) {
                 my $item= $self->{command_queue}->dequeue or return;
+                if ($item->[3]{queue_deadline} <= Time::HiRes::time()) {
+                    # Expired, but the timer hasn't gotten to it yet
+                    $self->_command_expired(@$item);
+                    next;
+                }
                 $self->_command_slowpath(@$item);
             }
         });
@@ -381,6 +815,8 @@ sub _report_stats {
             end_time    => $command_info->{end_time},
         });
     }
+
+    $self->_report_trace($command, $command_info) if $command_info->{trace};
 }
 
 # Utility functions that wrap query functions
@@ -426,7 +862,10 @@ sub DESTROY {
     return if in_global_destruction;
 
     my $self= shift;
-    if ($self->{connected}) {
+    if ($self->{pid} != $$) {
+        # Don't shut down connections that belong to our parent
+        $self->_after_fork;
+    } elsif ($self->{connected}) {
         $self->shutdown;
     }
 }
@@ -530,7 +969,9 @@ PUBLIC_METHODS: {
         connect
         execute
         each_page
+        get_trace
         prepare
+        prepare_statement
         wait_for_schema_agreement
     /) {
         *{$_}=               _mksync        (\&{"_$_"});
@@ -539,6 +980,17 @@ PUBLIC_METHODS: {
         *{"future_$_"}=      _mkfuture      (\&{"_$_"});
         *{"future_call_$_"}= _mkfuture_call (\&{"_$_"});
     }
+
+    my $statement= "Cassandra::Client::Statement";
+    for (qw/
+        execute
+    /) {
+        *{"${statement}::$_"}=               _mksync        (\&{"${statement}::_$_"});
+        *{"${statement}::call_$_"}=          _mkcall        (\&{"${statement}::_$_"});
+        *{"${statement}::async_$_"}=         _mkpromise     (\&{"${statement}::_$_"});
+        *{"${statement}::future_$_"}=        _mkfuture      (\&{"${statement}::_$_"});
+        *{"${statement}::future_call_$_"}=   _mkfuture_call (\&{"${statement}::_$_"});
+    }
 }
 
 1;
@@ -577,7 +1029,7 @@ Create a new C<Cassandra::Client> instance, with the given options.
 
 =item contact_points
 
-B<Required.> Arrayref of seed hosts to use when connecting. Specify more than one for increased reliability. This array is shuffled before use, so that random hosts are picked from the array.
+B<Required.> Arrayref of seed hosts to use when connecting. Specify more than one for increased reliability. This array is shuffled before use, so that random hosts are picked from the array. Up to three of them are tried at once, and the first to answer is used.
 
 =item keyspace
 
@@ -587,6 +1039,14 @@ Default keyspace to use on all underlying connections. Can be overridden by quer
 
 Should our internal event loop be based on AnyEvent, or should we just use our own? A true value means enable AnyEvent. Needed for promises to work.
 
+=item epoll
+
+Use the native epoll-based event loop instead of L<EV>. It handles socket readiness and timeouts without calling into Perl for every event, and only hands complete frames to Perl, which noticeably lowers the overhead of synchronous queries. Linux only, and cannot be combined with C<anyevent>. Exceptions thrown by callbacks are passed to C<$Cassandra::Client::AsyncEpoll::DIED>, which warns by default, like C<$EV::DIED>.
+
+=item proxy
+
+Path to the UNIX socket of a L<Cassandra::Client::Proxy>. All queries are then sent through the proxy, which shares its connections to the cluster between all local processes. Replaces C<contact_points>. The keyspace has to be configured on the proxy.
+
 =item port
 
 Port number to use. Defaults to C<9042>.
@@ -599,6 +1059,8 @@ CQL version to use. Defaults to the version the server is running. Override only
 
 Compression method to use. Defaults to the best available version, based on server and client support. Possible values are C<snappy>, C<lz4>, and C<none>.
 
+When both C<cql_version> and C<compression> are set, there's nothing to negotiate, and connections skip asking the server what it supports. This saves a round trip on every connect.
+
 =item default_consistency
 
 Default consistency level to use. Defaults to C<one>. Can be overridden on a query basis as well, by passing a C<consistency> attribute.
@@ -607,17 +1069,91 @@ Default consistency level to use. Defaults to C<one>. Can be overridden on a que
 
 Default value of the C<idempotent> query attribute that indicates if a write query may be retried without harm. It defaults to false.
 
+=item client_timestamps
+
+Whether to generate a timestamp on the client for every query and batch, instead of letting the coordinator pick one. Timestamps are in microseconds and guaranteed to increase monotonically within the process. A query keeps its timestamp when it is retried, so retried writes can't overwrite newer data. Defaults to false. Can be overridden per query by passing a C<timestamp> attribute.
+
+=item decode
+
+Alternative formats for decoded values, as a hashref mapping a type to its format. Useful when the values are going to be processed further, as these skip the formatting and parsing of strings. All types default to C<string>, and values in the alternative formats are also accepted when encoding.
+
+=over
+
+=item date => 'days'
+
+Dates are returned as the number of days since 1970-01-01.
+
+=item time => 'nanoseconds'
+
+Times are returned as the number of nanoseconds since midnight.
+
+=item decimal => 'pair'
+
+Decimals are returned as C<[ $unscaled, $scale ]>, meaning C<< $unscaled * 10**-$scale >>.
+
+=item varint => 'hex'
+
+Varints too big for a native integer are returned as hexadecimal strings like C<0x1f>, which can be passed to C<< Math::BigInt->new >> as-is. This also applies to the unscaled value of decimals when using C<pair>.
+
+=back
+
+Can be overridden per query by passing a C<decode> attribute.
+
+=item coalesce_reads
+
+Whether to merge identical reads that are in flight at the same time. A C<SELECT> with the same bound parameters and attributes as one that is still waiting for the server isn't sent again, but gets the result of the first one when it arrives. Helps against stampedes on hot partitions. All merged callers receive the same L<Cassandra::Client::ResultSet> object, so don't modify it. Defaults to false.
+
+=item shard_aware
+
+For ScyllaDB, which splits every node into shards, one per CPU core. Queries on prepared statements are sent to the node that owns their partition, on a connection to the shard that owns it, so the node doesn't have to pass them between cores. Connections to the other shards are opened in the background when they're first needed, through the node's shard-aware port if it has one. Only works with protocol version 4, and only picks the first replica of a partition. Has no effect on Cassandra, or through a C<proxy>. Defaults to false.
+
+=item max_concurrent_queries
+
+Maximum number of queries to have in flight at any time. Queries beyond that wait in the C<command_queue>. Defaults to C<1000>.
+
+=item max_concurrent_queries_per_node
+
+Maximum number of queries to have in flight on any single node. When a node is at its limit, queries go to the other nodes, and once all of them are, queries wait in the queue until any node has capacity again. This keeps one slow node from taking up all of C<max_concurrent_queries>. With C<shard_aware>, the limit covers all of a node's shard connections together. Requests that timed out count until the node answers them, as it's still working on them. Queued queries fail once they've waited for C<request_timeout>. Defaults to C<0>, no limit.
+
+=item result_cache_size
+
+Size in bytes of an in-memory cache for query results, for data that is read much more often than it changes. Only queries with a C<cache_ttl> attribute use it, and their results are kept for that many seconds. The cache is cleared whenever the schema changes. Defaults to C<0>, no cache.
+
+=item retry_budget
+
+A L<Cassandra::Client::Policy::Retry::Budget>, which limits retries to a fraction of the queries that succeed, so that retries can't pile up on an already struggling cluster. For example C<< Cassandra::Client::Policy::Retry::Budget->new(ratio => 0.1, min_per_second => 10) >> allows one retry for every ten successful queries, plus ten retries per second regardless. By default retries are only limited by the C<retry_policy>.
+
+Retries are spread out in time with random delays that grow with each attempt, and queries that failed because of their node are retried on another node when possible.
+
+=item load_balancing_policy
+
+Decides which nodes to connect to. The default, L<Cassandra::Client::Policy::LoadBalancing::Default>, connects to the nodes of one datacenter: the one given to it as C<datacenter>, or else that of the first node we connect to. L<Cassandra::Client::Policy::LoadBalancing::RackAware> does the same, but also prefers the nodes in one rack, such as the availability zone the client runs in: C<< Cassandra::Client::Policy::LoadBalancing::RackAware->new(datacenter => "us-east", rack => "us-east-1a") >>. Those are connected to first, and get the queries as long as they're not busy. Other nodes in the datacenter are only used when our rack doesn't have enough nodes for C<max_connections>, or its nodes are down or at C<max_concurrent_queries_per_node>. Without a C<rack>, it takes the rack of the first node we connect to.
+
+=item snapshot
+
+Path of a file to keep the cluster's nodes and the client's prepared statements in. It's written when the client shuts down (or by C<save_snapshot>), and read by C<new()>. A client that starts from a snapshot connects to the known nodes of its datacenter first, doesn't wait for the node list to be fetched, and can execute statements without preparing them first. Statements that the server doesn't know anymore are prepared again as usual. Meant for short-lived processes, such as cron jobs and CGI scripts, that spend much of their time connecting.
+
+The snapshot is ignored if it was written for other contact points, another port, keyspace or protocol version, or if it's older than C<snapshot_max_age>.
+
+=item snapshot_max_age
+
+Maximum age of a snapshot in seconds, before it's ignored. Defaults to C<86400> (a day).
+
 =item max_page_size
 
 Default max page size to pass to the server. This defaults to C<5000>. Note that large values can cause trouble on Cassandra. Can be overridden by passing C<page_size> in query attributes.
 
+=item prepare_threshold
+
+Number of times a statement has to be executed before it's prepared. Until then, it's sent to the server as a plain query, which saves a round trip and keeps one-off statements out of the prepared statement cache. Statements with bind values can only be sent this way if their C<types> attribute is set, see C<execute>. Defaults to C<1>: statements are prepared the first time they're used.
+
 =item max_connections
 
 Maximum amount of connections to keep open in the Cassandra connection pool. Defaults to C<2> for historical reasons, raise this if appropriate.
 
 =item timer_granularity
 
-Timer granularity used for timeouts. Defaults to C<0.1> (100ms). Change this if you're setting timeouts to values lower than a second.
+Timer granularity used for timeouts. Defaults to C<0.1> (100ms). Change this if you're setting timeouts to values lower than a second. Not used by the C<epoll> event loop, which tracks every deadline individually.
 
 =item request_timeout
 
@@ -627,6 +1163,14 @@ Maximum time to wait for a query, in seconds. Defaults to C<11>.
 
 Whether to connect to the full cluster in C<connect()>, or delay that until queries come in.
 
+=item trace_sample_rate
+
+Fraction of queries and batches to trace, between C<0> (the default) and C<1>. See the C<tracing> attribute of C<execute>.
+
+=item trace_hook
+
+Called with a hashref for every traced query, once the server has written its trace. It has the C<command>, the C<node> that coordinated the query, its C<trace_id> and C<timings>: how many seconds the query spent in the client's C<queue>, to C<encode>, to C<write> to the socket, waiting for the C<server> (including the network), to C<decode> the response, and in C<total>. The trace from C<get_trace> comes as C<session> and C<events>, or an C<error> if it couldn't be fetched.
+
 =item protocol_version
 
 Cassandra protocol version to use. Currently defaults to C<4>, can also be set to C<3> for compatibility with older versions of Cassandra.
@@ -635,7 +1179,7 @@ Cassandra protocol version to use. Currently defaults to C<4>, can also be set t
 
 =item $client->batch($queries[, $attributes])
 
-Run one or more queries, in a batch, on Cassandra. Queries must be specified as an arrayref of C<[$query, \@bind]> pairs.
+Run one or more queries, in a batch, on Cassandra. Queries must be specified as an arrayref of C<[$query, \@bind]> pairs. The query may also be a statement object from C<prepare_statement>.
 
 Defaults to a I<logged> batch, which can be overridden by passing C<logged>, C<unlogged> or C<counter> as the C<batch_type> attribute.
 
@@ -644,6 +1188,8 @@ Defaults to a I<logged> batch, which can be overridden by passing C<logged>, C<u
         [ "INSERT INTO my_table (a, b) VALUES (?, ?)", [ $row2_a, $row2_b ] ],
     ], { batch_type => "unlogged" });
 
+Besides C<batch_type> and C<consistency>, batches accept a C<serial_consistency> (for conditional updates), a C<timestamp> (in microseconds, applied to all statements in the batch) and a C<named_values> flag, which sends bind values along with their names. Note that Cassandra itself does not accept named values in batches at the time of writing.
+
 =item $client->execute($query[, $bound_parameters[, $attributes]])
 
 Executes a single query on Cassandra, and fetch the results (if any).
@@ -658,6 +1204,18 @@ For queries that have large amounts of result rows and end up spanning multiple
 
 The C<idempotent> attribute indicates that the query is idempotent and may be retried without harm.
 
+The C<timestamp> attribute sets the write timestamp of the query, in microseconds since the epoch.
+
+The C<priority> attribute decides the order in which queued queries are sent, when more queries are issued than the client lets through (see C<max_concurrent_queries>). Can be C<high>, C<normal> (the default) or C<low>. Use C<low> for background work that shouldn't hold up interactive queries. Batches accept it too.
+
+The C<cache_ttl> attribute allows the result to be served from the result cache (see C<result_cache_size>) if it's no older than this many seconds. A cached result isn't copied, so don't modify its rows.
+
+The C<types> attribute gives the CQL types of the bind values, as an arrayref such as C<< [ 'int', 'text', 'map<text, int>' ] >>. It's only used when the statement is sent without being prepared (see C<prepare_threshold>), as the server doesn't tell us the types then. Only works with bind values given as an arrayref.
+
+The C<decode> attribute overrides the client's C<decode> formats for this query, eg. C<< { decode => { date => 'days' } } >>.
+
+The C<tracing> attribute asks the server to trace the query, or with a false value, not to trace it even if C<trace_sample_rate> says so. Batches accept it too. The tracing session ID is available from the C<trace_id> method of the L<Cassandra::Client::ResultSet>, and goes to the C<trace_hook>. Traced queries always go to the server: they're not answered from the result cache, nor merged by C<coalesce_reads>.
+
 =item $client->each_page($query, $bound_parameters, $attributes, $page_callback)
 
 Executes a query and invokes C<$page_callback> with each page of the results, represented as L<Cassandra::Client::ResultSet> objects.
@@ -670,14 +1228,29 @@ Executes a query and invokes C<$page_callback> with each page of the results, re
         }
     });
 
+=item $client->get_trace($trace_id)
+
+Fetches the trace of a traced query from the C<system_traces> keyspace, as a hashref with the C<session> (C<coordinator>, C<duration> in microseconds, C<request>, C<parameters> and C<started_at>) and its C<events> (C<activity>, C<source>, C<source_elapsed> in microseconds and C<thread>). The server writes traces in the background, so this waits a little while for it to complete.
+
 =item $client->prepare($query)
 
 Prepares a query on the server. C<execute> and C<each_page> already do this internally, so this method is only useful for preloading purposes (and to check whether queries even compile, I guess).
 
+=item $client->prepare_statement($query[, $attributes])
+
+Prepares a query and returns it as a L<Cassandra::Client::Statement>, with its own C<execute> method. The attributes become the defaults for every execution. Executing a statement object skips finding the prepared statement by its query text, which is worth it for long queries that are executed often.
+
+    my ($statement)= $client->prepare_statement("SELECT value FROM my_table WHERE id=?");
+    my ($result)= $statement->execute([ 5 ]);
+
 =item $client->shutdown()
 
 Disconnect all connections and abort all current queries. After this, the C<Cassandra::Client> object considers itself shut down and must be reconstructed with C<new()>.
 
+=item $client->save_snapshot()
+
+Writes the snapshot file set with the C<snapshot> option. This also happens on C<shutdown>, so it's only needed to save one earlier.
+
 =item $client->wait_for_schema_agreement()
 
 Wait until all nodes agree on the schema version. Useful after changing table or keyspace definitions.
@@ -769,6 +1342,10 @@ Thread support is untested. Use at your own risk.
 
 =item *
 
+A client may be used across C<fork>. The child leaves the inherited connections alone, so the parent can keep using them, and lazily opens its own on the first query. Prepared statements and the list of known nodes are kept, so prefork servers can connect in the parent and start querying immediately in each child. Requests that were in flight at the time of the fork are only completed in the parent.
+
+=item *
+
 The C<timestamp> format is implemented naively by returning
 milliseconds since the UNIX epoch. In Perl you get this number through
 C<time() * 1000>. Trying to save times as C<DateTime> objects or
@@ -24,6 +24,22 @@ sub new {
     }, $class;
 }
 
+sub after_fork {
+    my ($self)= @_;
+
+    # AnyEvent has no notion of forking, but its EV backend needs to recreate its kernel state
+    # before we touch any watchers, or we'd be removing our parent's file descriptors from it.
+    EV::default_loop()->loop_fork if AnyEvent::detect() eq 'AnyEvent::Impl::EV';
+
+    $self->{ae_read}= {};
+    $self->{ae_write}= {};
+    $self->{ae_timeout}= undef;
+    $self->{fh_to_obj}= {};
+    $self->{timeouts}= [];
+
+    return;
+}
+
 sub register {
     my ($self, $fh, $connection)= @_;
     $self->{fh_to_obj}{$fh}= $connection;
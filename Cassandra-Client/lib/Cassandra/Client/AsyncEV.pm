@@ -25,6 +25,21 @@ sub new {
     }, $class;
 }
 
+sub after_fork {
+    my ($self)= @_;
+
+    # The loop's backend (epoll, kqueue) is shared with our parent. Stopping our watchers only queues
+    # changes on the old loop, which never runs again, so the parent's registrations stay intact.
+    $self->{ev_read}= {};
+    $self->{ev_write}= {};
+    $self->{ev_timeout}= undef;
+    $self->{fh_to_obj}= {};
+    $self->{timeouts}= [];
+    $self->{ev}= EV::Loop->new();
+
+    return;
+}
+
 sub register {
     my ($self, $fh, $connection)= @_;
     $self->{fh_to_obj}{$fh}= $connection;
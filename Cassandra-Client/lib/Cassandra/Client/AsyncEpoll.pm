@@ -0,0 +1,114 @@
+package Cassandra::Client::AsyncEpoll;
+
+use 5.010;
+use strict;
+use warnings;
+
+# Native event loop, implemented in eventloop.c. Unlike the EV and AnyEvent backends, it doesn't
+# allocate a closure per watcher or a Perl array per deadline, and for plaintext connections it
+# reads from the socket on its own, only waking up Perl when a complete frame is available.
+
+# Called with $@ set when a callback dies, as exceptions can't escape the loop. Same idea as $EV::DIED.
+our $DIED= sub { warn "Cassandra::Client::AsyncEpoll: error in callback (ignoring): $@" };
+
+sub new {
+    my ($class, %args)= @_;
+
+    return bless {
+        loop => Cassandra::Client::EventLoopPtr->new(),
+    }, $class;
+}
+
+sub after_fork {
+    my ($self)= @_;
+
+    # Closing the inherited epoll descriptor leaves our parent's instance alone, while removing
+    # file descriptors from it would not. So just start over with a fresh one.
+    $self->{loop}= Cassandra::Client::EventLoopPtr->new();
+
+    return;
+}
+
+sub register {
+    my ($self, $fh, $connection)= @_;
+
+    # TLS connections have their own buffering, so we can't read ahead on those
+    $self->{loop}->add($fh, $connection, ($connection->{tls} ? undef : $connection->{read_buffer}));
+    return;
+}
+
+sub unregister {
+    my ($self, $fh)= @_;
+    $self->{loop}->remove($fh);
+    return;
+}
+
+sub register_read {
+    my ($self, $fh)= @_;
+    $self->{loop}->watch_read($fh, 1);
+    return;
+}
+
+sub register_write {
+    my ($self, $fh)= @_;
+    $self->{loop}->watch_write($fh, 1);
+    return;
+}
+
+sub unregister_read {
+    my ($self, $fh)= @_;
+    $self->{loop}->watch_read($fh, 0);
+    return;
+}
+
+sub unregister_write {
+    my ($self, $fh)= @_;
+    $self->{loop}->watch_write($fh, 0);
+    return;
+}
+
+sub deadline {
+    my ($self, $fh, $id, $timeout)= @_;
+    return $self->{loop}->deadline($fh, $id, $timeout);
+}
+
+sub timer {
+    my ($self, $callback, $wait)= @_;
+    $self->{loop}->timer($callback, $wait);
+    return;
+}
+
+sub later {
+    my ($self, $callback)= @_;
+    $self->{loop}->timer($callback, 0);
+    return;
+}
+
+# $something->($async->wait(my $w)); my ($error, $result)= $w->();
+sub wait {
+    my ($self)= @_;
+    my $output= \$_[1];
+
+    my ($done, $in_run);
+    my @output;
+    my $callback= sub {
+        $done= 1;
+        @output= @_;
+        $self->{loop}->stop() if $in_run;
+    };
+
+    $$output= sub {
+        if ($self->{in_wait}) {
+            die "Unable to recursively wait for callbacks; are you doing synchronous Cassandra queries from asynchronous callbacks?";
+        }
+        local $self->{in_wait}= 1;
+
+        $in_run= 1;
+        $self->{loop}->run unless $done;
+        return @output;
+    };
+
+    return $callback;
+}
+
+1;
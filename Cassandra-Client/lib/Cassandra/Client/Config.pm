@@ -6,12 +6,14 @@ use warnings;
 
 use Ref::Util qw/is_plain_arrayref is_plain_coderef is_blessed_ref/;
 use Cassandra::Client::Policy::Auth::Password;
+use Cassandra::Client::Protocol qw/decode_flags/;
 
 sub new {
     my ($class, $config)= @_;
 
     my $self= bless {
         anyevent                => 0,
+        epoll                   => 0,
         contact_points          => undef,
         port                    => 9042,
         cql_version             => undef,
@@ -19,39 +21,55 @@ sub new {
         compression             => undef,
         default_consistency     => undef,
         default_idempotency     => 0,
+        client_timestamps       => 0,
+        coalesce_reads          => 0,
+        shard_aware             => 0,
         max_page_size           => 5000,
+        prepare_threshold       => 1,
         max_connections         => 2,
         timer_granularity       => 0.1,
         request_timeout         => 11,
         warmup                  => 0,
         max_concurrent_queries  => 1000,
+        max_concurrent_queries_per_node => 0,
+        result_cache_size       => 0,
+        snapshot                => undef,
+        snapshot_max_age        => 86400,
+        trace_sample_rate       => 0,
         tls                     => 0,
         protocol_version        => 4,
+        proxy                   => undef,
+        decode                  => undef,
+        decode_flags            => 0,
 
         throttler               => undef,
         command_queue           => undef,
         retry_policy            => undef,
+        retry_budget            => undef,
         load_balancing_policy   => undef,
         authentication          => undef,
 
         stats_hook              => undef,
+        trace_hook              => undef,
     }, $class;
 
     if (my $cp= $config->{contact_points}) {
         if (is_plain_arrayref($cp)) {
             @{$self->{contact_points}=[]}= @$cp;
         } else { die "contact_points must be an arrayref"; }
+    } elsif ($config->{proxy}) {
+        $self->{contact_points}= [ "$config->{proxy}" ];
     } else { die "contact_points not specified"; }
 
     # Booleans
-    for (qw/anyevent warmup tls default_idempotency/) {
+    for (qw/anyevent epoll warmup tls default_idempotency client_timestamps coalesce_reads shard_aware/) {
         if (exists($config->{$_})) {
             $self->{$_}= !!$config->{$_};
         }
     }
 
     # Numbers, ignore undef
-    for (qw/port timer_granularity request_timeout max_connections max_concurrent_queries/) {
+    for (qw/port timer_granularity request_timeout max_connections max_concurrent_queries max_concurrent_queries_per_node result_cache_size snapshot_max_age prepare_threshold trace_sample_rate/) {
         if (defined($config->{$_})) {
             $self->{$_}= 0+ $config->{$_};
         }
@@ -64,14 +82,14 @@ sub new {
     }
 
     # Strings
-    for (qw/cql_version keyspace compression default_consistency/) {
+    for (qw/cql_version keyspace compression default_consistency proxy snapshot/) {
         if (exists($config->{$_})) {
             $self->{$_}= defined($config->{$_}) ? "$config->{$_}" : undef;
         }
     }
 
     # Coderefs
-    for (qw/stats_hook/) {
+    for (qw/stats_hook trace_hook/) {
         if (defined($config->{$_})) {
             die "$_ must be a CODE reference" unless is_plain_coderef($config->{$_});
             $self->{$_}= $config->{$_};
@@ -79,7 +97,7 @@ sub new {
     }
 
     # Policies
-    for (qw/throttler retry_policy command_queue load_balancing_policy authentication/) {
+    for (qw/throttler retry_policy retry_budget command_queue load_balancing_policy authentication/) {
         if (exists($config->{$_})) {
             die "$_ must be a blessed reference implementing the correct API"
                 unless is_blessed_ref($config->{$_});
@@ -94,6 +112,18 @@ sub new {
         );
     }
 
+    # Behind a proxy, routing is up to the proxy
+    $self->{shard_aware}= 0 if $self->{proxy};
+
+    if ($self->{anyevent} && $self->{epoll}) {
+        die "anyevent and epoll are mutually exclusive";
+    }
+
+    if (defined $config->{decode}) {
+        $self->{decode_flags}= decode_flags($config->{decode});
+        $self->{decode}= { %{$config->{decode}} };
+    }
+
     if (exists $config->{protocol_version}) {
         if ($config->{protocol_version} == 3 || $config->{protocol_version} == 4) {
             $self->{protocol_version}= 0+ $config->{protocol_version};
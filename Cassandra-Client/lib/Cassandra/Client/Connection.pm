@@ -8,9 +8,11 @@ use vars qw/$BUFFER/;
 use Ref::Util qw/is_blessed_ref is_plain_arrayref/;
 use IO::Socket::INET;
 use IO::Socket::INET6;
-use Errno qw/EAGAIN/;
-use Socket qw/SOL_SOCKET IPPROTO_TCP SO_KEEPALIVE TCP_NODELAY/;
+use IO::Socket::UNIX;
+use Errno qw/EADDRINUSE EAGAIN/;
+use Socket qw/SOL_SOCKET IPPROTO_TCP SO_KEEPALIVE TCP_NODELAY SOCK_STREAM/;
 use Scalar::Util qw/weaken/;
+use Time::HiRes ();
 use Net::SSLeay qw/ERROR_WANT_READ ERROR_WANT_WRITE ERROR_NONE/;
 
 use Cassandra::Client::Util;
@@ -18,12 +20,15 @@ use Cassandra::Client::Protocol qw/
     :constants
     %consistency_lookup
     %batch_type_lookup
+    decode_flags
+    pack_batch
     pack_bytes
     pack_longstring
     pack_queryparameters
     pack_shortbytes
     pack_stringmap
     pack_stringlist
+    pack_stringmultimap
     unpack_bytes
     unpack_errordata
     unpack_inet
@@ -39,6 +44,7 @@ use Cassandra::Client::ResultSet;
 use Cassandra::Client::TLSHandling;
 
 use constant STREAM_ID_LIMIT => 32768;
+use constant SHARD_PORT_ATTEMPTS => 8;
 
 # Populated at BEGIN{} time
 my @compression_preference;
@@ -57,8 +63,7 @@ sub new {
         host            => $args{host},
         metadata        => $args{metadata},
         prepare_cache   => $args{metadata}->prepare_cache,
-        last_stream_id  => 0,
-        pending_streams => {},
+        streams         => Cassandra::Client::StreamTablePtr->new(STREAM_ID_LIMIT),
         in_prepare      => {},
 
         decompress_func => undef,
@@ -78,6 +83,14 @@ sub new {
 
         healthcheck     => undef,
         protocol_version => $args{options}{protocol_version},
+
+        # Scylla only: the shard we're connected to, and how the node is split up. When shard and
+        # shard_port are passed in, we try to get that shard through the node's shard-aware port.
+        shard           => $args{shard},
+        nr_shards       => $args{nr_shards},
+        shard_port      => $args{shard_port},
+        sharding_ignore_msb => undef,
+        shard_aware_port => undef,
     }, $class;
     weaken($self->{async_io});
     weaken($self->{client});
@@ -167,6 +180,7 @@ sub register_events {
     $self->request($callback, OPCODE_REGISTER, pack_stringlist([
         'TOPOLOGY_CHANGE',
         'STATUS_CHANGE',
+        'SCHEMA_CHANGE',
     ]));
 
     return;
@@ -175,15 +189,26 @@ sub register_events {
 
 ###### QUERY CODE
 sub execute_prepared {
-    my ($self, $callback, $queryref, $parameters, $attr, $exec_info)= @_;
+    my ($self, $callback, $queryref, $parameters, $attr, $exec_info, $statement)= @_;
 
     # Note: parameters is retained until the query is complete. It must not be changed; clone if needed.
     # Same for attr. Note that external callers automatically have their arguments cloned.
 
-    my $prepared= $self->{prepare_cache}{$$queryref} or do {
-        return $self->prepare_and_try_execute_again($callback, $queryref, $parameters, $attr, $exec_info);
+    my $prepared= $statement ? $statement->prepared_entry : $self->{prepare_cache}{$$queryref} or do {
+        # Statements that haven't been used often enough to be worth preparing are sent as they are,
+        # as long as we know how to encode their values
+        my $threshold= $self->{options}{prepare_threshold};
+        if ($threshold > 1 && (!$parameters || (is_plain_arrayref($parameters) && (!@$parameters || $attr->{types})))
+                && $self->{metadata}->count_use($$queryref) < $threshold) {
+            return $self->execute_query($callback, $queryref, $parameters, $attr);
+        }
+        return $self->prepare_and_try_execute_again($callback, $queryref, $parameters, $attr, $exec_info, $statement);
     };
 
+    # With tracing, the client wants to know where the time went
+    my $trace= $attr->{_trace};
+    $trace->{dispatched}= Time::HiRes::time() if $trace;
+
     my $want_result_metadata= !$prepared->{decoder};
     my $row;
     if ($parameters) {
@@ -201,17 +226,25 @@ sub execute_prepared {
         return $callback->("Invalid consistency level specified: $attr->{consistency}");
     }
 
+    my $decode_flags= $self->{options}{decode_flags};
+    if ($attr->{decode}) {
+        $decode_flags= eval { decode_flags($attr->{decode}, $decode_flags) } // do {
+            return $callback->("Invalid decode attribute: $@");
+        };
+    }
+
     my $page_size= (0+($attr->{page_size} || $self->{options}{max_page_size} || 0)) || undef;
     my $paging_state= $attr->{page} || undef;
-    my $execute_body= pack_shortbytes($prepared->{id}).pack_queryparameters($consistency, !$want_result_metadata, $page_size, $paging_state, undef, $row);
+    my $execute_body= pack_shortbytes($prepared->{id}).pack_queryparameters($consistency, !$want_result_metadata, $page_size, $paging_state, $attr->{timestamp}, $row);
 
     my $on_completion= sub {
         # my ($body)= $_[2]; (not copying, because performance. assuming ownership)
         my ($err, $code)= @_;
+        $self->trace_received($trace, $_[3]) if $trace;
 
         if ($err) {
             if (is_blessed_ref($err) && $err->code == 0x2500) {
-                return $self->prepare_and_try_execute_again($callback, $queryref, $parameters, $attr, $exec_info);
+                return $self->prepare_and_try_execute_again($callback, $queryref, $parameters, $attr, $exec_info, $statement);
             }
             return $callback->($err);
         }
@@ -224,18 +257,89 @@ sub execute_prepared {
             ));
         }
 
-        $self->decode_result($callback, $prepared, $_[2]);
+        $self->decode_result($callback, $prepared, $_[2], $decode_flags, $_[3]);
     };
 
     return $callback->($attr->{_synthetic_error}) if ($attr->{_synthetic_error});
 
-    $self->request($on_completion, OPCODE_EXECUTE, $execute_body);
+    $trace->{encoded}= Time::HiRes::time() if $trace;
+    $self->request($on_completion, OPCODE_EXECUTE, $execute_body, $trace);
+    $trace->{written}= Time::HiRes::time() if $trace;
 
     return;
 }
 
+# Like execute_prepared, but sends the query text with a QUERY instead. Bind values are encoded
+# according to the 'types' attribute, and the result always comes with its metadata.
+sub execute_query {
+    my ($self, $callback, $queryref, $parameters, $attr)= @_;
+
+    my $trace= $attr->{_trace};
+    $trace->{dispatched}= Time::HiRes::time() if $trace;
+
+    my $row;
+    if ($parameters && @$parameters) {
+        eval {
+            $row= $self->{metadata}->type_encoder($attr->{types})->encode($parameters);
+            1;
+        } or do {
+            my $error= $@ || "??";
+            return $callback->("Failed to encode row to native protocol: $error");
+        };
+    }
+
+    my $consistency= $consistency_lookup{$attr->{consistency} || 'one'};
+    if (!defined $consistency) {
+        return $callback->("Invalid consistency level specified: $attr->{consistency}");
+    }
+
+    my $decode_flags= $self->{options}{decode_flags};
+    if ($attr->{decode}) {
+        $decode_flags= eval { decode_flags($attr->{decode}, $decode_flags) } // do {
+            return $callback->("Invalid decode attribute: $@");
+        };
+    }
+
+    my $page_size= (0+($attr->{page_size} || $self->{options}{max_page_size} || 0)) || undef;
+    my $paging_state= $attr->{page} || undef;
+    my $query_body= pack_longstring($$queryref).pack_queryparameters($consistency, 0, $page_size, $paging_state, $attr->{timestamp}, $row);
+
+    return $callback->($attr->{_synthetic_error}) if ($attr->{_synthetic_error});
+
+    $trace->{encoded}= Time::HiRes::time() if $trace;
+    $self->request(sub {
+        # my ($body)= $_[2]; (not copying, because performance. assuming ownership)
+        my ($err, $code)= @_;
+        $self->trace_received($trace, $_[3]) if $trace;
+        return $callback->($err) if $err;
+
+        if ($code != OPCODE_RESULT) {
+            # This shouldn't ever happen...
+            return $callback->(Cassandra::Client::Error::Base->new(
+                message         => "Expected a RESULT frame but got something else; considering the query failed",
+                request_error   => 1,
+            ));
+        }
+
+        $self->decode_result($callback, undef, $_[2], $decode_flags, $_[3]);
+    }, OPCODE_QUERY, $query_body, $trace);
+    $trace->{written}= Time::HiRes::time() if $trace;
+
+    return;
+}
+
+# The response to a traced request arrived, with the ID of the tracing session (unless the server
+# didn't trace it after all)
+sub trace_received {
+    my ($self, $trace, $trace_id)= @_;
+    $trace->{received}= Time::HiRes::time();
+    $trace->{id}= $trace_id;
+    $trace->{node}= $self->ip_address;
+    return;
+}
+
 sub prepare_and_try_execute_again {
-    my ($self, $callback, $queryref, $parameters, $attr, $exec_info)= @_;
+    my ($self, $callback, $queryref, $parameters, $attr, $exec_info, $statement)= @_;
 
     if ($exec_info->{_prepared_and_tried_again}++) {
         return $callback->("Query failed because it seems to be missing from the server's prepared statement cache");
@@ -254,7 +358,7 @@ sub prepare_and_try_execute_again {
             return $callback->("Internal error: expected query to be prepared but it was not");
         }
 
-        return $self->execute_prepared($callback, $queryref, $parameters, $attr, $exec_info);
+        return $self->execute_prepared($callback, $queryref, $parameters, $attr, $exec_info, $statement);
     });
     return;
 }
@@ -263,6 +367,9 @@ sub execute_batch {
     my ($self, $callback, $queries, $attribs, $exec_info)= @_;
     # Like execute_prepared, assumes ownership of $queries and $attribs
 
+    my $trace= $attribs->{_trace};
+    $trace->{dispatched}= Time::HiRes::time() if $trace;
+
     if (!is_plain_arrayref($queries)) {
         return $callback->("execute_batch: queries argument must be an array of arrays");
     }
@@ -279,8 +386,8 @@ sub execute_batch {
             return $callback->("Query parameters to batch() must be given as an arrayref");
         }
 
-        if (my $prep= $self->{prepare_cache}{$query->[0]}) {
-            push @prepared, [ $prep, $query->[1] ];
+        if (my $prep= (is_blessed_ref($query->[0]) ? $query->[0]->prepared_entry : $self->{prepare_cache}{$query->[0]})) {
+            push @prepared, [ $prep->{id}, $prep->{encoder}, $query->[1] ];
 
         } else {
             return $self->prepare_and_try_batch_again($callback, $queries, $attribs, $exec_info);
@@ -300,15 +407,27 @@ sub execute_batch {
         return $callback->("Invalid consistency level specified: $attribs->{consistency}");
     }
 
-    my $batch_frame= pack('Cn', $batch_type, (0+@prepared));
-    for my $prep (@prepared) {
-        $batch_frame .= pack('C', 1).pack_shortbytes($prep->[0]{id}).$prep->[0]{encoder}->encode($prep->[1]);
+    my $serial_consistency;
+    if ($attribs->{serial_consistency}) {
+        $serial_consistency= $consistency_lookup{$attribs->{serial_consistency}};
+        if (!defined $serial_consistency) {
+            return $callback->("Invalid serial consistency level specified: $attribs->{serial_consistency}");
+        }
     }
-    $batch_frame .= pack('nC', $consistency, 0);
+
+    my $batch_frame;
+    eval {
+        $batch_frame= pack_batch($batch_type, \@prepared, $consistency, $serial_consistency, $attribs->{timestamp}, $attribs->{named_values} ? 1 : 0);
+        1;
+    } or do {
+        my $error= $@ || "??";
+        return $callback->("Failed to encode batch to native protocol: $error");
+    };
 
     my $on_completion= sub {
         # my ($body)= $_[2]; (not copying, because performance. assuming ownership)
         my ($err, $code)= @_;
+        $self->trace_received($trace, $_[3]) if $trace;
 
         if ($err) {
             if (is_blessed_ref($err) && $err->code == 0x2500) {
@@ -325,10 +444,12 @@ sub execute_batch {
             ));
         }
 
-        $self->decode_result($callback, undef, $_[2]);
+        $self->decode_result($callback, undef, $_[2], undef, $_[3]);
     };
 
-    $self->request($on_completion, OPCODE_BATCH, $batch_frame);
+    $trace->{encoded}= Time::HiRes::time() if $trace;
+    $self->request($on_completion, OPCODE_BATCH, $batch_frame, $trace);
+    $trace->{written}= Time::HiRes::time() if $trace;
 
     return;
 }
@@ -341,7 +462,7 @@ sub prepare_and_try_batch_again {
     }
 
     my %to_be_prepared;
-    $to_be_prepared{$_->[0]}= 1 for @$queries;
+    $to_be_prepared{is_blessed_ref($_->[0]) ? $_->[0]{query} : $_->[0]}= 1 for @$queries;
 
     parallel([
         map { my $query= $_; sub {
@@ -384,6 +505,8 @@ sub prepare {
             }
 
             my $id= unpack_shortbytes($body);
+            # unpack_metadata eats it, but snapshots want a copy
+            my $raw_metadata= $self->{options}{snapshot} ? $body : undef;
 
             my ($encoder, $decoder);
             eval {
@@ -395,7 +518,7 @@ sub prepare {
                 1;
             } or return $next->("Unable to unpack query result metadata: $@");
 
-            $self->{metadata}->add_prepared($query, $id, $decoder, $encoder);
+            $self->{metadata}->add_prepared($query, $id, $decoder, $encoder, $raw_metadata);
             return $next->();
         },
     ], sub {
@@ -407,8 +530,39 @@ sub prepare {
     return;
 }
 
+# Used by Cassandra::Client::Proxy: sends a frame we didn't build ourselves, and returns the
+# response as-is. If the server lost track of prepared statements, $reprepare lists the queries
+# to prepare again before retrying.
+sub forward {
+    my ($self, $callback, $opcode, $flags, $body, $reprepare, $exec_info)= @_;
+
+    my $copy= $body; # request() assumes ownership, but we may need to send this again
+    $self->request(sub {
+        my ($error, $code)= @_;
+
+        if ($error) {
+            if ($reprepare && @$reprepare && is_blessed_ref($error) && $error->code == 0x2500 && !$exec_info->{_prepared_and_tried_again}++) {
+                return parallel([
+                    map {
+                        my $query= $_;
+                        sub { $self->request($_[0], OPCODE_PREPARE, pack_longstring($query)) }
+                    } @$reprepare
+                ], sub {
+                    return $callback->($_[0]) if $_[0];
+                    return $self->forward($callback, $opcode, $flags, $body, $reprepare, $exec_info);
+                });
+            }
+            return $callback->($error);
+        }
+
+        return $callback->(undef, [ $code, $_[2], $_[3] ]);
+    }, $opcode, $copy, 0, $flags);
+
+    return;
+}
+
 sub decode_result {
-    my ($self, $callback, $prepared)= @_; # $_[3]=$body
+    my ($self, $callback, $prepared)= @_; # $_[3]=$body, $_[4]=$decode_flags, $_[5]=$trace_id
 
     my $result_type= unpack('l>', substr($_[3], 0, 4, ''));
     if ($result_type == RESULT_ROWS) { # Rows
@@ -426,6 +580,8 @@ sub decode_result {
                 \$_[3],
                 $decoder,
                 $paging_state,
+                $_[4],
+                $_[5],
             )
         );
 
@@ -437,6 +593,7 @@ sub decode_result {
         return $callback->();
 
     } elsif ($result_type == RESULT_SCHEMA_CHANGE) { # Schema change
+        $self->{client}->_handle_schema_change if $self->{client};
         return $self->wait_for_schema_agreement(sub {
             # We may be passed an error. Ignore it, our query succeeded
             $callback->();
@@ -494,6 +651,15 @@ sub handshake {
     series([
         sub { # Send the OPCODE_OPTIONS
             my ($next)= @_;
+            my ($cql_version, $compression)= @{$self->{options}}{qw/cql_version compression/};
+            if ($cql_version && $compression && !$self->{options}{proxy} && !$self->{options}{shard_aware}) {
+                # Nothing to negotiate: save a round trip and assume the server supports what we
+                # asked for. If it doesn't, it will reject the STARTUP.
+                return $next->(undef, OPCODE_SUPPORTED, pack_stringmultimap({
+                    CQL_VERSION => [ $cql_version ],
+                    COMPRESSION => [ $compression ],
+                }));
+            }
             $self->request($next, OPCODE_OPTIONS, '');
         },
         sub { # The server hopefully just told us what it supports, let's respond with a STARTUP message
@@ -508,6 +674,8 @@ sub handshake {
                 return $next->("Server did not return compression and cql version information");
             }
 
+            $self->set_sharding_info($map) if $self->{options}{shard_aware};
+
             my $selected_cql_version= $self->{options}{cql_version};
             if (!$selected_cql_version) {
                 ($selected_cql_version)= reverse sort @{$map->{CQL_VERSION}};
@@ -556,19 +724,34 @@ sub handshake {
 
             return $next->("Unexpected response from the server");
         },
-        sub {
+        sub { # The keyspace and the node's address don't depend on each other, so ask for both at once
             my ($next)= @_;
-            if ($self->{options}{keyspace}) {
-                return $self->execute_prepared($next, \('use "'.$self->{options}{keyspace}.'"'));
-            }
-            return $next->();
-        },
-        sub {
-            my ($next)= @_;
-            if (!$self->{ipaddress}) {
-                return $self->get_local_status($next);
-            }
-            return $next->();
+            parallel([
+                sub {
+                    my ($pnext)= @_;
+                    if ($self->{options}{keyspace} && !$self->{options}{proxy}) {
+                        # A plain QUERY, as preparing it would cost another round trip
+                        return $self->request($pnext, OPCODE_QUERY,
+                            pack_longstring('use "'.$self->{options}{keyspace}.'"')
+                            .pack_queryparameters(CONSISTENCY_ONE));
+                    }
+                    return $pnext->();
+                },
+                sub {
+                    my ($pnext)= @_;
+                    if ($self->{options}{proxy}) {
+                        # The proxy is the only node we talk to
+                        $self->{ipaddress}= $self->{host};
+                    }
+                    if (!$self->{ipaddress}) {
+                        return $self->get_local_status($pnext);
+                    }
+                    return $pnext->();
+                },
+            ], sub {
+                my ($error, undef, $status)= @_;
+                return $next->($error, $status);
+            });
         },
         sub {
             my ($next, $status)= @_;
@@ -576,6 +759,7 @@ sub handshake {
                 my ($local)= values %$status;
                 $self->{ipaddress}= $local->{peer};
                 $self->{datacenter}= $local->{data_center};
+                $self->{rack}= $local->{rack};
             }
             if (!$self->{ipaddress}) {
                 return $next->("Unable to determine node's IP address");
@@ -587,6 +771,25 @@ sub handshake {
     return;
 }
 
+# Scylla splits its nodes into shards, one per core, and tells us which shard got our connection.
+# We only understand the one sharding algorithm there is so far.
+sub set_sharding_info {
+    my ($self, $supported)= @_;
+    my ($nr_shards)= @{$supported->{SCYLLA_NR_SHARDS} || []};
+    my ($algorithm)= @{$supported->{SCYLLA_SHARDING_ALGORITHM} || []};
+    my ($shard)= @{$supported->{SCYLLA_SHARD} || []};
+
+    $self->{nr_shards}= undef;
+    return unless $nr_shards && $nr_shards > 1 && defined $shard && $shard < $nr_shards;
+    return unless $algorithm && $algorithm eq 'biased-token-round-robin';
+
+    $self->{shard}= $shard;
+    $self->{nr_shards}= $nr_shards;
+    ($self->{sharding_ignore_msb})= @{$supported->{SCYLLA_SHARDING_IGNORE_MSB} || [0]};
+    ($self->{shard_aware_port})= @{$supported->{$self->{options}{tls} ? 'SCYLLA_SHARD_AWARE_PORT_SSL' : 'SCYLLA_SHARD_AWARE_PORT'} || []};
+    return;
+}
+
 sub authenticate {
     my ($self, $callback, $initial_challenge)= @_;
 
@@ -662,11 +865,20 @@ sub handle_event {
         my ($change, $ipaddress)= (unpack_string($eventdata), unpack_inet($eventdata));
         $self->{client}->_handle_status_change($change, $ipaddress);
 
+    } elsif ($type eq 'SCHEMA_CHANGE') {
+        $self->{client}->_handle_schema_change;
+
     } else {
         warn 'Received unknown event type: '.$type;
     }
 }
 
+# Requests the node is still working on, as far as we know: including those that timed out
+sub in_flight {
+    my $streams= $_[0]{streams};
+    return $streams->active + $streams->orphaned;
+}
+
 sub get_pool_id {
     $_[0]{pool_id}
 }
@@ -705,22 +917,38 @@ sub connect {
     my $socket; {
         local $@;
 
-        if ($self->{host} =~ /:/) {
-            # IPv6
-            $socket= IO::Socket::INET6->new(
-                PeerAddr => $self->{host},
-                PeerPort => $self->{options}{port},
-                Proto    => 'tcp',
-                Blocking => 0,
+        if ($self->{options}{proxy}) {
+            # Local multiplexer, see Cassandra::Client::Proxy
+            $socket= IO::Socket::UNIX->new(
+                Peer => $self->{options}{proxy},
+                Type => SOCK_STREAM,
             );
-        } else {
-            # IPv6
-            $socket= IO::Socket::INET->new(
+            unless ($socket) {
+                my $error= "Could not connect to proxy: $!";
+                return $callback->($error);
+            }
+            $socket->blocking(0);
+            last;
+        }
+
+        # Scylla's shard-aware port hands the connection to shard (source port % shard count)
+        my $use_shard_port= $self->{shard_port} && defined $self->{shard} && $self->{nr_shards};
+        for my $attempt (1..($use_shard_port ? SHARD_PORT_ATTEMPTS : 1)) {
+            my %args= (
                 PeerAddr => $self->{host},
-                PeerPort => $self->{options}{port},
+                PeerPort => ($use_shard_port ? $self->{shard_port} : $self->{options}{port}),
                 Proto    => 'tcp',
                 Blocking => 0,
+                ($use_shard_port ? (LocalPort => _shard_local_port($self->{shard}, $self->{nr_shards})) : ()),
             );
+            if ($self->{host} =~ /:/) {
+                # IPv6
+                $socket= IO::Socket::INET6->new(%args);
+            } else {
+                # IPv4
+                $socket= IO::Socket::INET->new(%args);
+            }
+            last if $socket || $! != EADDRINUSE;
         }
 
         unless ($socket) {
@@ -758,30 +986,33 @@ sub connect {
     return;
 }
 
+# A random local port that maps to the shard
+sub _shard_local_port {
+    my ($shard, $nr_shards)= @_;
+    my $port= 49152 + $nr_shards + int(rand(16384 - 2 * $nr_shards));
+    return $port - ($port % $nr_shards) + $shard;
+}
+
 sub request {
     # my $body= $_[3] (let's avoid copying that blob). Yes, this code assumes ownership of the body.
+    # A true $_[4] asks the server to trace the request. $_[5] has the flags of a proxied request.
     my ($self, $cb, $opcode)= @_;
     return $cb->(Cassandra::Client::Error::Base->new(
         message => "Connection shutting down",
         request_error => 1,
     )) if $self->{shutdown};
 
-    my $pending= $self->{pending_streams};
-
-    my $stream_id= $self->{last_stream_id} + 1;
-    my $attempts= 0;
-    while (exists($pending->{$stream_id}) || $stream_id >= STREAM_ID_LIMIT) {
-        $stream_id= (++$stream_id) % STREAM_ID_LIMIT;
-        return $cb->(Cassandra::Client::Error::Base->new(
-            message => "Cannot find a stream ID to post query with",
-            request_error => 1,
-        )) if ++$attempts >= STREAM_ID_LIMIT;
-    }
-    $self->{last_stream_id}= $stream_id;
-    $pending->{$stream_id}= [$cb, $self->{async_io}->deadline($self->{fileno}, $stream_id, $self->{request_timeout})];
+    my $streams= $self->{streams};
+    my $stream_id= $streams->acquire($cb);
+    return $cb->(Cassandra::Client::Error::Base->new(
+        message => "Cannot find a stream ID to post query with",
+        request_error => 1,
+    )) if $stream_id < 0;
+    $streams->set_deadline($stream_id, $self->{async_io}->deadline($self->{fileno}, $stream_id, $self->{request_timeout}));
 
     WRITE: {
-        my $flags= 0;
+        my $flags= $_[4] ? 2 : 0;
+        $flags |= $_[5] & ~1 if $_[5]; # Except compression, which is between us and the server
 
         if (length($_[3]) > 500 && (my $compress_func= $self->{compress_func})) {
             $flags |= 1;
@@ -821,16 +1052,13 @@ sub request {
                     # We failed to send the request.
                     my $error= Net::SSLeay::ERR_error_string(Net::SSLeay::ERR_get_error());
 
-                    # We never actually sent our request, so take it out again
-                    my $my_stream= delete $pending->{$stream_id};
-
-                    # Disable our stream's deadline
-                    ${$my_stream->[1]}= 1;
+                    # We never actually sent our request, so take it out again. This also disables its deadline.
+                    my $my_cb= $streams->release($stream_id);
 
                     $self->shutdown($error);
 
                     # Now fail our stream properly, but include the retry notice
-                    $my_stream->[0]->(Cassandra::Client::Error::Base->new(
+                    $my_cb->(Cassandra::Client::Error::Base->new(
                         message       => "Disconnected: $error",
                         do_retry      => 1,
                         request_error => 1,
@@ -853,16 +1081,13 @@ sub request {
                 # Oh, we failed to send out the request. That's bad. Let's first find out what happened.
                 my $error= $!;
 
-                # We never actually sent our request, so take it out again
-                my $my_stream= delete $pending->{$stream_id};
-
-                # Disable our stream's deadline
-                ${$my_stream->[1]}= 1;
+                # We never actually sent our request, so take it out again. This also disables its deadline.
+                my $my_cb= $streams->release($stream_id);
 
                 $self->shutdown($error);
 
                 # Now fail our stream properly, but include the retry notice
-                $my_stream->[0]->(Cassandra::Client::Error::Base->new(
+                $my_cb->(Cassandra::Client::Error::Base->new(
                     message       => "Disconnected: $error",
                     do_retry      => 1,
                     request_error => 1,
@@ -946,6 +1171,11 @@ READ_NEXT:
                 # Decompress if needed
                 $self->{decompress_func}->($body);
             }
+            my $trace_id;
+            if ($flags & 2) {
+                # Tracing session ID, for a request that had the tracing flag
+                $trace_id= substr($body, 0, 16, '');
+            }
             if ($flags & 4) {
                 # FIXME: If we reach this (we shouldn't!), we're corrupting the user's data.
                 warn 'BUG: unexpectedly received custom QueryHandler payload';
@@ -959,21 +1189,20 @@ READ_NEXT:
             }
 
             if ($stream_id != -1) {
-                my $stream_cb= delete $self->{pending_streams}{$stream_id};
-                if (!$stream_cb) {
-                    warn 'BUG: received response for unknown stream';
+                # Also dismisses the deadline. Returns undef for requests that already timed out.
+                my $cb= $self->{streams}->release($stream_id);
+                if (!$cb) {
+                    # The answer to a request that timed out. The node is done with it now, so it
+                    # may have room for the commands that are queued because of it.
+                    my $client= $self->{client};
+                    $client->_schedule_command_dequeue if $client && $client->{command_queue}{has_any};
 
                 } elsif ($opcode == OPCODE_ERROR) {
-                    my ($cb, $dl)= @$stream_cb;
-                    $$dl= 1;
-
                     my $error= unpack_errordata($body);
-                    $cb->($error);
+                    $cb->($error, undef, undef, $trace_id);
 
                 } else {
-                    my ($cb, $dl)= @$stream_cb;
-                    $$dl= 1;
-                    $cb->(undef, $opcode, $body);
+                    $cb->(undef, $opcode, $body, $trace_id);
                 }
 
             } else {
@@ -1049,9 +1278,9 @@ sub can_write {
 
 sub can_timeout {
     my ($self, $id)= @_;
-    my $stream= delete $self->{pending_streams}{$id};
-    $self->{pending_streams}{$id}= [ sub{}, \(my $zero= 0) ]; # fake it
-    $stream->[0]->(Cassandra::Client::Error::Base->new(
+    # The server may still answer, so the stream ID stays reserved until it does
+    my $cb= $self->{streams}->timeout($id) or return;
+    $cb->(Cassandra::Client::Error::Base->new(
         message         => "Request timed out",
         is_timeout      => 1,
         request_error   => 1,
@@ -1095,11 +1324,8 @@ sub shutdown {
     return if $self->{shutdown};
     $self->{shutdown}= 1;
 
-    my $pending= $self->{pending_streams};
-    $self->{pending_streams}= {};
-
-    # Disable our deadlines
-    ${$_->[1]}= 1 for values %$pending;
+    # Also disables our deadlines
+    my @pending= $self->{streams}->drain;
 
     $self->{async_io}->unregister_read($self->{fileno});
     if (defined(delete $self->{pending_write})) {
@@ -1109,8 +1335,8 @@ sub shutdown {
     $self->{client}->_disconnected($self->get_pool_id);
     $self->{socket}->close;
 
-    for (values %$pending) {
-        $_->[0]->(Cassandra::Client::Error::Base->new(
+    for (@pending) {
+        $_->(Cassandra::Client::Error::Base->new(
             message       => "Disconnected: $shutdown_reason",
             request_error => 1,
         ));
@@ -1120,6 +1346,22 @@ sub shutdown {
 }
 
 
+# Used after a fork: the socket and TLS session are still in use by the parent, so we drop our
+# copies without sending anything, and without invoking callbacks that belong to the parent.
+sub abandon {
+    my ($self)= @_;
+
+    return if $self->{shutdown};
+    $self->{shutdown}= 1;
+
+    $self->{streams}->drain;
+    $self->{pending_write}= undef;
+    $self->{tls}= undef;
+    $self->{socket}->close if $self->{socket};
+
+    return;
+}
+
 
 ###### COMPRESSION
 BEGIN {
@@ -4,11 +4,17 @@ use 5.010;
 use strict;
 use warnings;
 
+use Cassandra::Client::Protocol qw/pack_metadata parse_type unpack_metadata/;
+
+use constant MAX_COUNTED_QUERIES => 10000;
+
 sub new {
     my ($class, %args)= @_;
 
     return bless {
         prepare_cache => {},
+        uses => {},
+        type_encoders => {},
     }, $class;
 }
 
@@ -17,12 +23,19 @@ sub prepare_cache {
 }
 
 sub add_prepared {
-    my ($self, $query, $id, $decoder, $encoder)= @_;
-    $self->{prepare_cache}{$query}= {
+    my ($self, $query, $id, $decoder, $encoder, $raw)= @_;
+    my $entry= {
         id => $id,
         decoder => $decoder,
-        encoder => $encoder
+        encoder => $encoder,
     };
+    $entry->{raw}= $raw if defined $raw; # The metadata as the server sent it, for snapshots
+    if (my $old= $self->{prepare_cache}{$query}) {
+        # Statement objects may still refer to the old entry
+        $old->{replaced_by}= $entry;
+    }
+    $self->{prepare_cache}{$query}= $entry;
+    delete $self->{uses}{$query};
     if (values %{$self->{prepare_cache}} > 500) {
         unless ($self->{warned}++) {
             warn "Cassandra::Client: found more than 500 queries in our prepared statement cache, try using placeholders";
@@ -31,6 +44,30 @@ sub add_prepared {
     return;
 }
 
+# How often an unprepared statement was executed, including this time. Only an estimate: if too
+# many statements are being counted, we start over.
+sub count_use {
+    my ($self, $query)= @_;
+    %{$self->{uses}}= () if keys %{$self->{uses}} >= MAX_COUNTED_QUERIES;
+    return ++$self->{uses}{$query};
+}
+
+# An encoder for bind values of the given types (names such as 'int', or pack_option_type structures)
+sub type_encoder {
+    my ($self, $types)= @_;
+    return _type_encoder($types) if grep ref, @$types;
+    return $self->{type_encoders}{join(',', @$types)} ||= _type_encoder($types);
+}
+
+sub _type_encoder {
+    my ($types)= @_;
+    my $i= 0;
+    my ($encoder)= unpack_metadata(4, 1, pack_metadata(4, 1, {
+        columns => [ map { [ '', '', 'p'.($i++), (ref $_ ? $_ : parse_type($_)) ] } @$types ],
+    }));
+    return $encoder;
+}
+
 sub is_prepared {
     my ($self, $queryref)= @_;
     my $cached= $self->{prepare_cache}{$$queryref};
@@ -63,6 +63,10 @@ sub select_master {
                 },
                 sub {
                     my ($next, $connection)= @_;
+                    if ($pool->{options}{proxy}) {
+                        # Topology is the proxy's problem, we only know about the proxy itself
+                        return $next->(undef, undef, { $connection->ip_address => { peer => $connection->ip_address } }, $connection);
+                    }
                     parallel([
                         sub {
                             my ($pnext)= @_;
@@ -101,6 +105,16 @@ sub shutdown {
     $self->{shutdown}= 1;
 }
 
+sub after_fork {
+    my ($self)= @_;
+
+    # Keep the node list, but pick a new master once we reconnect
+    $self->{master_id}= undef;
+    $self->{waiting_for_cb}= [];
+
+    return;
+}
+
 sub load_status {
     my ($self, $new_status)= @_;
     my $old_status= $self->{status};
@@ -20,11 +20,8 @@ sub new {
 
 sub get_distance {
     my ($self, $peer)= @_;
-    my $node= $self->{nodes}{$peer};
-    if (!$node) {
-        warn 'Being asked about a distance for a node we don\'t know';
-        return 'ignored';
-    }
+    # The pool asks about the node it connected to first before we know any, which is fine
+    return 'ignored' unless $self->{nodes}{$peer};
 
     if ($self->{local_nodes}{$peer}) {
         return 'local';
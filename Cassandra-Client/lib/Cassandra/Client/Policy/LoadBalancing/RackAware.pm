@@ -0,0 +1,60 @@
+package Cassandra::Client::Policy::LoadBalancing::RackAware;
+
+use parent 'Cassandra::Client::Policy::LoadBalancing::Default';
+use 5.010;
+use strict;
+use warnings;
+use List::Util 'shuffle';
+
+# Like Default, but within the local datacenter it prefers the nodes in our own rack (availability
+# zone, usually), as going to another one costs latency and often money. We connect to those nodes
+# first, and the pool sends queries to them as long as they're not busy. The other nodes of the
+# datacenter are only connected to when max_connections is more than our rack has nodes, or when
+# those are down, and used as a fallback.
+#
+# Takes 'datacenter' and 'rack' arguments. Without them, both are taken from the first node we
+# connect to, which is the contact point that answered first.
+
+sub new {
+    my ($class, %args)= @_;
+    my $self= $class->SUPER::new(%args);
+    $self->{datacenter}= $args{datacenter};
+    $self->{rack}= $args{rack};
+    $self->{rack_nodes}= {};
+    return $self;
+}
+
+sub get_distance {
+    my ($self, $peer)= @_;
+    return 'local' if $self->{rack_nodes}{$peer};
+    return 'remote' if $self->{local_nodes}{$peer};
+    return 'ignored';
+}
+
+sub on_new_node {
+    my ($self, $node)= @_;
+    $self->SUPER::on_new_node($node);
+
+    my $peer= $node->{peer};
+    if ($self->{local_nodes}{$peer} && defined $self->{rack} && defined $node->{rack} && $node->{rack} eq $self->{rack}) {
+        $self->{rack_nodes}{$peer}= $node;
+    }
+}
+
+sub on_removed_node {
+    my ($self, $node)= @_;
+    $self->SUPER::on_removed_node($node);
+    delete $self->{rack_nodes}{$node->{peer}};
+}
+
+sub get_next_candidate {
+    my ($self)= @_;
+
+    # Our rack first, then the rest of the datacenter. No list of candidates to go through, as a
+    # node in our rack may have come back in the meantime.
+    my @available= grep { !$self->{connected}{$_} && $self->check_backoff($_) } keys %{$self->{local_nodes}};
+    my @rack= grep { $self->{rack_nodes}{$_} } @available;
+    return (shuffle(@rack ? @rack : @available))[0];
+}
+
+1;
@@ -4,6 +4,10 @@ use 5.010;
 use strict;
 use warnings;
 
+# Queued commands are sent in order of their priority attribute, and in order of arrival within a
+# priority, so interactive queries don't wait behind background work.
+my @priorities= qw/high normal low/;
+
 sub new {
     my ($class, %args)= @_;
 
@@ -12,7 +16,7 @@ sub new {
     return bless {
         max_entries => 0+ $max_entries,
         has_any     => 0, # We're using this as a count.
-        queue       => [],
+        queues      => { map { $_ => [] } @priorities },
     }, $class;
 }
 
@@ -23,16 +27,54 @@ sub enqueue {
         return "command queue full: $self->{has_any} entries";
     }
 
-    push @{$self->{queue}}, $item;
+    my $priority= $item->[3] && $item->[3]{priority} || 'normal';
+    push @{$self->{queues}{$priority} || $self->{queues}{normal}}, $item;
     $self->{has_any}++;
     return;
 }
 
 sub dequeue {
     my ($self)= @_;
-    my $item= shift @{$self->{queue}};
-    $self->{has_any}= 0+@{$self->{queue}};
-    return $item;
+    for my $priority (@priorities) {
+        my $queue= $self->{queues}{$priority};
+        next unless @$queue;
+        $self->{has_any}--;
+        return shift @$queue;
+    }
+    return;
+}
+
+# Entries that wait too long are taken out by the client, using the queue_deadline it puts in their
+# command info. Everything waits for the same request_timeout, so within a priority the entries are in
+# order of their deadline, and the expired ones are at the front.
+sub expire {
+    my ($self, $now)= @_;
+    my @expired;
+    for my $priority (@priorities) {
+        my $queue= $self->{queues}{$priority};
+        while (@$queue && _deadline($queue->[0]) <= $now) {
+            push @expired, shift @$queue;
+            $self->{has_any}--;
+        }
+    }
+    return @expired;
+}
+
+sub next_deadline {
+    my ($self)= @_;
+    my $next;
+    for my $priority (@priorities) {
+        my $queue= $self->{queues}{$priority};
+        next unless @$queue;
+        my $deadline= _deadline($queue->[0]);
+        $next= $deadline if !defined $next || $deadline < $next;
+    }
+    return $next;
+}
+
+sub _deadline {
+    my ($item)= @_;
+    return ($item->[3] && $item->[3]{queue_deadline}) // 9**9**9;
 }
 
 1;
@@ -7,9 +7,10 @@ use warnings;
 use Exporter 'import';
 our @EXPORT_OK= (qw/try_next_host retry rethrow/);
 
+# Like retry, but the query should go to a different node than the one that failed it
 sub try_next_host {
     my $cl= shift;
-    return 'retry';
+    return 'try_next_host';
 }
 
 sub retry {
@@ -0,0 +1,58 @@
+package Cassandra::Client::Policy::Retry::Budget;
+
+use 5.010;
+use strict;
+use warnings;
+
+use Time::HiRes qw/CLOCK_MONOTONIC/;
+
+# Caps retries to a fraction of the successful queries, so that during an outage retries can't
+# multiply the load on a cluster that is already struggling. Every success deposits 'ratio' tokens
+# (up to 'max_tokens'), every retry takes one. On top of that there's an allowance of
+# 'min_per_second' retries, so a client that only sends a few queries can still retry them.
+
+sub new {
+    my ($class, %args)= @_;
+
+    my $self= bless {
+        ratio          => $args{ratio} // 0.1,
+        min_per_second => $args{min_per_second} // 10,
+        max_tokens     => $args{max_tokens} // 100,
+
+        tokens         => 0,
+        allowance      => 0,
+        last_refill    => Time::HiRes::clock_gettime(CLOCK_MONOTONIC),
+    }, $class;
+    $self->{allowance}= $self->{min_per_second};
+
+    return $self;
+}
+
+sub deposit {
+    my ($self)= @_;
+    $self->{tokens} += $self->{ratio};
+    $self->{tokens}= $self->{max_tokens} if $self->{tokens} > $self->{max_tokens};
+    return;
+}
+
+# Returns true if the retry may go ahead
+sub withdraw {
+    my ($self)= @_;
+
+    my $now= Time::HiRes::clock_gettime(CLOCK_MONOTONIC);
+    $self->{allowance} += ($now - $self->{last_refill}) * $self->{min_per_second};
+    $self->{allowance}= $self->{min_per_second} if $self->{allowance} > $self->{min_per_second};
+    $self->{last_refill}= $now;
+
+    if ($self->{allowance} >= 1) {
+        $self->{allowance}--;
+        return 1;
+    }
+    if ($self->{tokens} >= 1) {
+        $self->{tokens}--;
+        return 1;
+    }
+    return 0;
+}
+
+1;
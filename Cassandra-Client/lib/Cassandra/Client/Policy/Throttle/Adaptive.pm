@@ -4,38 +4,26 @@ use parent 'Cassandra::Client::Policy::Throttle::Default';
 use 5.010;
 use strict;
 use warnings;
-use Time::HiRes qw/CLOCK_MONOTONIC/;
 use Ref::Util qw/is_blessed_ref/;
 use Cassandra::Client::Error::ClientThrottlingError;
 
 sub new {
     my ($class, %args)= @_;
+    my $time= $args{time} || 120;
     return bless {
         ratio => $args{ratio} || 2,
-        time => $args{time} || 120,
+        time => $time,
 
-        window => [],
-        window_success => 0,
-        window_total => 0,
+        # Counts over the last $time seconds, in a fixed number of buckets (see ringcounter.c)
+        window => Cassandra::Client::RingCounterPtr->new($time, $args{buckets} || 60),
     }, $class;
 }
 
-sub _process_window {
-    my ($self)= @_;
-    my $now= Time::HiRes::clock_gettime(CLOCK_MONOTONIC);
-    while (@{$self->{window}} && $self->{window}[0][0] < $now) {
-        my $entry= shift @{$self->{window}};
-        $self->{window_total}--;
-        $self->{window_success}-- if $entry->[1];
-    }
-    return;
-}
-
 sub should_fail {
     my ($self)= @_;
-    $self->_process_window;
+    my ($total, $success)= $self->{window}->totals;
 
-    my $fail= ( rand() < (($self->{window_total} - ($self->{ratio} * $self->{window_success})) / ($self->{window_total} + 1)) );
+    my $fail= ( rand() < (($total - ($self->{ratio} * $success)) / ($total + 1)) );
     return unless $fail;
 
     $self->count(undef, 1);
@@ -47,10 +35,8 @@ sub count {
 
     return if is_blessed_ref($error) && $error->isa('Cassandra::Client::Error::ClientThrottlingError');
 
-    $self->{window_total}++;
     my $success= !(is_blessed_ref($error) && $error->is_timeout) && !$force_error;
-    push @{$self->{window}}, [ Time::HiRes::clock_gettime(CLOCK_MONOTONIC)+$self->{time}, $success ];
-    $self->{window_success}++ if $success;
+    $self->{window}->add($success ? 1 : 0);
     return;
 }
 
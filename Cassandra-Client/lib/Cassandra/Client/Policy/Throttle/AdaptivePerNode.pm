@@ -0,0 +1,37 @@
+package Cassandra::Client::Policy::Throttle::AdaptivePerNode;
+
+use parent 'Cassandra::Client::Policy::Throttle::Default';
+use 5.010;
+use strict;
+use warnings;
+use Cassandra::Client::Policy::Throttle::Adaptive;
+
+# Like Adaptive, but keeps a separate window for every node, so timeouts from one struggling node
+# throttle only the queries sent to that node. Takes the same arguments as Adaptive.
+
+sub new {
+    my ($class, %args)= @_;
+    return bless {
+        args => \%args,
+        nodes => {},
+    }, $class;
+}
+
+sub _node {
+    my ($self, $connection)= @_;
+    return $self->{nodes}{$connection->ip_address} ||= Cassandra::Client::Policy::Throttle::Adaptive->new(%{$self->{args}});
+}
+
+sub should_fail {
+    my ($self, $connection)= @_;
+    return unless $connection; # Not about a node, like when connecting
+    return $self->_node($connection)->should_fail;
+}
+
+sub count {
+    my ($self, $error, $force_error, $connection)= @_;
+    return unless $connection;
+    return $self->_node($connection)->count($error, $force_error);
+}
+
+1;
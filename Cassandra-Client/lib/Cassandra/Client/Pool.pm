@@ -5,8 +5,12 @@ use strict;
 use warnings;
 
 use Scalar::Util 'weaken';
+use Time::HiRes ();
 use Cassandra::Client::Util;
 use Cassandra::Client::NetworkStatus;
+use Cassandra::Client::Protocol qw/scylla_shard token_sort_key/;
+
+use constant SHARD_CONNECT_BACKOFF => 5;
 
 sub new {
     my ($class, %args)= @_;
@@ -17,6 +21,7 @@ sub new {
         max_connections => $args{options}{max_connections},
         async_io => $args{async_io},
         policy => $args{load_balancing_policy},
+        known_nodes => $args{known_nodes},
 
         shutdown => 0,
         pool => {},
@@ -27,9 +32,17 @@ sub new {
         id2ip => {},
 
         i => 0,
+        near => [],
+        near_count => 0,
+        near_i => 0,
 
         connecting => {},
         wait_connect => [],
+
+        # With shard_aware: per node, a connection for each of its shards, and the token ring
+        shards => {},
+        shard_backoff => {},
+        ring => undef,
     }, $class;
     weaken($self->{client});
     $self->{network_status}= Cassandra::Client::NetworkStatus->new(pool => $self, async_io => $args{async_io});
@@ -43,15 +56,28 @@ sub init {
 
     # If we didn't have a datacenter pinned before, now we do
     $self->{policy}{datacenter} ||= $first_connection->{datacenter};
+    # Same for the rack, if the policy cares about it
+    if (exists $self->{policy}{rack} && !defined $self->{policy}{rack} && ($first_connection->{datacenter} // '') eq $self->{policy}{datacenter}) {
+        $self->{policy}{rack}= $first_connection->{rack};
+    }
 
     $self->add($first_connection);
     $self->{policy}->set_connecting($first_connection->ip_address);
     $self->{policy}->set_connected($first_connection->ip_address);
 
+    # With the nodes from a snapshot, we don't need to wait for master selection: it refreshes the
+    # node list in the background.
+    my $known_nodes= delete $self->{known_nodes};
+    $self->{network_status}->load_status($known_nodes) if $known_nodes;
+
     # Master selection, warmup, etc
     series([
         sub {
             my ($next)= @_;
+            if ($known_nodes) {
+                $self->{network_status}->init(sub {});
+                return $next->();
+            }
             $self->{network_status}->init($next);
         },
         sub {
@@ -67,18 +93,201 @@ sub init {
     ], $callback);
 }
 
+# Returns undef if there are no connections, or if every node is at max_concurrent_queries_per_node.
+# If $avoid (an IP address) is given, that node is only picked when there's no other. Nodes that the
+# load balancing policy says are local come first: the others only get queries when those can't.
 sub get_one {
-    my ($self)= @_;
+    my ($self, $avoid)= @_;
     return undef unless $self->{count};
 
+    if ($self->{near_count}) {
+        my $connection= $self->_pick_one($self->{near}, 'near_i', $avoid, 1);
+        return $connection if $connection;
+    }
+    return $self->_pick_one($self->{list}, 'i', $avoid);
+}
+
+# Round-robin over the list, with the index in $self->{$index}. Strict means no fallback to the
+# node to avoid.
+sub _pick_one {
+    my ($self, $list, $index, $avoid, $strict)= @_;
+    my $count= @$list;
+
     # Round-robin: pick the next one
-    return $self->{list}[$self->{i}= (($self->{i}+1) % $self->{count})];
+    my $connection= $list->[$self->{$index}= (($self->{$index}+1) % $count)];
+    my $limit= $self->{options}{max_concurrent_queries_per_node};
+    return $connection if !$limit && !$avoid;
+
+    # Try the others if that node is busy or to be avoided
+    my $fallback;
+    for (1..$count) {
+        $connection= $list->[$self->{$index}= (($self->{$index}+1) % $count)] if $_ > 1;
+        next if $limit && $self->node_in_flight($connection->ip_address) >= $limit;
+        return $connection unless $avoid && $connection->ip_address eq $avoid;
+        $fallback= $connection;
+    }
+    return $strict ? undef : $fallback;
+}
+
+# Whether get_one would find a node to send a query to. True when not connected yet, as that's
+# handled by get_one_cb.
+sub has_capacity {
+    my ($self)= @_;
+    my $limit= $self->{options}{max_concurrent_queries_per_node};
+    return 1 if !$limit || !$self->{count};
+    for (@{$self->{list}}) {
+        return 1 if $self->node_in_flight($_->ip_address) < $limit;
+    }
+    return 0;
+}
+
+# What counts towards max_concurrent_queries_per_node: the requests on the node's main connection,
+# plus those on its shard connections with shard_aware. Shard connections that are still doing
+# their handshake don't carry queries yet, and nothing would look at the queue once they're done.
+sub node_in_flight {
+    my ($self, $ipaddress)= @_;
+    my $main= $self->{pool}{$ipaddress};
+    my $in_flight= $main ? $main->in_flight : 0;
+    if (my $slots= $self->{shards}{$ipaddress}) {
+        for (@$slots) {
+            $in_flight += $_->in_flight if $_ && $_->{connected} && (!$main || $_ != $main);
+        }
+    }
+    return $in_flight;
+}
+
+# With shard_aware: a connection to the first replica of the token that we're connected to, on the
+# shard that owns the token. Nodes that aren't split into shards have just the one connection. If
+# we're not connected to the shard yet, we connect in the background and return the node's main
+# connection for now. Returns undef if we don't know the ring, or aren't connected to any node on it.
+sub get_for_token {
+    my ($self, $token)= @_;
+
+    my $ring= $self->_ring or return undef;
+    my $owners= $ring->{owners};
+    my $position= _ring_position($ring, $token);
+
+    # Walk the ring: the next node along has the next replica, at least with SimpleStrategy and
+    # NetworkTopologyStrategy without racks
+    my ($ipaddress, $primary);
+    for (1..@$owners) {
+        $ipaddress= $owners->[$position];
+        last if $primary= $self->{pool}{$ipaddress};
+        $position= ($position + 1) % @$owners;
+    }
+    return undef unless $primary;
+    return $primary unless $primary->{nr_shards};
+
+    my $shard= scylla_shard($token, $primary->{nr_shards}, $primary->{sharding_ignore_msb});
+    my $connection= $self->{shards}{$ipaddress}[$shard];
+    if (!$connection || $connection->{shutdown}) {
+        $self->spawn_shard_connection($primary, $shard);
+        return $primary;
+    }
+    return $connection->{connected} ? $connection : $primary;
+}
+
+# The node in our datacenter with the first token at or after this one: the first replica of the
+# partition there
+sub token_owner {
+    my ($self, $token)= @_;
+    my $ring= $self->_ring or return undef;
+    return $ring->{owners}[_ring_position($ring, $token)];
+}
+
+# The tokens of the nodes in our datacenter, in order, with the node that owns each. Tokens are
+# kept as token_sort_key strings, because 32-bit perls can't hold them as numbers.
+sub _ring {
+    my ($self)= @_;
+
+    my $status= $self->{network_status}{status} or return undef;
+    my $datacenter= $self->{policy}{datacenter};
+    my $ring= $self->{ring};
+    if (!$ring || $ring->{status} != $status || ($ring->{datacenter} // '') ne ($datacenter // '')) {
+        my @ring= sort { $a->[0] cmp $b->[0] } map {
+            my $node= $_;
+            map [ token_sort_key($_), $node->{peer} ], @{$node->{tokens} || []};
+        } grep {
+            !defined $datacenter || ($_->{data_center} // '') eq $datacenter
+        } values %$status;
+        $ring= $self->{ring}= {
+            status     => $status,
+            datacenter => $datacenter,
+            tokens     => [ map $_->[0], @ring ],
+            owners     => [ map $_->[1], @ring ],
+        };
+    }
+    return @{$ring->{tokens}} ? $ring : undef;
+}
+
+# Index of the first token on the ring at or after this one, wrapping around
+sub _ring_position {
+    my ($ring, $token)= @_;
+    my $key= token_sort_key($token);
+    my $tokens= $ring->{tokens};
+    my ($low, $high)= (0, 0+@$tokens);
+    while ($low < $high) {
+        my $mid= ($low + $high) >> 1;
+        if ($tokens->[$mid] lt $key) {
+            $low= $mid + 1;
+        } else {
+            $high= $mid;
+        }
+    }
+    return $low == @$tokens ? 0 : $low;
+}
+
+sub spawn_shard_connection {
+    my ($self, $primary, $shard)= @_;
+
+    return if $self->{shutdown};
+    my $ipaddress= $primary->ip_address;
+    my $retry_at= $self->{shard_backoff}{$ipaddress};
+    return if $retry_at && $retry_at > Time::HiRes::time();
+
+    my $connection= Cassandra::Client::Connection->new(
+        client => $self->{client},
+        options => $self->{options},
+        host => $primary->{host},
+        async_io => $self->{async_io},
+        metadata => $self->{metadata},
+        shard => $shard,
+        nr_shards => $primary->{nr_shards},
+        shard_port => $primary->{shard_aware_port},
+    );
+    my $slots= $self->{shards}{$ipaddress} ||= [];
+    $slots->[$shard]= $connection;
+
+    $connection->connect(sub {
+        my ($error)= @_;
+
+        if ($error || $self->{shutdown} || !defined $connection->{nr_shards}) {
+            $slots->[$shard]= undef if ($slots->[$shard] // 0) == $connection;
+            $self->{shard_backoff}{$ipaddress}= Time::HiRes::time() + SHARD_CONNECT_BACKOFF;
+            $connection->shutdown("Shard connection failed") unless $error || $connection->{shutdown};
+            return;
+        }
+        return if $connection->{shard} == $shard;
+
+        # We got another shard than we asked for: there's no shard-aware port, or something
+        # between us and the node changed the port. Keep it if we need that shard anyway.
+        $slots->[$shard]= undef if ($slots->[$shard] // 0) == $connection;
+        my $other= $slots->[$connection->{shard}];
+        if ($other && !$other->{shutdown}) {
+            $connection->shutdown("Not needed");
+        } else {
+            $slots->[$connection->{shard}]= $connection;
+        }
+    });
+
+    return;
 }
 
 sub get_one_cb {
-    my ($self, $callback)= @_;
+    my ($self, $callback, $avoid)= @_;
 
-    return $callback->(undef, $self->get_one) if $self->{count};
+    # Callers checked has_capacity, but if every node is busy anyway we still have to pick one
+    return $callback->(undef, $self->get_one($avoid) || $self->{list}[$self->{i}]) if $self->{count};
 
     if (!%{$self->{connecting}}) {
         $self->connect_if_needed;
@@ -135,6 +344,12 @@ sub add {
     $self->{pool}{$ipaddress}= $connection;
     $self->{id2ip}{$id}= $ipaddress;
 
+    if ($connection->{nr_shards}) {
+        my $slots= $self->{shards}{$ipaddress} ||= [];
+        my $other= $slots->[$connection->{shard}];
+        $slots->[$connection->{shard}]= $connection if !$other || $other->{shutdown};
+    }
+
     $self->rebuild;
 
     my $waiters= delete $self->{wait_connect};
@@ -151,6 +366,11 @@ sub rebuild {
     $self->{list}= [ values %{$self->{pool}} ];
     $self->{count}= 0+ @{$self->{list}};
 
+    # Only worth telling apart if some of the nodes are local and some aren't
+    my $policy= $self->{policy};
+    $self->{near}= [ grep { $policy->get_distance($_->ip_address) eq 'local' } @{$self->{list}} ];
+    $self->{near_count}= @{$self->{near}} < $self->{count} ? 0+ @{$self->{near}} : 0;
+
     return;
 }
 
@@ -166,6 +386,29 @@ sub shutdown {
     my @connecting= values %{$self->{connecting}};
     $_->shutdown("Shutting down") for @connecting;
 
+    $_->shutdown("Shutting down") for grep { $_ && !$_->{shutdown} } map @$_, values %{$self->{shards}};
+
+    return;
+}
+
+sub after_fork {
+    my ($self)= @_;
+
+    for my $host (keys %{$self->{pool}}, keys %{$self->{connecting}}) {
+        $self->{policy}->set_disconnected($host);
+    }
+    $_->abandon for @{$self->{list}}, values %{$self->{connecting}};
+    $_->abandon for grep $_, map @$_, values %{$self->{shards}};
+
+    $self->{pool}= {};
+    $self->{shards}= {};
+    $self->{id2ip}= {};
+    $self->{connecting}= {};
+    $self->{wait_connect}= [];
+    $self->rebuild;
+
+    $self->{network_status}->after_fork;
+
     return;
 }
 
@@ -257,6 +500,11 @@ sub spawn_new_connection {
     return 1;
 }
 
+sub known_nodes {
+    my ($self)= @_;
+    return $self->{network_status}{status};
+}
+
 # Events coming from the network
 sub event_added_node {
     my ($self, $ipaddress)= @_;
@@ -270,17 +518,22 @@ sub event_removed_node {
     if (my $conn= $self->{pool}{$ipaddress}) {
         $conn->shutdown("Removed from pool");
     }
+    if (my $slots= delete $self->{shards}{$ipaddress}) {
+        $_->shutdown("Removed from pool") for grep { $_ && !$_->{shutdown} } @$slots;
+    }
 }
 
 # Events coming from network_status
 sub on_new_node {
     my ($self, $node)= @_;
     $self->{policy}->on_new_node($node);
+    $self->rebuild;
 }
 
 sub on_removed_node {
     my ($self, $node)= @_;
     $self->{policy}->on_removed_node($node);
+    $self->rebuild;
 }
 
 1;
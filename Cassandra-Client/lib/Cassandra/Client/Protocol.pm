@@ -18,7 +18,7 @@ use constant BIGINT_SUPPORTED => eval { unpack('q>', "\0\0\0\0\0\0\0\1") };
 use if !BIGINT_SUPPORTED, 'Math::BigInt';
 
 our (@EXPORT_OK, %EXPORT_TAGS);
-our (%consistency_lookup, %batch_type_lookup);
+our (%consistency_lookup, %batch_type_lookup, %decode_format_lookup);
 BEGIN {
     my %constants= (
         OPCODE_ERROR => 0,
@@ -82,6 +82,12 @@ BEGIN {
         TYPE_SET => 0x22,
         TYPE_UDT => 0x30,
         TYPE_TUPLE => 0x31,
+
+        # Keep in sync with define.h
+        DECODE_DATE_DAYS => 0x01,
+        DECODE_TIME_NANOSECONDS => 0x02,
+        DECODE_DECIMAL_PAIR => 0x04,
+        DECODE_VARINT_HEX => 0x08,
     );
 
     @EXPORT_OK= (
@@ -95,7 +101,7 @@ BEGIN {
             pack_stringlist         unpack_stringlist
             pack_bytes              unpack_bytes
             pack_shortbytes         unpack_shortbytes
-            pack_option_type
+            pack_option_type        parse_type
             pack_stringmap
             pack_stringmultimap     unpack_stringmultimap
                                     unpack_inet
@@ -104,9 +110,15 @@ BEGIN {
             pack_metadata           unpack_metadata
                                     unpack_errordata
             pack_queryparameters
+            pack_batch
+            next_timestamp
+            murmur3_token           scylla_shard
+            token_sort_key
+            decode_flags
 
             %consistency_lookup
             %batch_type_lookup
+            %decode_format_lookup
 
             BIGINT_SUPPORTED
         /
@@ -129,9 +141,38 @@ BEGIN {
         counter  => 2,
     );
 
+    # type => [ alternative format, decode flag ]. 'string' is the default for all of them.
+    %decode_format_lookup= (
+        date    => [ days        => $constants{DECODE_DATE_DAYS} ],
+        time    => [ nanoseconds => $constants{DECODE_TIME_NANOSECONDS} ],
+        decimal => [ pair        => $constants{DECODE_DECIMAL_PAIR} ],
+        varint  => [ hex         => $constants{DECODE_VARINT_HEX} ],
+    );
+
     constant->import( { %constants } );
 }
 
+# Turns { date => 'days', ... } into flags for RowMeta's decode(), applied on top of $base
+sub decode_flags {
+    my ($formats, $base)= @_;
+    die "decode formats must be a HASH reference" unless ref $formats eq 'HASH';
+
+    my $flags= $base || 0;
+    for my $type (sort keys %$formats) {
+        my $lookup= $decode_format_lookup{$type} or die "Unknown type in decode formats: $type";
+        my ($format, $flag)= @$lookup;
+        my $wanted= $formats->{$type} // 'string';
+        if ($wanted eq $format) {
+            $flags |= $flag;
+        } elsif ($wanted eq 'string') {
+            $flags &= ~$flag;
+        } else {
+            die "Invalid decode format for $type: must be one of [string, $format]";
+        }
+    }
+    return $flags;
+}
+
 # TYPE: int
 sub pack_int {
     pack('l>', $_[0])
@@ -299,6 +340,47 @@ sub pack_option_type {
     }
 }
 
+# Turns a CQL type name, such as 'int' or 'map<text, frozen<list<int>>>', into the structure that
+# pack_option_type takes. UDTs need their field list, so they can't be named this way.
+my %type_names= (
+    ascii => TYPE_ASCII, bigint => TYPE_BIGINT, blob => TYPE_BLOB, boolean => TYPE_BOOLEAN,
+    counter => TYPE_COUNTER, date => TYPE_DATE, decimal => TYPE_DECIMAL, double => TYPE_DOUBLE,
+    float => TYPE_FLOAT, inet => TYPE_INET, int => TYPE_INT, smallint => TYPE_SMALLINT,
+    text => TYPE_VARCHAR, time => TYPE_TIME, timestamp => TYPE_TIMESTAMP, timeuuid => TYPE_TIMEUUID,
+    tinyint => TYPE_TINYINT, uuid => TYPE_UUID, varchar => TYPE_VARCHAR, varint => TYPE_VARINT,
+);
+sub parse_type {
+    my ($name)= @_;
+    my $type= _parse_type(\$name);
+    die "Invalid type: $name\n" if (pos($name) // 0) != length $name;
+    return $type;
+}
+
+sub _parse_type {
+    my ($str)= @_;
+    $$str =~ /\G\s*(\w+)\s*/gc or die "Invalid type: $$str\n";
+    my $name= lc $1;
+
+    my @args;
+    if ($$str =~ /\G<\s*/gc) {
+        do { push @args, _parse_type($str) } while ($$str =~ /\G,\s*/gc);
+        $$str =~ /\G>\s*/gc or die "Invalid type: $$str\n";
+    }
+
+    if ($name eq 'frozen' && @args == 1) {
+        return $args[0];
+    } elsif (($name eq 'list' || $name eq 'set') && @args == 1) {
+        return [ ($name eq 'list' ? TYPE_LIST : TYPE_SET), $args[0] ];
+    } elsif ($name eq 'map' && @args == 2) {
+        return [ TYPE_MAP, @args ];
+    } elsif ($name eq 'tuple' && @args) {
+        return [ TYPE_TUPLE, \@args ];
+    } elsif ($type_names{$name} && !@args) {
+        return [ $type_names{$name} ];
+    }
+    die "Invalid type: $$str\n";
+}
+
 # TYPE: stringmap
 sub pack_stringmap {
     my $pairs= '';
@@ -0,0 +1,436 @@
+package Cassandra::Client::Proxy;
+
+# ABSTRACT: Share Cassandra connections between processes through a local multiplexer
+
+use 5.010;
+use strict;
+use warnings;
+
+use Errno qw/EAGAIN/;
+use IO::Socket::UNIX;
+use Ref::Util qw/is_blessed_ref/;
+use Scalar::Util qw/weaken/;
+use Socket qw/SOCK_STREAM SOMAXCONN/;
+
+use Cassandra::Client;
+use Cassandra::Client::Protocol qw/
+    :constants
+    pack_int
+    pack_shortbytes
+    pack_string
+    pack_stringmultimap
+    unpack_shortbytes
+/;
+
+sub new {
+    my ($class, %args)= @_;
+
+    my $socket_path= delete $args{socket} or die "socket not specified";
+    die "A proxy cannot itself use a proxy" if $args{proxy};
+
+    my $self= bless {
+        socket_path     => $socket_path,
+        client          => Cassandra::Client->new(%args),
+        listener        => undef,
+        sessions        => {},
+        prepared        => {}, # id => query
+        prepare_results => {}, # query => RESULT body, so we can answer PREPAREs ourselves
+        stop            => undef,
+    }, $class;
+
+    return $self;
+}
+
+sub client {
+    $_[0]{client}
+}
+
+sub listen {
+    my ($self)= @_;
+    return if $self->{listener};
+
+    unlink $self->{socket_path} if -S $self->{socket_path};
+    my $socket= IO::Socket::UNIX->new(
+        Local  => $self->{socket_path},
+        Type   => SOCK_STREAM,
+        Listen => SOMAXCONN,
+    ) or die "Unable to listen on $self->{socket_path}: $!";
+    $socket->blocking(0);
+
+    my $listener= $self->{listener}= bless {
+        proxy   => $self,
+        socket  => $socket,
+        fileno  => $socket->fileno,
+    }, 'Cassandra::Client::Proxy::Listener';
+    weaken($listener->{proxy});
+
+    my $async_io= $self->{client}{async_io};
+    $async_io->register($listener->{fileno}, $listener);
+    $async_io->register_read($listener->{fileno});
+
+    return;
+}
+
+# Connects to the cluster, then serves workers until stop() is called
+sub run {
+    my ($self)= @_;
+
+    # Workers come and go, and writing to one that just left must not take us down with it
+    local $SIG{PIPE}= 'IGNORE';
+
+    $self->{client}->connect;
+    $self->listen;
+
+    my $async_io= $self->{client}{async_io};
+    $self->{stop}= $async_io->wait(my $w);
+    $w->();
+
+    return;
+}
+
+sub stop {
+    my ($self)= @_;
+
+    $_->close for values %{$self->{sessions}};
+    if (my $listener= delete $self->{listener}) {
+        my $async_io= $self->{client}{async_io};
+        $async_io->unregister_read($listener->{fileno});
+        $async_io->unregister($listener->{fileno});
+        $listener->{socket}->close;
+        unlink $self->{socket_path};
+    }
+
+    if (my $stop= delete $self->{stop}) {
+        $stop->();
+    }
+
+    return;
+}
+
+sub DESTROY {
+    my ($self)= @_;
+    local $@;
+    $self->stop if $self->{listener};
+}
+
+sub _accept {
+    my ($self, $socket)= @_;
+
+    $socket->blocking(0);
+    my $session= bless {
+        proxy         => $self,
+        socket        => $socket,
+        fileno        => $socket->fileno,
+        read_buffer   => \(my $empty= ''),
+        bytes_read    => 0,
+        pending_write => undef,
+        closed        => 0,
+    }, 'Cassandra::Client::Proxy::Session';
+    weaken($session->{proxy});
+
+    $self->{sessions}{$session->{fileno}}= $session;
+
+    my $async_io= $self->{client}{async_io};
+    $async_io->register($session->{fileno}, $session);
+    $async_io->register_read($session->{fileno});
+
+    return;
+}
+
+sub _handle_frame {
+    my ($self, $session, $version, $flags, $stream_id, $opcode)= @_; # $_[6]= $body
+
+    my $protocol_version= $self->{client}{options}{protocol_version};
+    if ($version != $protocol_version) {
+        return $session->reply($version, $stream_id, OPCODE_ERROR, _error_body(0x000A, "Proxy only supports protocol version $protocol_version"));
+    }
+
+    if ($opcode == OPCODE_OPTIONS) {
+        return $session->reply($version, $stream_id, OPCODE_SUPPORTED, pack_stringmultimap({
+            CQL_VERSION => [ $self->{client}{options}{cql_version} || '3.0.0' ],
+            COMPRESSION => [],
+        }));
+    }
+
+    if ($opcode == OPCODE_STARTUP || $opcode == OPCODE_REGISTER) {
+        # The proxy has already done all of this on the worker's behalf
+        return $session->reply($version, $stream_id, OPCODE_READY, '');
+    }
+
+    if ($opcode == OPCODE_PREPARE || $opcode == OPCODE_QUERY) {
+        my $query= unpack('l>/a', $_[6]);
+        if ($query =~ /\A\s*use\s/i) {
+            return $session->reply($version, $stream_id, OPCODE_ERROR, _error_body(0x2200, "USE is not supported through the proxy; set the keyspace on the proxy instead"));
+        }
+
+        if ($opcode == OPCODE_PREPARE) {
+            if (defined(my $result= $self->{prepare_results}{$query})) {
+                return $session->reply($version, $stream_id, OPCODE_RESULT, $result);
+            }
+            return $self->_forward($session, $version, $flags, $stream_id, $opcode, $_[6], undef, $query);
+        }
+
+        return $self->_forward($session, $version, $flags, $stream_id, $opcode, $_[6]);
+    }
+
+    if ($opcode == OPCODE_EXECUTE) {
+        my $id= unpack('n/a', $_[6]);
+        my $query= $self->{prepared}{$id};
+        return $self->_forward($session, $version, $flags, $stream_id, $opcode, $_[6], ($query ? [ $query ] : undef));
+    }
+
+    if ($opcode == OPCODE_BATCH) {
+        return $self->_forward($session, $version, $flags, $stream_id, $opcode, $_[6], $self->_batch_queries($_[6]));
+    }
+
+    return $session->reply($version, $stream_id, OPCODE_ERROR, _error_body(0x000A, "Unsupported opcode $opcode"));
+}
+
+# The request's flags (tracing, custom payloads) go along with it, and a trace ID comes back
+sub _forward {
+    my ($self, $session, $version, $flags, $stream_id, $opcode, $body, $reprepare, $preparing)= @_;
+
+    $self->{client}->_command("forward", sub {
+        my ($error, $response)= @_;
+
+        if ($error) {
+            return $session->reply($version, $stream_id, OPCODE_ERROR, _error_body_from($error));
+        }
+
+        my ($code, $response_body, $trace_id)= @$response;
+        if (defined $preparing && $code == OPCODE_RESULT && unpack('l>', $response_body) == RESULT_PREPARED) {
+            my $id= unpack('n/a', substr($response_body, 4));
+            $self->{prepared}{$id}= $preparing;
+            $self->{prepare_results}{$preparing}= $response_body;
+        }
+
+        return $session->reply($version, $stream_id, $code, $response_body, $trace_id);
+    }, [ $opcode, $flags, $body, $reprepare ]);
+
+    return;
+}
+
+# Returns the queries behind the prepared statements in a BATCH body, in case we need to prepare
+# them again. Named values aren't supported in batches by Cassandra, so we don't bother with them.
+sub _batch_queries {
+    my ($self)= @_; # $_[1]= $body
+
+    my @queries;
+    my $pos= 1;
+    my $count= unpack('n', substr($_[1], $pos, 2)); $pos += 2;
+    for (1..$count) {
+        my $kind= unpack('C', substr($_[1], $pos, 1)); $pos += 1;
+        if ($kind == 1) {
+            my $id_length= unpack('n', substr($_[1], $pos, 2));
+            my $query= $self->{prepared}{substr($_[1], $pos+2, $id_length)};
+            push @queries, $query if $query;
+            $pos += 2 + $id_length;
+        } else {
+            $pos += 4 + unpack('l>', substr($_[1], $pos, 4));
+        }
+
+        my $values= unpack('n', substr($_[1], $pos, 2)); $pos += 2;
+        for (1..$values) {
+            my $length= unpack('l>', substr($_[1], $pos, 4));
+            $pos += 4 + ($length > 0 ? $length : 0);
+        }
+        return \@queries if $pos > length $_[1];
+    }
+
+    return \@queries;
+}
+
+sub _error_body {
+    my ($code, $message)= @_;
+    return pack_int($code).pack_string($message);
+}
+
+# The worker decides whether to retry, so we give it the server's error in full detail
+sub _error_body_from {
+    my ($error)= @_;
+
+    if (!is_blessed_ref($error) || $error->code < 0) {
+        return _error_body(0x0000, "Proxy: $error");
+    }
+
+    my $code= $error->code;
+    my $body= _error_body($code, $error->message);
+    if ($code == 0x1000) {
+        $body .= pack('nl>l>', $error->{cl}, $error->{required}, $error->{alive});
+    } elsif ($code == 0x1100) {
+        $body .= pack('nl>l>', $error->{cl}, $error->{received}, $error->{blockfor}).pack_string($error->{write_type});
+    } elsif ($code == 0x1200) {
+        $body .= pack('nl>l>C', $error->{cl}, $error->{received}, $error->{blockfor}, $error->{data_present});
+    } elsif ($code == 0x2400) {
+        $body .= pack_string('').pack_string('');
+    } elsif ($code == 0x2500) {
+        $body .= pack_shortbytes('');
+    }
+    return $body;
+}
+
+package Cassandra::Client::Proxy::Listener;
+
+use 5.010;
+use strict;
+use warnings;
+
+sub can_read {
+    my ($self)= @_;
+    while (my $socket= $self->{socket}->accept) {
+        $self->{proxy}->_accept($socket);
+    }
+    return;
+}
+
+sub can_write { }
+
+package Cassandra::Client::Proxy::Session;
+
+use 5.010;
+use strict;
+use warnings;
+use vars qw/$BUFFER/;
+
+use Errno qw/EAGAIN/;
+
+sub can_read {
+    my ($self)= @_;
+    local *BUFFER= $self->{read_buffer};
+
+    # The event loop may have read ahead for us, so EAGAIN doesn't mean there's nothing to do
+    my $read_cnt= sysread($self->{socket}, $BUFFER, 16384, length $BUFFER);
+    if ($read_cnt) {
+        $self->{bytes_read} += $read_cnt;
+    } elsif (defined($read_cnt) || $! != EAGAIN) {
+        return $self->close;
+    }
+
+    while (length($BUFFER) >= 9) {
+        my ($version, $flags, $stream_id, $opcode, $bodylen)= unpack('CCsCN', $BUFFER);
+        last if length($BUFFER) < $bodylen+9;
+
+        substr($BUFFER, 0, 9, '');
+        my $body= substr($BUFFER, 0, $bodylen, '');
+        $self->{proxy}->_handle_frame($self, $version, $flags, $stream_id, $opcode, $body);
+        return if $self->{closed};
+    }
+
+    return;
+}
+
+sub can_write {
+    my ($self)= @_;
+
+    my $result= syswrite($self->{socket}, $self->{pending_write});
+    if (!defined $result) {
+        return if $! == EAGAIN;
+        return $self->close;
+    }
+    substr($self->{pending_write}, 0, $result, '');
+
+    if (!length $self->{pending_write}) {
+        $self->{pending_write}= undef;
+        $self->{proxy}{client}{async_io}->unregister_write($self->{fileno});
+    }
+
+    return;
+}
+
+sub can_timeout { }
+
+sub reply {
+    my ($self, $version, $stream_id, $opcode, undef, $trace_id)= @_; # $_[4]= $body
+    return if $self->{closed};
+
+    my $data= (defined $trace_id
+        ? pack('CCsCN/a', 0x80 | $version, 2, $stream_id, $opcode, $trace_id.$_[4])
+        : pack('CCsCN/a', 0x80 | $version, 0, $stream_id, $opcode, $_[4]));
+    if (defined $self->{pending_write}) {
+        $self->{pending_write} .= $data;
+        return;
+    }
+
+    my $result= syswrite($self->{socket}, $data);
+    if (!defined $result) {
+        return $self->close unless $! == EAGAIN;
+        $result= 0;
+    }
+    if ($result < length $data) {
+        $self->{pending_write}= substr($data, $result);
+        $self->{proxy}{client}{async_io}->register_write($self->{fileno});
+    }
+
+    return;
+}
+
+sub close {
+    my ($self)= @_;
+    return if $self->{closed};
+    $self->{closed}= 1;
+
+    my $async_io= $self->{proxy}{client}{async_io};
+    $async_io->unregister_read($self->{fileno});
+    $async_io->unregister_write($self->{fileno}) if defined $self->{pending_write};
+    $async_io->unregister($self->{fileno});
+    delete $self->{proxy}{sessions}{$self->{fileno}};
+    $self->{socket}->close;
+
+    return;
+}
+
+1;
+
+__END__
+
+=head1 SYNOPSIS
+
+    # In the parent process, or in a separate daemon
+    my $proxy= Cassandra::Client::Proxy->new(
+        socket         => '/run/myapp/cassandra.sock',
+        contact_points => [ '10.0.0.1', '10.0.0.2' ],
+        keyspace       => 'my_keyspace',
+        max_connections => 4,
+    );
+    $proxy->run;
+
+    # In every worker
+    my $client= Cassandra::Client->new(
+        proxy => '/run/myapp/cassandra.sock',
+    );
+
+=head1 DESCRIPTION
+
+Prefork servers that give every worker its own L<Cassandra::Client> end up with a lot of connections to the cluster, and every worker pays for its own handshake, statement preparation and topology discovery. C<Cassandra::Client::Proxy> holds the cluster connections in a single process instead, and workers talk to it over a Unix socket using the normal native protocol.
+
+The proxy remaps stream IDs, so the requests of all workers are multiplexed over the proxy's connections. It answers C<OPTIONS>, C<STARTUP> and C<REGISTER> itself and remembers prepared statements, so a worker that prepares a statement some other worker already prepared doesn't cause a round trip to the cluster.
+
+Workers connect by passing the C<proxy> option to C<< Cassandra::Client->new >> instead of C<contact_points>. They don't discover the cluster's topology, and the keyspace has to be configured on the proxy: C<USE> statements are rejected. Compression and TLS only apply between the proxy and the cluster. Request flags, such as tracing, are passed on to the cluster. Workers should ignore C<SIGPIPE>, as writing to the socket of a proxy that went away would otherwise kill them.
+
+=head1 METHODS
+
+=over
+
+=item Cassandra::Client::Proxy->new(socket => $path, %options)
+
+Creates the proxy. C<%options> are passed on to L<Cassandra::Client>.
+
+=item $proxy->run
+
+Connects to the cluster, starts listening on the socket and serves workers until C<stop> is called.
+
+=item $proxy->listen
+
+Starts listening on the socket without blocking, for when the proxy's event loop is driven by other code. That code should ignore C<SIGPIPE>, like C<run> does, or a worker disconnecting at the wrong moment kills the process.
+
+=item $proxy->stop
+
+Disconnects all workers and stops listening. Makes C<run> return.
+
+=item $proxy->client
+
+Returns the L<Cassandra::Client> holding the cluster connections.
+
+=back
+
+=cut
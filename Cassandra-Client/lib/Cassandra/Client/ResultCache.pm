@@ -0,0 +1,99 @@
+package Cassandra::Client::ResultCache;
+
+use 5.010;
+use strict;
+use warnings;
+
+use Cassandra::Client::ResultSet;
+use Time::HiRes ();
+
+# Bounded cache of query results. We keep the raw rows (the RESULT body after the metadata), so a
+# hit costs a ResultSet object and nothing else; the rows are only decoded if asked for. Entries
+# are evicted oldest first once the byte limit is reached, and expired ones are dropped on lookup.
+
+use constant ENTRY_OVERHEAD => 200; # Rough size of our bookkeeping per entry
+
+sub new {
+    my ($class, %args)= @_;
+
+    return bless {
+        max_bytes => 0+ ($args{max_bytes} || 0),
+        bytes     => 0,
+        entries   => {},
+        order     => [], # [ $key, $seq ] pairs, oldest first
+        seq       => 0,
+    }, $class;
+}
+
+sub get {
+    my ($self, $key)= @_;
+    my $entry= $self->{entries}{$key} or return;
+
+    if ($entry->{expires} <= Time::HiRes::time()) {
+        $self->_remove($key);
+        return;
+    }
+
+    return Cassandra::Client::ResultSet->new(
+        $entry->{raw_data},
+        $entry->{decoder},
+        $entry->{next_page},
+        $entry->{decode_flags},
+    );
+}
+
+sub put {
+    my ($self, $key, $result, $ttl)= @_;
+
+    my $bytes= length(${$result->{raw_data}}) + length($key) + ENTRY_OVERHEAD;
+    return if $bytes > $self->{max_bytes};
+
+    $self->_remove($key) if $self->{entries}{$key};
+    $self->{entries}{$key}= {
+        raw_data     => $result->{raw_data},
+        decoder      => $result->{decoder},
+        next_page    => $result->{next_page},
+        decode_flags => $result->{decode_flags},
+        expires      => Time::HiRes::time() + $ttl,
+        bytes        => $bytes,
+        seq          => ++$self->{seq},
+    };
+    push @{$self->{order}}, [ $key, $self->{seq} ];
+    $self->{bytes} += $bytes;
+
+    while ($self->{bytes} > $self->{max_bytes}) {
+        my ($old_key, $seq)= @{shift @{$self->{order}}};
+        # The entry may have been removed or replaced since
+        my $entry= $self->{entries}{$old_key};
+        $self->_remove($old_key) if $entry && $entry->{seq} == $seq;
+    }
+
+    return;
+}
+
+sub _remove {
+    my ($self, $key)= @_;
+    my $entry= delete $self->{entries}{$key} or return;
+    $self->{bytes} -= $entry->{bytes};
+
+    # Keep {order} from growing without bound when entries are replaced or expire
+    my $entries= $self->{entries};
+    if (@{$self->{order}} > 2 * keys(%$entries) + 16) {
+        @{$self->{order}}= grep { $entries->{$_->[0]} && $entries->{$_->[0]}{seq} == $_->[1] } @{$self->{order}};
+    }
+    return;
+}
+
+sub clear {
+    my ($self)= @_;
+    $self->{entries}= {};
+    $self->{order}= [];
+    $self->{bytes}= 0;
+    return;
+}
+
+sub count {
+    return 0+ keys %{$_[0]{entries}};
+}
+
+1;
@@ -4,6 +4,8 @@ use 5.010;
 use strict;
 use warnings;
 
+use Cassandra::Client::Util qw/format_uuid/;
+
 =head1 METHODS
 
 =over
@@ -11,12 +13,14 @@ use warnings;
 =cut
 
 sub new {
-    my ($class, $raw_data, $decoder, $next_page)= @_;
+    my ($class, $raw_data, $decoder, $next_page, $decode_flags, $trace_id)= @_;
 
     return bless {
         raw_data => $raw_data,
         decoder => $decoder,
         next_page => $next_page,
+        decode_flags => $decode_flags || 0,
+        trace_id => $trace_id,
     }, $class;
 }
 
@@ -27,7 +31,7 @@ Returns an arrayref of all rows in the ResultSet. Each row will be represented a
 =cut
 
 sub rows {
-    return $_[0]{rows} ||= $_[0]{decoder}->decode(${$_[0]{raw_data}}, 0);
+    return $_[0]{rows} ||= $_[0]{decoder}->decode(${$_[0]{raw_data}}, 0, $_[0]{decode_flags});
 }
 
 =item $result->row_hashes()
@@ -37,7 +41,7 @@ Returns an arrayref of all rows in the ResultSet. Each row will be represented a
 =cut
 
 sub row_hashes {
-    return $_[0]{row_hashes} ||= $_[0]{decoder}->decode(${$_[0]{raw_data}}, 1);
+    return $_[0]{row_hashes} ||= $_[0]{decoder}->decode(${$_[0]{raw_data}}, 1, $_[0]{decode_flags});
 }
 
 =item $result->column_names()
@@ -60,6 +64,16 @@ sub next_page {
     $_[0]{next_page}
 }
 
+=item $result->trace_id()
+
+For queries with tracing, the ID of the tracing session, as a UUID string. Can be passed to C<< $client->get_trace() >>.
+
+=cut
+
+sub trace_id {
+    return $_[0]{trace_id} && format_uuid($_[0]{trace_id});
+}
+
 =back
 
 =cut
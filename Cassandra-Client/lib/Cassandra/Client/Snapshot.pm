@@ -0,0 +1,150 @@
+package Cassandra::Client::Snapshot;
+
+use 5.010;
+use strict;
+use warnings;
+
+# On-disk copy of what a client learns while it runs: the nodes of the cluster, and the prepared
+# statements with their metadata. A process that loads it can connect to nodes it knows are good
+# and execute straight away, instead of preparing every statement again.
+#
+# The file is a flat sequence of length-prefixed fields, read in one go and decoded in a single
+# pass. It's only valid for the same contact points, port, keyspace and protocol version, because
+# the metadata of a prepared statement depends on those.
+
+use constant MAGIC => "CCSNAP1\n";
+use constant NODE_FIELDS => qw/peer data_center host_id preferred_ip rack release_version schema_version/;
+
+sub identity {
+    my ($class, $options)= @_;
+    return join("\0",
+        $options->{protocol_version},
+        $options->{port},
+        ($options->{keyspace} // ''),
+        sort @{$options->{contact_points}},
+    );
+}
+
+# Returns undef if there's no usable snapshot: missing, corrupt, too old, or for another cluster
+sub load {
+    my ($class, $path, $options)= @_;
+
+    open(my $fh, '<:raw', $path) or return;
+    my $data= do { local $/; <$fh> };
+    close $fh;
+    return unless defined $data && substr($data, 0, length(MAGIC), '') eq MAGIC;
+
+    my $snapshot= eval {
+        my $identity= _unpack_bytes($data);
+        die "identity\n" unless defined $identity && $identity eq $class->identity($options);
+
+        my $saved_at= _unpack_int($data, 'N');
+        my $age= time() - $saved_at;
+        die "age\n" if $age < 0 || $age > $options->{snapshot_max_age};
+
+        my %snapshot= (
+            saved_at   => $saved_at,
+            datacenter => _unpack_string($data),
+            nodes      => {},
+            prepared   => [],
+        );
+
+        my $node_count= _unpack_int($data, 'N');
+        for (1..$node_count) {
+            my %node;
+            $node{$_}= _unpack_string($data) for NODE_FIELDS;
+            my $token_count= _unpack_int($data, 'l>');
+            $node{tokens}= $token_count < 0 ? undef : [ map _unpack_string($data), 1..$token_count ];
+            die "node\n" unless defined $node{peer};
+            $snapshot{nodes}{$node{peer}}= \%node;
+        }
+
+        my $prepared_count= _unpack_int($data, 'N');
+        for (1..$prepared_count) {
+            my $query= _unpack_string($data);
+            my $id= _unpack_bytes($data);
+            my $raw= _unpack_bytes($data);
+            die "prepared\n" unless defined $query && defined $id && defined $raw;
+            push @{$snapshot{prepared}}, [ $query, $id, $raw ];
+        }
+
+        die "trailing data\n" if length $data;
+        \%snapshot;
+    };
+
+    return $snapshot;
+}
+
+# Writes to a temporary file first, so concurrent readers never see half a snapshot. Dies on failure.
+sub save {
+    my ($class, $path, $options, $datacenter, $nodes, $prepare_cache)= @_;
+
+    my @nodes= values %{$nodes || {}};
+    my @prepared= grep { defined $prepare_cache->{$_}{raw} } keys %$prepare_cache;
+
+    my $data= MAGIC
+        ._pack_bytes($class->identity($options))
+        .pack('N', time())
+        ._pack_string($datacenter)
+        .pack('N', 0+@nodes);
+    for my $node (@nodes) {
+        $data .= _pack_string($node->{$_}) for NODE_FIELDS;
+        if ($node->{tokens}) {
+            $data .= pack('l>', 0+@{$node->{tokens}}).join('', map _pack_string($_), @{$node->{tokens}});
+        } else {
+            $data .= pack('l>', -1);
+        }
+    }
+    $data .= pack('N', 0+@prepared);
+    for my $query (@prepared) {
+        my $entry= $prepare_cache->{$query};
+        $data .= _pack_string($query)._pack_bytes($entry->{id})._pack_bytes($entry->{raw});
+    }
+
+    my $tmp= "$path.$$.tmp";
+    open(my $fh, '>:raw', $tmp) or die "Unable to write snapshot to $tmp: $!";
+    unless ((print $fh $data) && close($fh)) {
+        my $error= $!;
+        unlink $tmp;
+        die "Unable to write snapshot to $tmp: $error";
+    }
+    unless (rename($tmp, $path)) {
+        my $error= $!;
+        unlink $tmp;
+        die "Unable to write snapshot to $path: $error";
+    }
+
+    return;
+}
+
+sub _pack_bytes {
+    defined $_[0] ? pack('l>/a', $_[0]) : pack('l>', -1)
+}
+
+sub _pack_string {
+    return pack('l>', -1) unless defined $_[0];
+    my $str= $_[0]; # copy
+    utf8::encode $str;
+    return pack('l>/a', $str);
+}
+
+# A 32-bit integer, signed ('l>') or not ('N')
+sub _unpack_int {
+    die "truncated\n" if length($_[0]) < 4;
+    return unpack($_[1], substr($_[0], 0, 4, ''));
+}
+
+sub _unpack_bytes {
+    my $len= _unpack_int($_[0], 'l>');
+    return undef if $len < 0;
+    die "truncated\n" if length($_[0]) < $len;
+    return substr($_[0], 0, $len, '');
+}
+
+sub _unpack_string {
+    my $str= &_unpack_bytes;
+    utf8::decode $str if defined $str;
+    return $str;
+}
+
+1;
@@ -0,0 +1,78 @@
+package Cassandra::Client::Statement;
+
+# ABSTRACT: A prepared statement, bound to its client
+
+use 5.010;
+use strict;
+use warnings;
+
+# Holds on to the prepared statement cache entry, so executing doesn't have to look the query up
+# by its text. When the statement gets prepared again (after an UNPREPARED error, for example),
+# the old entry points to its replacement, which we then switch to.
+
+sub new {
+    my ($class, %args)= @_;
+    return bless {
+        client     => $args{client},
+        async_io   => $args{client}{async_io},
+        query      => $args{query},
+        prepared   => $args{prepared},
+        attributes => $args{attributes} || {},
+    }, $class;
+}
+
+sub query {
+    return $_[0]{query};
+}
+
+# The prepared statement cache entry, following it along if the statement was prepared again since
+sub prepared_entry {
+    my ($self)= @_;
+    my $prepared= $self->{prepared};
+    $prepared= $self->{prepared}= $prepared->{replaced_by} while $prepared->{replaced_by};
+    return $prepared;
+}
+
+sub _execute {
+    my ($self, $callback, $params, $attribs)= @_;
+    $self->{client}->_execute_statement($callback, $self, $params, $attribs);
+    return;
+}
+
+# The public execute methods are set up by Cassandra::Client, along with its own
+
+1;
+
+=head1 SYNOPSIS
+
+    my ($statement)= $client->prepare_statement("SELECT value FROM my_table WHERE id=?", { consistency => "quorum" });
+    for my $id (@ids) {
+        my ($result)= $statement->execute([ $id ]);
+        ...
+    }
+
+=head1 DESCRIPTION
+
+Returned by C<prepare_statement> in L<Cassandra::Client>. Executing a statement object is the same as passing its query to C<execute>, except that the client doesn't have to find the prepared statement by its query text every time, which adds up for long queries.
+
+Statement objects can also take the place of the query in C<batch>.
+
+=head1 METHODS
+
+=over
+
+=item $statement->execute([$bound_parameters[, $attributes]])
+
+Like C<execute> in L<Cassandra::Client>. The attributes are merged with the ones given to C<prepare_statement>. Comes in the same calling styles: C<call_execute>, C<async_execute>, C<future_execute> and C<future_call_execute>.
+
+=item $statement->query
+
+The query text.
+
+=item $statement->prepared_entry
+
+The statement's entry in the client's prepared statement cache, with its ID and metadata. If the statement was prepared again since it was created, this is the newest entry.
+
+=back
+
+=cut
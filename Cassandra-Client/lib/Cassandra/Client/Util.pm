@@ -6,9 +6,15 @@ use warnings;
 
 use Exporter 'import';
 our @EXPORT= ('series', 'parallel', 'whilst');
+our @EXPORT_OK= ('format_uuid');
 
 use Sub::Current;
 
+# The usual text form of a 16-byte binary UUID, such as a tracing session ID
+sub format_uuid {
+    return join '-', unpack('H8H4H4H4H12', $_[0]);
+}
+
 sub series {
     my $list= shift;
     my $final= shift;
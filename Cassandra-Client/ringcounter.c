@@ -0,0 +1,93 @@
+#define PERL_NO_GET_CONTEXT
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include "ringcounter.h"
+
+/* Success/total counts over a sliding time window, for the adaptive throttlers. The window is split
+ * into a fixed number of buckets, each covering window/size seconds, used as a ring: when time moves
+ * on, the buckets that fell out of the window are subtracted from the sums and reused. So memory
+ * doesn't depend on the request rate, and no call does more than one pass over the buckets.
+ *
+ * The window is only as precise as a bucket: counts expire somewhere between window-width and
+ * window seconds after they were added. */
+
+double cc_ring_counter_now()
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1e6);
+#endif
+}
+
+struct cc_ring_counter *cc_ring_counter_new(pTHX_ double window, int32_t size)
+{
+    struct cc_ring_counter *counter;
+
+    if (UNLIKELY(size <= 0 || size > 100000))
+        croak("cc_ring_counter_new: invalid bucket count %d", (int)size);
+    if (UNLIKELY(!(window > 0)))
+        croak("cc_ring_counter_new: window must be positive");
+
+    Newxz(counter, 1, struct cc_ring_counter);
+    Newxz(counter->buckets, size, struct cc_ring_bucket);
+    counter->size = size;
+    counter->bucket_width = window / size;
+    counter->head = -1;
+    return counter;
+}
+
+void cc_ring_counter_destroy(pTHX_ struct cc_ring_counter *counter)
+{
+    Safefree(counter->buckets);
+    Safefree(counter);
+}
+
+/* Expires the buckets that are older than the window at time 'now' */
+void cc_ring_counter_advance(struct cc_ring_counter *counter, double now)
+{
+    int64_t slot, steps, i;
+
+    slot = (int64_t)(now / counter->bucket_width);
+    if (slot <= counter->head)
+        return;
+
+    steps = slot - counter->head;
+    if (counter->head < 0 || steps >= counter->size) {
+        Zero(counter->buckets, counter->size, struct cc_ring_bucket);
+        counter->total = 0;
+        counter->success = 0;
+    } else {
+        for (i = 1; i <= steps; i++) {
+            struct cc_ring_bucket *bucket = &counter->buckets[(counter->head + i) % counter->size];
+            counter->total -= bucket->total;
+            counter->success -= bucket->success;
+            bucket->total = 0;
+            bucket->success = 0;
+        }
+    }
+    counter->head = slot;
+}
+
+void cc_ring_counter_add(struct cc_ring_counter *counter, double now, int success)
+{
+    struct cc_ring_bucket *bucket;
+
+    cc_ring_counter_advance(counter, now);
+    bucket = &counter->buckets[counter->head % counter->size];
+    bucket->total++;
+    counter->total++;
+    if (success) {
+        bucket->success++;
+        counter->success++;
+    }
+}
@@ -0,0 +1,28 @@
+#include <stdint.h>
+#define PERL_NO_GET_CONTEXT
+#include "perl.h"
+
+#ifndef CC_RINGCOUNTER_H
+#define CC_RINGCOUNTER_H
+
+struct cc_ring_bucket {
+    uint32_t total;
+    uint32_t success;
+};
+
+struct cc_ring_counter {
+    struct cc_ring_bucket *buckets;
+    int32_t size;
+    double bucket_width;
+    int64_t head;       /* Time slot of the newest bucket */
+    uint64_t total;     /* Sums over all buckets */
+    uint64_t success;
+};
+
+struct cc_ring_counter *cc_ring_counter_new(pTHX_ double window, int32_t size);
+void cc_ring_counter_destroy(pTHX_ struct cc_ring_counter *counter);
+void cc_ring_counter_add(struct cc_ring_counter *counter, double now, int success);
+void cc_ring_counter_advance(struct cc_ring_counter *counter, double now);
+double cc_ring_counter_now();
+
+#endif
@@ -0,0 +1,220 @@
+#define PERL_NO_GET_CONTEXT
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/time.h>
+#include "streams.h"
+
+/* Stream ID allocation for a connection. Slots live in an array indexed by stream ID, and free IDs
+ * are kept in a FIFO list, so both acquiring and releasing an ID are O(1). Because the list is
+ * FIFO, a released ID goes to the back of the line: that way we cycle through the whole ID space
+ * like the old incrementing allocator did, instead of handing the same few IDs out over and over.
+ *
+ * The array starts small and doubles when every slot is in use, up to the protocol's limit. */
+
+#define CC_STREAMS_INITIAL_SIZE 64
+
+static double cc_streams_now()
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (tv.tv_usec / 1e6);
+#endif
+}
+
+static void cc_streams_push_free(struct cc_streams *streams, int32_t id)
+{
+    struct cc_stream *slot = &streams->slots[id];
+    slot->state = CC_STREAM_FREE;
+    slot->callback = NULL;
+    slot->deadline = NULL;
+    slot->next_free = -1;
+
+    if (streams->free_tail >= 0)
+        streams->slots[streams->free_tail].next_free = id;
+    else
+        streams->free_head = id;
+    streams->free_tail = id;
+}
+
+static int cc_streams_grow(struct cc_streams *streams)
+{
+    int32_t new_size, id;
+
+    if (streams->size >= streams->limit)
+        return 0;
+
+    new_size = streams->size ? streams->size * 2 : CC_STREAMS_INITIAL_SIZE;
+    if (new_size > streams->limit)
+        new_size = streams->limit;
+
+    Renew(streams->slots, new_size, struct cc_stream);
+    Zero(streams->slots + streams->size, new_size - streams->size, struct cc_stream);
+    for (id = streams->size; id < new_size; id++)
+        cc_streams_push_free(streams, id);
+    streams->size = new_size;
+
+    return 1;
+}
+
+/* Tells the event loop that the request completed, so its deadline won't fire */
+static void cc_streams_dismiss(pTHX_ struct cc_stream *slot)
+{
+    if (slot->deadline) {
+        if (SvROK(slot->deadline))
+            sv_setiv(SvRV(slot->deadline), 1);
+        SvREFCNT_dec(slot->deadline);
+        slot->deadline = NULL;
+    }
+}
+
+struct cc_streams *cc_streams_new(pTHX_ int32_t limit)
+{
+    struct cc_streams *streams;
+
+    if (UNLIKELY(limit <= 0 || limit > 32768))
+        croak("cc_streams_new: invalid stream ID limit %d", (int)limit);
+
+    Newxz(streams, 1, struct cc_streams);
+    streams->limit = limit;
+    streams->free_head = -1;
+    streams->free_tail = -1;
+    return streams;
+}
+
+void cc_streams_destroy(pTHX_ struct cc_streams *streams)
+{
+    int32_t id;
+
+    for (id = 0; id < streams->size; id++) {
+        SvREFCNT_dec(streams->slots[id].callback);
+        SvREFCNT_dec(streams->slots[id].deadline);
+    }
+    Safefree(streams->slots);
+    Safefree(streams);
+}
+
+/* Returns the stream ID, or -1 if every ID is in use */
+int32_t cc_streams_acquire(pTHX_ struct cc_streams *streams, SV *callback)
+{
+    struct cc_stream *slot;
+    int32_t id;
+
+    if (streams->free_head < 0 && !cc_streams_grow(streams))
+        return -1;
+
+    id = streams->free_head;
+    slot = &streams->slots[id];
+    streams->free_head = slot->next_free;
+    if (streams->free_head < 0)
+        streams->free_tail = -1;
+
+    slot->state = CC_STREAM_ACTIVE;
+    slot->callback = newSVsv(callback);
+    slot->deadline = NULL;
+    slot->sent_at = cc_streams_now();
+    streams->active++;
+
+    return id;
+}
+
+void cc_streams_set_deadline(pTHX_ struct cc_streams *streams, int32_t id, SV *deadline)
+{
+    struct cc_stream *slot;
+
+    if (UNLIKELY(id < 0 || id >= streams->size || streams->slots[id].state != CC_STREAM_ACTIVE))
+        croak("set_deadline: stream %d is not in use", (int)id);
+
+    slot = &streams->slots[id];
+    SvREFCNT_dec(slot->deadline);
+    slot->deadline = SvOK(deadline) ? newSVsv(deadline) : NULL;
+}
+
+/* A response arrived. Returns the callback (the caller owns the reference), or NULL if the request
+ * already timed out or the ID was never handed out. */
+SV *cc_streams_release(pTHX_ struct cc_streams *streams, int32_t id)
+{
+    struct cc_stream *slot;
+    SV *callback;
+
+    if (id < 0 || id >= streams->size)
+        return NULL;
+
+    slot = &streams->slots[id];
+    if (slot->state == CC_STREAM_ORPHANED) {
+        /* The late answer to a request that timed out: finally safe to reuse the ID */
+        streams->orphaned--;
+        cc_streams_push_free(streams, id);
+        return NULL;
+    }
+    if (slot->state != CC_STREAM_ACTIVE)
+        return NULL;
+
+    cc_streams_dismiss(aTHX_ slot);
+    callback = slot->callback;
+    streams->active--;
+    cc_streams_push_free(streams, id);
+    return callback;
+}
+
+/* The request timed out. The server may still answer, so the ID stays reserved until it does;
+ * returns the callback (the caller owns the reference), or NULL if the stream wasn't active. */
+SV *cc_streams_orphan(pTHX_ struct cc_streams *streams, int32_t id)
+{
+    struct cc_stream *slot;
+    SV *callback;
+
+    if (id < 0 || id >= streams->size || streams->slots[id].state != CC_STREAM_ACTIVE)
+        return NULL;
+
+    slot = &streams->slots[id];
+    cc_streams_dismiss(aTHX_ slot);
+    callback = slot->callback;
+    slot->callback = NULL;
+    slot->state = CC_STREAM_ORPHANED;
+    streams->active--;
+    streams->orphaned++;
+    return callback;
+}
+
+/* The connection is going away: returns the callbacks of all active requests, and frees every ID */
+AV *cc_streams_drain(pTHX_ struct cc_streams *streams)
+{
+    AV *callbacks;
+    int32_t id;
+
+    callbacks = newAV();
+    if (streams->active)
+        av_extend(callbacks, streams->active - 1);
+
+    streams->free_head = -1;
+    streams->free_tail = -1;
+    for (id = 0; id < streams->size; id++) {
+        struct cc_stream *slot = &streams->slots[id];
+        if (slot->state == CC_STREAM_ACTIVE) {
+            cc_streams_dismiss(aTHX_ slot);
+            av_push(callbacks, slot->callback);
+        }
+        cc_streams_push_free(streams, id);
+    }
+    streams->active = 0;
+    streams->orphaned = 0;
+
+    return callbacks;
+}
+
+/* When the request on the stream was sent, on the monotonic clock; 0 if the stream isn't active */
+double cc_streams_sent_at(struct cc_streams *streams, int32_t id)
+{
+    if (id < 0 || id >= streams->size || streams->slots[id].state != CC_STREAM_ACTIVE)
+        return 0;
+    return streams->slots[id].sent_at;
+}
@@ -0,0 +1,39 @@
+#include <stdint.h>
+#define PERL_NO_GET_CONTEXT
+#include "perl.h"
+
+#ifndef CC_STREAMS_H
+#define CC_STREAMS_H
+
+#define CC_STREAM_FREE     0
+#define CC_STREAM_ACTIVE   1
+#define CC_STREAM_ORPHANED 2 /* Timed out, but the server may still answer, so the ID can't be reused yet */
+
+struct cc_stream {
+    SV *callback;
+    SV *deadline;       /* Reference to the scalar that dismisses the request deadline */
+    double sent_at;
+    int32_t next_free;
+    uint8_t state;
+};
+
+struct cc_streams {
+    struct cc_stream *slots;
+    int32_t size;
+    int32_t limit;
+    int32_t free_head;
+    int32_t free_tail;
+    int32_t active;
+    int32_t orphaned;
+};
+
+struct cc_streams *cc_streams_new(pTHX_ int32_t limit);
+void cc_streams_destroy(pTHX_ struct cc_streams *streams);
+int32_t cc_streams_acquire(pTHX_ struct cc_streams *streams, SV *callback);
+void cc_streams_set_deadline(pTHX_ struct cc_streams *streams, int32_t id, SV *deadline);
+SV *cc_streams_release(pTHX_ struct cc_streams *streams, int32_t id);
+SV *cc_streams_orphan(pTHX_ struct cc_streams *streams, int32_t id);
+AV *cc_streams_drain(pTHX_ struct cc_streams *streams);
+double cc_streams_sent_at(struct cc_streams *streams, int32_t id);
+
+#endif
@@ -4,7 +4,8 @@ use strict;
 use warnings;
 use Test::More;
 use Cassandra::Client;
-use Cassandra::Client::Protocol qw/:constants pack_int pack_long pack_metadata unpack_metadata/;
+use Cassandra::Client::Protocol qw/:constants decode_flags murmur3_token pack_int pack_long pack_metadata parse_type scylla_shard unpack_metadata/;
+use Math::BigInt;
 
 # Add some junk into our Perl magic variables
 local $"= "junk join string ,";
@@ -103,6 +104,7 @@ check_enc([TYPE_COUNTER], -1, "\xff\xff\xff\xff\xff\xff\xff\xff");
 
 # Decimal
 check_simple([TYPE_DECIMAL], [ undef, 0, 1, 100, '1e+100', 1E100 ]);
+check_simple([TYPE_DECIMAL], [ -1, "-1.5", "-100000000000000000000.25" ], [ -1, "-15e-1", "-10000000000000000000025e-2" ]);
 check_simple([TYPE_DECIMAL], [ "10000000000000001.123456789123456789E-1000" ], [ "10000000000000001123456789123456789e-1018" ]);
 check_enc([TYPE_DECIMAL], 0, "\0\0\0\0\0");
 check_enc([TYPE_DECIMAL], 1, "\0\0\0\0\1");
@@ -146,6 +148,20 @@ check_enc([TYPE_VARINT], -1, "\xff");
 check_enc([TYPE_VARINT], -128, "\x80");
 check_enc([TYPE_VARINT], -129, "\xff\x7f");
 check_enc([TYPE_VARINT], "1000000000000000000000000000000000000000000000000000000000000000000", "\x09\x7e\xdd\x87\x1c\xfd\xa3\xa5\x69\x77\x58\xbf\x0e\x3c\xbb\x5a\xc5\x74\x1c\x64\0\0\0\0\0\0\0\0");
+check_enc([TYPE_VARINT], "9223372036854775808", "\0\x80\0\0\0\0\0\0\0");
+check_enc([TYPE_VARINT], "-9223372036854775809", "\xff\x7f\xff\xff\xff\xff\xff\xff\xff");
+check_enc([TYPE_VARINT], "18446744073709551616", "\1\0\0\0\0\0\0\0\0");
+check_enc([TYPE_VARINT], "-18446744073709551616", "\xff\0\0\0\0\0\0\0\0");
+check_enc([TYPE_VARINT], "79228162514264337593543950335", "\0".("\xff" x 12));
+check_enc([TYPE_VARINT], "-79228162514264337593543950336", "\xff".("\0" x 12));
+check_simple([TYPE_VARINT], [ "9223372036854775808", "-9223372036854775809", "18446744073709551616", "-18446744073709551616",
+                              "999999999999999999999999999", "-1000000000000000000000000000", "79228162514264337593543950335",
+                              ("1234567890" x 40), "-".("9876543210" x 40) ]);
+check_simple([TYPE_VARINT], [ "000000000000000000000000000042", "+100000000000000000000" ], [ 42, "100000000000000000000" ]);
+{
+    my ($rowmeta)= unpack_metadata(4, 1, pack_metadata(4, 1, { columns => [ [ 'schema', 'table', 'a', [TYPE_VARINT] ] ] }));
+    ok(!eval { $rowmeta->encode([ "12345678901234567890x" ]); 1 }, 'invalid varint croaks');
+}
 
 # Time
 check_simple([TYPE_TIME], [
@@ -216,6 +232,7 @@ check_enc([TYPE_INET], "::1", "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\1");
 
 # List
 check_simple([TYPE_LIST, [ TYPE_INT ] ], [ [1, 2, 3], [4, 5, 6], undef, [4, undef, 6] ]);
+check_simple([TYPE_LIST, [ TYPE_VARCHAR ] ], [ [ "a", undef, "\x{263a}" ], [] ]);
 check_enc([TYPE_LIST, [ TYPE_INT ] ], [ 1, 2, 3 ], "\0\0\0\3\0\0\0\4\0\0\0\1\0\0\0\4\0\0\0\2\0\0\0\4\0\0\0\3");
 
 # Map
@@ -224,6 +241,10 @@ check_simple([TYPE_MAP, [ TYPE_INT ], [ TYPE_BOOLEAN ] ], [
                                                           ]);
 check_enc([TYPE_MAP, [ TYPE_INT ], [ TYPE_BOOLEAN ] ], { 2 => !0 }, "\0\0\0\1\0\0\0\4\0\0\0\2\0\0\0\1\1");
 check_enc([TYPE_MAP, [ TYPE_INT ], [ TYPE_BOOLEAN ] ], { 1 => !1 }, "\0\0\0\1\0\0\0\4\0\0\0\1\0\0\0\1\0");
+check_simple([TYPE_MAP, [ TYPE_VARCHAR ], [ TYPE_VARCHAR ] ], [ { "\x{263a}" => "caf\x{e9}\x{263a}", plain => undef, "" => "" } ]);
+check_simple([TYPE_MAP, [ TYPE_BLOB ], [ TYPE_INT ] ], [ { "\xff\0" => 1, abc => undef } ]);
+check_simple([TYPE_MAP, [ TYPE_BIGINT ], [ TYPE_LIST, [ TYPE_VARCHAR ] ] ], [ { 1 => [ "a", undef ], 5000000000 => [] } ]);
+check_simple([TYPE_MAP, [ TYPE_VARCHAR ], [ TYPE_INT ] ], [ { map { ("key $_" => $_) } 1..500 } ]);
 
 # Set
 check_simple([TYPE_SET, [ TYPE_INT ]], [
@@ -242,6 +263,7 @@ check_simple([TYPE_TUPLE, [[TYPE_INT], [TYPE_INT]]], [
                                                       [ 1, 2 ],
                                                       [ 1, 2 ]
                                                      ]);
+check_simple([TYPE_TUPLE, [[TYPE_VARCHAR], [TYPE_INT], [TYPE_DOUBLE]]], [ [ "x", undef, 1.5 ] ]);
 check_enc([TYPE_TUPLE, [[TYPE_INT], [TYPE_INT]]], [ 1, 2 ], "\0\0\0\4\0\0\0\1\0\0\0\4\0\0\0\2" );
 
 # list<frozen<map<int,bool>>>
@@ -271,5 +293,89 @@ check_enc([TYPE_MAP, [TYPE_INT], [TYPE_LIST, [TYPE_INT]]],
     pack('H*', '0000000100000004000000010000000c000000010000000400000002')
 );
 
+# Alternative decode formats
+sub check_decode_flags {
+    my ($coltype, $flags, $row, $expected)= @_;
+    my ($rowmeta)= unpack_metadata(4, 1, pack_metadata(4, 1, {
+        columns => [ map { [ 'schema', 'table', "c$_", $coltype ] } 0..$#$row ],
+    }));
+    my $encoded= $rowmeta->encode($row);
+    substr($encoded, 0, 2, '');
+    is_deeply($rowmeta->decode(pack_int(1).$encoded, 0, $flags)->[0], $expected);
+}
+
+check_decode_flags([TYPE_DATE], DECODE_DATE_DAYS, [ "1970-01-01", "1970-01-02", "1969-12-31", "2020-02-29" ], [ 0, 1, -1, 18321 ]);
+check_decode_flags([TYPE_DATE], 0, [ 0, 1, -1, 18321 ], [ "1970-01-01", "1970-01-02", "1969-12-31", "2020-02-29" ]);
+check_decode_flags([TYPE_DATE], 0, [ -2147483648, 2147483647 ], [ "-5877641-06-23", "5881580-07-11" ]);
+check_decode_flags([TYPE_TIME], DECODE_TIME_NANOSECONDS, [ "00:00:00", "01:00:00.5", "23:59:59.999999999" ], [ 0, 3600500000000, 86399999999999 ]);
+check_decode_flags([TYPE_TIME], 0, [ 0, 3600500000000, 100 ], [ "0:00:00", "1:00:00.5", "0:00:00.0000001" ]);
+check_decode_flags([TYPE_DECIMAL], DECODE_DECIMAL_PAIR, [ "123.45", "-1e+5", "1000000000000000000000000.5" ], [ [ 12345, 2 ], [ -1, -5 ], [ "10000000000000000000000005", 1 ] ]);
+check_decode_flags([TYPE_DECIMAL], 0, [ [ 12345, 2 ], [ -1, -5 ], [ "0xd3c21bcecceda1000000", 0 ] ], [ "12345e-2", "-1e+5", "1000000000000000000000000" ]);
+check_decode_flags([TYPE_VARINT], DECODE_VARINT_HEX, [ 1, "1000000000000000000000000", "-1000000000000000000000000" ], [ 1, "0xd3c21bcecceda1000000", "-0xd3c21bcecceda1000000" ]);
+check_decode_flags([TYPE_VARINT], 0, [ "0xd3c21bcecceda1000000", "-0xD3C21BCECCEDA1000000", "0x10" ], [ "1000000000000000000000000", "-1000000000000000000000000", 16 ]);
+check_decode_flags([TYPE_DECIMAL], DECODE_DECIMAL_PAIR | DECODE_VARINT_HEX, [ "1000000000000000000000000e-3" ], [ [ "0xd3c21bcecceda1000000", 3 ] ]);
+check_decode_flags([TYPE_DECIMAL], DECODE_VARINT_HEX, [ "1000000000000000000000000e-3" ], [ "1000000000000000000000000e-3" ]);
+check_decode_flags([TYPE_LIST, [TYPE_DATE]], DECODE_DATE_DAYS, [ [ "1970-01-11", "1970-01-21" ] ], [ [ 10, 20 ] ]);
+check_decode_flags([TYPE_MAP, [TYPE_INT], [TYPE_TIME]], DECODE_TIME_NANOSECONDS, [ { 1 => "00:00:01" } ], [ { 1 => 1000000000 } ]);
+
+# Times without seconds, and with whitespace around them, are still accepted
+check_decode_flags([TYPE_TIME], DECODE_TIME_NANOSECONDS, [ "12:00", "1:05", " 12:00:00 ", "\t01:00:00.5\n", " 3600000000000 " ],
+    [ 43200000000000, 3900000000000, 43200000000000, 3600500000000, 3600000000000 ]);
+
+# Digit strings are days and nanoseconds, even when Perl has used a number as a string
+{
+    my ($days, $nanoseconds)= (19000, 3600000000000);
+    my $used= "$days $nanoseconds";
+    check_decode_flags([TYPE_DATE], DECODE_DATE_DAYS, [ "19000", "-1", $days ], [ 19000, -1, 19000 ]);
+    check_decode_flags([TYPE_TIME], DECODE_TIME_NANOSECONDS, [ "3600000000000", "0", $nanoseconds ], [ 3600000000000, 0, 3600000000000 ]);
+}
+{
+    my ($rowmeta)= unpack_metadata(4, 1, pack_metadata(4, 1, { columns => [ [ 'schema', 'table', 'd', [TYPE_DATE] ], [ 'schema', 'table', 't', [TYPE_TIME] ] ] }));
+    for my $date ("2020/01/01", "2020-01", "2020-01-01-01", "2020-01-01x", "", "1e5", "2020--01") {
+        ok(!eval { $rowmeta->encode([ $date, 0 ]); 1 }, "invalid date '$date' croaks");
+    }
+    for my $time ("12:", "1:2:3:4", "12:00:00.1234567890", "noon", "12:60:00", "12:00:00.", "-5", "100000000000000") {
+        ok(!eval { $rowmeta->encode([ "1970-01-01", $time ]); 1 }, "invalid time '$time' croaks");
+    }
+}
+
+is(decode_flags({ date => 'days', time => 'nanoseconds' }), DECODE_DATE_DAYS | DECODE_TIME_NANOSECONDS, 'decode_flags');
+is(decode_flags({ date => 'string', varint => 'hex' }, DECODE_DATE_DAYS | DECODE_DECIMAL_PAIR), DECODE_DECIMAL_PAIR | DECODE_VARINT_HEX, 'decode_flags applies on top of a base');
+ok(!eval { decode_flags({ date => 'julian' }); 1 }, 'invalid decode format dies');
+ok(!eval { decode_flags({ uuid => 'string' }); 1 }, 'unknown decode type dies');
+
+is_deeply(parse_type('int'), [TYPE_INT], 'parse_type');
+is_deeply(parse_type('Map<text, frozen<list<bigint>>>'), [TYPE_MAP, [TYPE_VARCHAR], [TYPE_LIST, [TYPE_BIGINT]]], 'parse_type with collections');
+is_deeply(parse_type('tuple<int,set<uuid>>'), [TYPE_TUPLE, [[TYPE_INT], [TYPE_SET, [TYPE_UUID]]]], 'parse_type with tuples');
+ok(!eval { parse_type($_); 1 }, "parse_type rejects '$_'") for 'integer', 'list<int', 'map<int>', 'int>';
+
+# Partition key tokens, as Cassandra computes them (including its signed tail bytes)
+is(murmur3_token(pack('l>', 1)), -4069959284402364209, 'murmur3_token of int 1');
+is(murmur3_token('123'), -7468325962851647638, 'murmur3_token');
+is(murmur3_token("\x00\xff\x10\xfa\x99" x 10), 5837342703291459765, 'murmur3_token of a long key');
+is(murmur3_token("\xfe" x 8), -8927430733708461935, 'murmur3_token with high tail bytes');
+is(murmur3_token(''), -9223372036854775808, 'murmur3_token of an empty key');
+
+for my $token (-9223372036854775808, -4069959284402364209, 0, 1446172840243228796, 9223372036854775807) {
+    my $biased= ((Math::BigInt->new($token) + Math::BigInt->new(2)**63) * Math::BigInt->new(2)**12) % Math::BigInt->new(2)**64;
+    is(scylla_shard($token, 12, 12), ($biased * 12) / Math::BigInt->new(2)**64, "scylla_shard of $token");
+}
+is(scylla_shard(1446172840243228796, 1, 12), 0, 'scylla_shard without shards');
+
+{
+    # Bind metadata of a prepared statement, with a partition key of columns 2 and 0
+    my $metadata= pack_metadata(4, 1, { columns => [ [ 'ks', 't', 'a', [TYPE_INT] ], [ 'ks', 't', 'b', [TYPE_INT] ], [ 'ks', 't', 'c', [TYPE_VARCHAR] ] ] });
+    substr($metadata, 8, 0, pack('l>n*', 2, 2, 0));
+    my ($rowmeta)= unpack_metadata(4, 0, $metadata);
+    is($rowmeta->routing_token([ 5, 6, "x" ]), murmur3_token(pack('n/a C n/a C', "x", 0, pack('l>', 5), 0)), 'routing_token of a composite key');
+    is($rowmeta->routing_token({ a => 5, b => 6, c => "x" }), $rowmeta->routing_token([ 5, 6, "x" ]), 'routing_token of named values');
+    ok(!defined $rowmeta->routing_token([ 5, 6, undef ]), 'no routing_token with a null key');
+    ok(!defined $rowmeta->routing_token([ 5, 6 ]), 'no routing_token with missing values');
+
+    $metadata= pack_metadata(4, 1, { columns => [ [ 'ks', 't', 'id', [TYPE_INT] ] ] });
+    substr($metadata, 8, 0, pack('l>n', 1, 0));
+    ($rowmeta)= unpack_metadata(4, 0, $metadata);
+    is($rowmeta->routing_token([ 1 ]), -4069959284402364209, 'routing_token of a single key');
+}
 
 done_testing;
@@ -0,0 +1,55 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use Test::More;
+use Cassandra::Client;
+use Cassandra::Client::Protocol qw/:constants pack_batch pack_long pack_metadata pack_shortbytes pack_string unpack_metadata/;
+
+my ($encoder)= unpack_metadata(4, 1, pack_metadata(4, 1, {
+    columns => [
+        [ 'schema', 'table', 'id', [ TYPE_INT ] ],
+        [ 'schema', 'table', 'value', [ TYPE_VARCHAR ] ],
+    ],
+}));
+
+my @queries= map { [ "id$_", $encoder, [ $_, "value $_" ] ] } 1..3;
+
+sub perl_batch {
+    my ($type, $queries, $consistency, $flags, $trailer, $named)= @_;
+    my $frame= pack('Cn', $type, 0+@$queries);
+    for my $query (@$queries) {
+        my $row= $query->[1]->encode($query->[2]);
+        if ($named) {
+            my (undef, $id, $value)= unpack('n l>/a l>/a', $row);
+            $row= pack('n', 2).pack_string('id').pack('l>/a', $id).pack_string('value').pack('l>/a', $value);
+        }
+        $frame .= pack('C', 1).pack_shortbytes($query->[0]).$row;
+    }
+    return $frame.pack('nC', $consistency, $flags).($trailer // '');
+}
+
+is(unpack('H*', pack_batch(1, \@queries, CONSISTENCY_QUORUM, undef, undef, 0)),
+   unpack('H*', perl_batch(1, \@queries, CONSISTENCY_QUORUM, 0)),
+   'plain batch');
+
+is(unpack('H*', pack_batch(0, \@queries, CONSISTENCY_ONE, CONSISTENCY_LOCAL_SERIAL, undef, 0)),
+   unpack('H*', perl_batch(0, \@queries, CONSISTENCY_ONE, 0x10, pack('n', CONSISTENCY_LOCAL_SERIAL))),
+   'serial consistency');
+
+is(unpack('H*', pack_batch(0, \@queries, CONSISTENCY_ONE, undef, 1500000000123456, 0)),
+   unpack('H*', perl_batch(0, \@queries, CONSISTENCY_ONE, 0x20, pack_long(1500000000123456))),
+   'default timestamp');
+
+is(unpack('H*', pack_batch(0, \@queries, CONSISTENCY_ONE, undef, undef, 1)),
+   unpack('H*', perl_batch(0, \@queries, CONSISTENCY_ONE, 0x40, undef, 1)),
+   'named values');
+
+is(unpack('H*', pack_batch(2, [ [ "x", $encoder, undef ] ], CONSISTENCY_ONE, undef, undef, 0)),
+   unpack('H*', pack('Cn', 2, 1).pack('C', 1).pack_shortbytes('x').pack('n', 0).pack('nC', CONSISTENCY_ONE, 0)),
+   'query without parameters');
+
+ok(!eval { pack_batch(0, [ [ "x", $encoder, [ 1 ] ] ], CONSISTENCY_ONE, undef, undef, 0); 1 }, 'wrong column count croaks');
+ok(!eval { pack_batch(0, [ "x" ], CONSISTENCY_ONE, undef, undef, 0); 1 }, 'malformed entry croaks');
+
+done_testing;
@@ -0,0 +1,22 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use Test::More;
+use Cassandra::Client;
+use Cassandra::Client::Protocol qw/next_timestamp/;
+use Time::HiRes ();
+
+my $first= next_timestamp();
+ok(abs($first - (Time::HiRes::time() * 1000000)) < 5000000, 'timestamp is in microseconds since the epoch');
+
+my $last= $first;
+my $increasing= 1;
+for (1..10000) {
+    my $next= next_timestamp();
+    $increasing= 0 unless $next > $last;
+    $last= $next;
+}
+ok($increasing, 'timestamps increase monotonically, even within the same microsecond');
+
+done_testing;
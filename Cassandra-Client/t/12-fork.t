@@ -0,0 +1,49 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use File::Basename qw//; use lib File::Basename::dirname(__FILE__).'/lib';
+use Test::More;
+use TestCassandra;
+use POSIX ();
+
+plan skip_all => "Missing Cassandra test environment" unless TestCassandra->is_ok;
+plan tests => 5;
+
+my $client= TestCassandra->new;
+$client->connect;
+
+my $query= "select key from system.local where key=?";
+my ($before)= $client->execute($query, [ 'local' ]);
+is($before->rows->[0][0], 'local', 'query before fork');
+ok($client->{metadata}->is_prepared(\$query), 'statement is prepared');
+
+my @children;
+for (1..3) {
+    my $pid= fork;
+    die "fork: $!" unless defined $pid;
+    if (!$pid) {
+        my $ok= eval {
+            die "lost the prepare cache" unless $client->{metadata}->is_prepared(\$query);
+            my ($rs)= $client->execute($query, [ 'local' ]);
+            die "unexpected result" unless $rs->rows->[0][0] eq 'local';
+            $client->shutdown;
+            1;
+        };
+        warn $@ unless $ok;
+        POSIX::_exit($ok ? 0 : 1);
+    }
+    push @children, $pid;
+}
+
+my $failed= 0;
+for (@children) {
+    waitpid($_, 0);
+    $failed++ if $?;
+}
+is($failed, 0, 'children can query after forking');
+
+# The children shut down their clients, which must not have affected ours
+my ($after)= $client->execute($query, [ 'local' ]);
+is($after->rows->[0][0], 'local', 'parent connection survives');
+ok($client->is_active, 'parent is still connected');
@@ -0,0 +1,731 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use File::Basename qw//; use lib File::Basename::dirname(__FILE__).'/lib';
+use Test::More;
+use MockCassandra;
+use MockClient;
+use Cassandra::Client;
+use Cassandra::Client::Policy::LoadBalancing::RackAware;
+use Cassandra::Client::Protocol qw/:constants murmur3_token scylla_shard token_sort_key/;
+use File::Temp ();
+use IO::Select;
+use IO::Socket::INET;
+use POSIX ();
+use Time::HiRes ();
+
+my $mock= eval {
+    MockCassandra->new(
+        nodes      => 3,
+        statements => [
+            [ qr/\Aselect id, value from t where id=\?/, {
+                params  => [ [ id => TYPE_INT ] ],
+                columns => [ [ id => TYPE_INT ], [ value => TYPE_VARCHAR ] ],
+                rows    => sub { my ($params, $node)= @_; [ [ unpack('l>', $params->[0]), "node $node" ] ] },
+            } ],
+            [ qr/\Ainsert into t/, { params => [ [ id => TYPE_INT ] ] } ],
+        ],
+    )->start;
+} or plan skip_all => "Unable to start the mock server: $@";
+
+my $client= mock_client($mock, request_timeout => 2);
+
+my ($result)= $client->execute("select id, value from t where id=?", [ 5 ]);
+is($result->rows->[0][0], 5, 'bind parameters reach the server');
+like($result->rows->[0][1], qr/\Anode [123]\z/, 'canned result');
+is_deeply($result->column_names, [ 'id', 'value' ], 'column names');
+
+is(0+(keys %{$client->{pool}{network_status}{status}}), 3, 'peers are discovered through system.peers');
+
+my %nodes;
+for (1..30) {
+    my ($rs)= $client->execute("select id, value from t where id=?", [ $_ ]);
+    $nodes{$rs->rows->[0][1]}++;
+}
+ok(keys(%nodes) > 1, 'queries are spread over the nodes');
+
+$client->batch([ [ "insert into t (id) values (?)", [ 1 ] ], [ "insert into t (id) values (?)", [ 2 ] ] ]);
+is($mock->stats($client)->{batch}, 1, 'batch reaches the server');
+
+my ($error)= $client->call_execute("select nothing from nowhere");
+like($error, qr/Unknown statement/, 'errors are relayed');
+
+$client->shutdown;
+
+# Error injection: every injected error must be either retried away or reported
+{
+    my $faulty= MockCassandra->new(
+        nodes      => 2,
+        errors     => { unavailable => 0.1, unprepared => 0.1 },
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    my $client= mock_client($faulty, request_timeout => 2);
+
+    my ($ok, $injected)= (0, 0);
+    for (1..200) {
+        my ($error, $rs)= $client->call_execute("select id from t");
+        if (!$error) {
+            $ok++;
+        } elsif ($error =~ /Injected unavailable|prepared statement cache/) {
+            $injected++;
+        } else {
+            diag $error;
+        }
+    }
+    is($ok + $injected, 200, 'only the injected errors surface');
+    ok($ok > 150, 'injected errors are mostly retried away');
+
+    my $stats= $faulty->stats($client);
+    ok($stats->{unprepared}, 'unprepared statements were injected');
+    ok($stats->{prepare} > $stats->{unprepared}, 'and reprepared');
+    $client->shutdown;
+}
+
+# Dropped responses turn into request timeouts
+{
+    my $silent= MockCassandra->new(
+        errors     => { drop => 1 },
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    my $client= mock_client($silent, request_timeout => 0.2);
+    my ($error)= $client->call_execute("select id from t");
+    like($error, qr/timed out/i, 'dropped response times out');
+    $client->shutdown;
+}
+
+# Latency
+{
+    my $slow= MockCassandra->new(
+        latency    => [ 0.05, 0.06 ],
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    my $client= mock_client($slow);
+    $client->execute("select id from t");
+    my $t0= Time::HiRes::time();
+    $client->execute("select id from t");
+    cmp_ok(Time::HiRes::time() - $t0, '>=', 0.05, 'latency is added');
+    $client->shutdown;
+}
+
+# Forking after connect: the child reconnects on its own, and leaves the parent's connections alone
+{
+    my $client= mock_client($mock, request_timeout => 2);
+    $client->execute("select id, value from t where id=?", [ 1 ]);
+
+    my @children;
+    for my $n (1..3) {
+        my $pid= fork;
+        die "fork: $!" unless defined $pid;
+        if (!$pid) {
+            my $ok= eval {
+                for (1..5) {
+                    my ($rs)= $client->execute("select id, value from t where id=?", [ $n * 10 + $_ ]);
+                    die "unexpected result" unless $rs->rows->[0][0] == $n * 10 + $_;
+                }
+                $client->shutdown;
+                1;
+            };
+            warn $@ unless $ok;
+            POSIX::_exit($ok ? 0 : 1);
+        }
+        push @children, $pid;
+    }
+
+    # The parent keeps going while the children run
+    my ($rs)= $client->execute("select id, value from t where id=?", [ 2 ]);
+    is($rs->rows->[0][0], 2, 'parent can query while the children do');
+
+    my $failed= 0;
+    for (@children) {
+        waitpid($_, 0);
+        $failed++ if $?;
+    }
+    is($failed, 0, 'children can query after forking');
+
+    ($rs)= $client->execute("select id, value from t where id=?", [ 3 ]);
+    is($rs->rows->[0][0], 3, 'parent connections survive the children shutting down');
+    ok($client->is_active, 'parent is still connected');
+    $client->shutdown;
+}
+
+# Forking while a merged read is in flight: the child sends its own instead of waiting on the parent's
+{
+    my $slow= MockCassandra->new(
+        latency    => 0.2,
+        statements => [ [ qr/\Aselect id from t where id=\?/, {
+            params  => [ [ id => TYPE_INT ] ],
+            columns => [ [ id => TYPE_INT ] ],
+            rows    => sub { [ [ unpack('l>', $_[0][0]) ] ] },
+        } ] ],
+    )->start;
+    my $client= mock_client($slow, request_timeout => 2, coalesce_reads => 1);
+    $client->execute("select id from t where id=?", [ 0 ]); # Prepare
+
+    my $parent_result;
+    $client->_execute(sub { $parent_result= $_[1] }, "select id from t where id=?", [ 1 ]);
+    ok($client->{inflight_reads} && keys %{$client->{inflight_reads}}, 'a merged read is in flight');
+
+    # Let the request go out, well before its answer comes back
+    my $sent= $client->{async_io}->wait(my $run);
+    $client->{async_io}->timer(sub { $sent->() }, 0.05);
+    $run->();
+
+    my $pid= fork;
+    die "fork: $!" unless defined $pid;
+    if (!$pid) {
+        my $ok= eval {
+            my ($rs)= $client->execute("select id from t where id=?", [ 1 ]);
+            $rs->rows->[0][0] == 1 or die "unexpected result";
+            !$parent_result or die "the parent's read was answered in the child";
+        };
+        POSIX::_exit($ok ? 0 : 1);
+    }
+
+    my $deadline= Time::HiRes::time() + 10;
+    Time::HiRes::sleep(0.01) until waitpid($pid, POSIX::WNOHANG()) || Time::HiRes::time() > $deadline;
+    my $status= $?;
+    if (kill 0, $pid) {
+        kill 'KILL', $pid;
+        waitpid($pid, 0);
+        $status= -1;
+    }
+    is($status, 0, 'the child sends its own read instead of joining the one the parent had in flight');
+
+    my ($rs)= $client->execute("select id from t where id=?", [ 1 ]);
+    is($rs->rows->[0][0], 1, 'the parent still gets its own');
+    is($parent_result && $parent_result->rows->[0][0], 1, 'including the read that was in flight');
+    $client->shutdown;
+}
+
+# Identical reads in flight at the same time are merged
+{
+    my $slow= MockCassandra->new(
+        latency    => 0.05,
+        statements => [ [ qr/\Aselect id from t where id=\?/, {
+            params  => [ [ id => TYPE_INT ] ],
+            columns => [ [ id => TYPE_INT ] ],
+            rows    => sub { [ [ unpack('l>', $_[0][0]) ] ] },
+        } ] ],
+    )->start;
+    my $client= mock_client($slow, coalesce_reads => 1);
+    $client->execute("select id from t where id=?", [ 0 ]); # Prepare
+
+    my $before= $slow->stats($client)->{execute};
+    my @ids= (1, 1, 1, 2, 1);
+    my @results= map { $_->[0] // $_->[1] } run_concurrently($client, 0+@ids, sub {
+        return ("select id from t where id=?", [ $ids[$_[0] - 1] ]);
+    });
+
+    is_deeply([ map { $_->rows->[0][0] } @results ], [ 1, 1, 1, 1, 2 ], 'everyone gets their result');
+    is($results[0], $results[1], 'merged queries share the ResultSet');
+    is($slow->stats($client)->{execute} - $before, 3, 'only distinct reads reach the server'); # Includes mock.stats
+    $client->shutdown;
+}
+
+# Result cache
+{
+    my $mock= MockCassandra->new(
+        statements => [ [ qr/\Aselect id from t where id=\?/, {
+            params  => [ [ id => TYPE_INT ] ],
+            columns => [ [ id => TYPE_INT ] ],
+            rows    => sub { [ [ unpack('l>', $_[0][0]) ] ] },
+        } ] ],
+    )->start;
+    my $client= mock_client($mock, result_cache_size => 100000);
+
+    my $executes= sub { $mock->stats($client)->{execute} - 1 }; # Minus the mock.stats query itself
+    my $query= "select id from t where id=?";
+    $client->execute($query, [ 1 ]); # Prepare
+    my $base= $executes->();
+
+    my ($first)= $client->execute($query, [ 1 ], { cache_ttl => 60 });
+    my ($second)= $client->execute($query, [ 1 ], { cache_ttl => 60 });
+    is_deeply($second->rows, [ [ 1 ] ], 'cached result');
+    is($executes->() - $base, 2, 'served from the cache'); # One query, one mock.stats
+    $client->execute($query, [ 2 ], { cache_ttl => 60 });
+    $client->execute($query, [ 1 ]);
+    is($executes->() - $base, 5, 'other parameters and uncached queries go to the server');
+
+    my ($connection)= $client->{pool}->get_one;
+    $connection->handle_event(join '', map { pack('n/a*', $_) } 'SCHEMA_CHANGE', 'UPDATED', 'TABLE', 'ks', 't');
+    is($client->{result_cache}->count, 0, 'schema changes clear the cache');
+
+    $client->execute($query, [ 3 ], { cache_ttl => 0.05 });
+    Time::HiRes::sleep(0.1);
+    my $before= $executes->();
+    $client->execute($query, [ 3 ], { cache_ttl => 0.05 });
+    is($executes->() - $before, 2, 'entries expire');
+    $client->shutdown;
+
+    my $cache= Cassandra::Client::ResultCache->new(max_bytes => 1000);
+    $cache->put($_, Cassandra::Client::ResultSet->new(\("x" x 100), undef, undef, 0), 60) for qw/a b c d/;
+    $cache->put('b', Cassandra::Client::ResultSet->new(\("y" x 100), undef, undef, 0), 60);
+    ok(!$cache->get('a') && $cache->get('b') && $cache->get('d'), 'oldest entries are evicted first');
+    is(${$cache->get('b')->{raw_data}}, "y" x 100, 'replaced entries are kept');
+}
+
+# Per-node limits: a slow node only gets its share, the rest goes elsewhere
+{
+    my $mock= MockCassandra->new(
+        nodes      => 2,
+        latency    => sub { $_[1] == 1 ? 0.2 : 0.001 },
+        statements => [ [ qr/\Aselect node from t/, {
+            columns => [ [ node => TYPE_INT ] ],
+            rows    => sub { [ [ $_[1] ] ] },
+        } ] ],
+    )->start;
+    my $client= mock_client($mock, max_concurrent_queries_per_node => 2);
+    $client->execute("select node from t") for 1..4; # Prepare on both nodes
+
+    my %nodes;
+    $nodes{$_->[0] ? 'error' : $_->[1]->rows->[0][0]}++ for run_concurrently($client, 20, sub {
+        my ($i)= @_;
+        return ("select node from t", undef, { priority => ($i == 20 ? 'high' : 'low') });
+    });
+    ok(!$nodes{error}, 'no errors');
+    cmp_ok($nodes{1} || 0, '<=', 4, 'the slow node only gets a few queries');
+    is(($nodes{1} || 0) + $nodes{2}, 20, 'the fast node gets the rest');
+    $client->shutdown;
+
+    my $queue= Cassandra::Client::Policy::Queue::Default->new;
+    $queue->enqueue([ "q$_->[0]", undef, undef, { priority => $_->[1] } ])
+        for [ 1, 'low' ], [ 2, undef ], [ 3, 'high' ], [ 4, 'low' ], [ 5, 'normal' ];
+    is($queue->{has_any}, 5, 'queue counts entries');
+    is(join(',', map { $queue->dequeue->[0] } 1..5), 'q3,q2,q5,q1,q4', 'queue honours priorities');
+    ok(!$queue->{has_any} && !$queue->dequeue, 'queue is empty');
+
+    $queue->enqueue([ "q$_->[0]", undef, undef, { priority => $_->[1], queue_deadline => $_->[2] } ])
+        for [ 1, 'low', 10 ], [ 2, 'high', 11 ], [ 3, 'low', 12 ], [ 4, 'high', 13 ];
+    is($queue->next_deadline, 10, 'queue knows the first deadline');
+    is(join(',', map $_->[0], $queue->expire(11.5)), 'q2,q1', 'queue takes out expired entries');
+    is($queue->{has_any}, 2, 'and stops counting them');
+    is($queue->next_deadline, 12, 'next deadline');
+}
+
+# A request that timed out keeps its node busy until the node answers it. Queries queued behind it
+# go out once it does, and fail if it takes longer than request_timeout.
+{
+    my $slow= 1;
+    my $mock= MockCassandra->new(
+        latency    => sub { ($_[2] // '') =~ /\Aselect id from t/ && $slow-- > 0 ? 0.5 : 0 }, # Only the first one is slow
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    my $client= mock_client($mock, request_timeout => 0.2, max_concurrent_queries_per_node => 1);
+    my $t0= Time::HiRes::time();
+    my ($error, $result)= $client->call_execute("select id from t");
+    ok(!$error, 'the retry goes out once the node answers the request that timed out') or diag $error;
+    cmp_ok(Time::HiRes::time() - $t0, '<', 2, 'without hanging');
+    $client->shutdown;
+
+    my $silent= MockCassandra->new(
+        errors     => { drop => 1 },
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    $client= mock_client($silent, request_timeout => 0.2, max_concurrent_queries_per_node => 1);
+    $t0= Time::HiRes::time();
+    my @errors= map $_->[0], run_concurrently($client, 3, sub { "select id from t" });
+    is(0+(grep defined, @errors), 3, 'queries waiting for a node that never answers fail');
+    ok((grep { /in the command queue/ } @errors), 'some of them while queued');
+    cmp_ok(Time::HiRes::time() - $t0, '<', 3, 'after request_timeout');
+    $client->shutdown;
+
+    # Expired entries leave the queue right away, rather than taking up room until they're dequeued
+    $client= mock_client($silent, request_timeout => 0.2, max_concurrent_queries_per_node => 1,
+        command_queue => Cassandra::Client::Policy::Queue::Default->new(max_entries => 3));
+    run_concurrently($client, 4, sub { "select id from t" });
+    is($client->{command_queue}{has_any}, 0, 'queries that timed out in the queue are taken out of it');
+    my ($error)= $client->call_execute("select id from t");
+    like($error, qr/in the command queue/, 'so a full queue of them does not turn new queries away');
+    $client->shutdown;
+}
+
+# Retries avoid the node that failed, and the retry budget caps them
+{
+    my $mock= MockCassandra->new(
+        nodes      => 2,
+        errors     => { unavailable => sub { $_[0] == 1 ? 1 : 0 } },
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    my $client= mock_client($mock);
+    $client->execute("select id from t") for 1..4; # Prepare on both nodes
+    my @errors= grep defined, map { ($client->call_execute("select id from t"))[0] } 1..20;
+    is(0+@errors, 0, 'queries failing on one node are retried on the other');
+    $client->shutdown;
+
+    my $down= MockCassandra->new(
+        nodes      => 2,
+        errors     => { unavailable => 1 },
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    $client= mock_client($down, retry_budget => Cassandra::Client::Policy::Retry::Budget->new(ratio => 0, min_per_second => 3));
+
+    run_concurrently($client, 20, sub { "select id from t" });
+    # Without the budget every query would be tried twice
+    cmp_ok($down->stats($client)->{unavailable}, '<=', 20 + 3 + 1, 'retries stay within the budget');
+    $client->shutdown;
+
+    {
+        package FakeConnection;
+        sub new { bless { ip => $_[1], in_flight => $_[2] || 0 }, $_[0] }
+        sub ip_address { $_[0]{ip} }
+        sub in_flight { $_[0]{in_flight} }
+    }
+    my $pool= bless { i => 0, options => {} }, 'Cassandra::Client::Pool';
+    $pool->{list}= [ map FakeConnection->new("10.0.0.$_"), 1..3 ];
+    $pool->{pool}= { map { $_->ip_address => $_ } @{$pool->{list}} };
+    $pool->{count}= 3;
+    ok(!(grep { $pool->get_one('10.0.0.2')->ip_address eq '10.0.0.2' } 1..30), 'pool avoids the failed node');
+    $pool->{options}{max_concurrent_queries_per_node}= 5;
+    $_->{in_flight}= 5 for @{$pool->{list}}[0, 2];
+    is($pool->get_one('10.0.0.2')->ip_address, '10.0.0.2', 'unless it is the only one with capacity');
+
+    my $budget= Cassandra::Client::Policy::Retry::Budget->new(ratio => 0.5, min_per_second => 0, max_tokens => 2);
+    ok(!$budget->withdraw, 'no retries without successes');
+    $budget->deposit for 1..10;
+    ok($budget->withdraw && $budget->withdraw && !$budget->withdraw, 'tokens are capped');
+}
+
+# Snapshots: a new client starts out with the nodes and prepared statements of the previous one
+{
+    my $mock= MockCassandra->new(
+        nodes      => 1,
+        statements => [ [ qr/\Aselect id from t/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ] ],
+    )->start;
+    my $dir= File::Temp::tempdir(CLEANUP => 1);
+    my $client= mock_client($mock, snapshot => "$dir/snapshot");
+    $client->execute("select id from t");
+    my $prepares= $mock->stats($client)->{prepare};
+    $client->shutdown;
+    ok(-s "$dir/snapshot", 'snapshot is written on shutdown');
+
+    my $snapshot= Cassandra::Client::Snapshot->load("$dir/snapshot", $client->{options});
+    is_deeply([ keys %{$snapshot->{nodes}} ], [ $mock->address(1) ], 'snapshot has the nodes');
+    ok((grep { $_->[0] eq 'select id from t' } @{$snapshot->{prepared}}), 'snapshot has the prepared statements');
+    ok(!Cassandra::Client::Snapshot->load("$dir/snapshot", { %{$client->{options}}, keyspace => 'other' }),
+        'snapshot is only used for the same cluster and keyspace');
+
+    my $complete= do { open(my $fh, '<:raw', "$dir/snapshot") or die $!; local $/; <$fh> };
+    my (@accepted, @warnings);
+    {
+        local $SIG{__WARN__}= sub { push @warnings, @_ };
+        for my $length (0..length($complete) - 1) {
+            open(my $fh, '>:raw', "$dir/truncated") or die $!;
+            print $fh substr($complete, 0, $length);
+            close $fh;
+            push @accepted, $length if Cassandra::Client::Snapshot->load("$dir/truncated", $client->{options});
+        }
+    }
+    is_deeply(\@accepted, [], 'truncated snapshots are rejected');
+    is_deeply(\@warnings, [], 'without warnings');
+
+    $client= mock_client($mock, snapshot => "$dir/snapshot");
+    is(0+(keys %{$client->{pool}->known_nodes}), 1, 'nodes are known right after connecting');
+    my ($result)= $client->execute("select id from t");
+    is($result->rows->[0][0], 1, 'query through a prepared statement from the snapshot');
+    is($mock->stats($client)->{prepare}, $prepares, 'nothing had to be prepared again');
+    $client->shutdown;
+
+    open(my $fh, '>', "$dir/snapshot") or die $!;
+    print $fh "garbage";
+    close $fh;
+    $client= mock_client($mock, snapshot => "$dir/snapshot");
+    ($result)= $client->execute("select id from t");
+    is($result->rows->[0][0], 1, 'broken snapshots are ignored');
+    $client->shutdown;
+    ok(Cassandra::Client::Snapshot->load("$dir/snapshot", $client->{options}), 'and replaced');
+
+    $client= mock_client($mock);
+    $client->execute("select id from t");
+    ok(!(grep { exists $_->{raw} } values %{$client->{metadata}->prepare_cache}), 'raw metadata is only kept for snapshots');
+    $client->shutdown;
+}
+
+# Connecting: no OPTIONS when there's nothing to negotiate, and contact points are raced
+{
+    my $mock= MockCassandra->new(nodes => 1)->start;
+    my $client= mock_client($mock,
+        keyspace    => 'ks',
+        cql_version => '3.0.0',
+        compression => 'none',
+    );
+    my $stats= $mock->stats($client);
+    ok(!$stats->{options}, 'OPTIONS is skipped with cql_version and compression set');
+    is($stats->{query}, 1, 'keyspace is set with a plain QUERY');
+    $client->shutdown;
+
+    # These accept connections, but never answer
+    my @silent= map IO::Socket::INET->new(LocalAddr => "127.0.0.$_", LocalPort => $mock->port, Listen => 5), 8, 9;
+    SKIP: {
+        skip "Unable to listen on 127.0.0.8 and 127.0.0.9", 2 unless @silent == 2 && $silent[0] && $silent[1];
+        my $t0= Time::HiRes::time();
+        my $client= mock_client($mock,
+            contact_points  => [ '127.0.0.8', '127.0.0.9', $mock->address(1) ],
+            request_timeout => 5,
+        );
+        cmp_ok(Time::HiRes::time() - $t0, '<', 2, 'an unresponsive contact point does not hold up connecting');
+
+        # The attempts that lost the race are closed right away, instead of when their handshake times out
+        my $closed= 0;
+        for my $listener (@silent) {
+            my $peer= $listener->accept or next;
+            my $select= IO::Select->new($peer);
+            while ($select->can_read(1)) {
+                next if sysread($peer, my $buffer, 4096);
+                $closed++;
+                last;
+            }
+        }
+        is($closed, 2, 'the other contact points are cut off');
+        $client->shutdown;
+    }
+}
+
+# Statements are sent as plain QUERYs until they've been used prepare_threshold times
+{
+    my $mock= MockCassandra->new(
+        nodes      => 1,
+        statements => [
+            [ qr/\Aselect id, value from t where id=\?/, {
+                params  => [ [ id => TYPE_INT ] ],
+                columns => [ [ id => TYPE_INT ], [ value => TYPE_VARCHAR ] ],
+                rows    => sub { my ($params)= @_; [ [ unpack('l>', $params->[0]), "x" ] ] },
+            } ],
+            [ qr/\Aselect id from t\z/, { columns => [ [ id => TYPE_INT ] ], rows => [ [ 1 ] ] } ],
+        ],
+    )->start;
+    my $client= mock_client($mock, prepare_threshold => 3);
+    $client->prepare("select name, value from mock.stats"); # Or our own lookups would count
+    my $before= $mock->stats($client);
+
+    my @ids= map { ($client->execute("select id, value from t where id=?", [ $_ ], { types => [ 'int' ] }))[0]->rows->[0][0] } 1..2;
+    is_deeply(\@ids, [ 1, 2 ], 'bind values are encoded with the given types');
+    my ($result)= $client->execute("select id from t");
+    is($result->rows->[0][0], 1, 'query without bind values');
+    my $stats= $mock->stats($client);
+    is($stats->{query} - ($before->{query} || 0), 3, 'sent as plain queries');
+    is($stats->{prepare}, $before->{prepare}, 'nothing was prepared');
+
+    $client->execute("select id, value from t where id=?", [ 3 ], { types => [ 'int' ] });
+    $client->execute("select id, value from t where id=?", [ 4 ]);
+    $stats= $mock->stats($client);
+    is($stats->{prepare} - $before->{prepare}, 1, 'prepared on the third use');
+    is($stats->{execute} - $before->{execute}, 2 + 2, 'and executed from then on'); # Includes the stats lookups
+    $client->shutdown;
+}
+
+# Statement objects
+{
+    my $mock= MockCassandra->new(
+        nodes      => 1,
+        statements => [
+            [ qr/\Aselect id, value from t where id=\?/, {
+                params  => [ [ id => TYPE_INT ] ],
+                columns => [ [ id => TYPE_INT ], [ value => TYPE_VARCHAR ] ],
+                rows    => sub { my ($params)= @_; [ [ unpack('l>', $params->[0]), "x" ] ] },
+            } ],
+            [ qr/\Ainsert into t/, { params => [ [ id => TYPE_INT ] ] } ],
+        ],
+    )->start;
+    my $client= mock_client($mock);
+
+    my ($statement)= $client->prepare_statement("select id, value from t where id=?", { consistency => 'quorum' });
+    isa_ok($statement, 'Cassandra::Client::Statement');
+    my ($result)= $statement->execute([ 7 ]);
+    is($result->rows->[0][0], 7, 'statements execute');
+
+    my $entry= $statement->{prepared};
+    $mock->forget_prepared($client);
+    ($result)= $statement->execute([ 8 ]);
+    is($result->rows->[0][0], 8, 'statements are prepared again on UNPREPARED');
+    ok($statement->{prepared} != $entry && $statement->{prepared} == $client->{metadata}->prepare_cache->{$statement->query},
+        'and switch to the new prepared statement right away');
+
+    my ($insert)= $client->prepare_statement("insert into t (id) values (?)");
+    my ($error)= $client->call_batch([ [ $insert, [ 1 ] ], [ "insert into t (id) values (?)", [ 2 ] ] ]);
+    ok(!$error, 'statements in batches') or diag $error;
+    $client->shutdown;
+}
+
+# Shard awareness: queries go to the node and the shard that own the partition
+{
+    my $mock= MockCassandra->new(
+        nodes      => 3,
+        shards     => 4,
+        statements => [
+            [ qr/\Aselect node, shard from t where id=\?/, {
+                params  => [ [ id => TYPE_INT ] ],
+                pk      => [ 0 ],
+                columns => [ [ node => TYPE_INT ], [ shard => TYPE_INT ] ],
+                rows    => sub { my ($params, $node, $shard)= @_; [ [ $node, $shard ] ] },
+            } ],
+        ],
+    )->start;
+    my $client= mock_client($mock, shard_aware => 1, max_connections => 3);
+
+    my $pool= $client->{pool};
+    is($pool->token_owner(2_002_000_000_000_000), $mock->address(2), 'token owner');
+    is($pool->token_owner(1_500_000_000_000_000), $mock->address(2), 'token owner is the next one on the ring');
+    is($pool->token_owner(3_500_000_000_000_000), $mock->address(1), 'ring wraps around');
+
+    my $misrouted;
+    for my $round (1..50) {
+        $misrouted= 0;
+        for my $id (1..40) {
+            my $token= murmur3_token(pack('l>', $id));
+            my ($result)= $client->execute("select node, shard from t where id=?", [ $id ]);
+            my ($node, $shard)= @{$result->rows->[0]};
+            $misrouted++ if $mock->address($node) ne $pool->token_owner($token) || $shard != scylla_shard($token, 4, 12);
+        }
+        last unless $misrouted;
+    }
+    is($misrouted, 0, 'every query reaches its shard');
+    is(0+(grep $_, @{$pool->{shards}{$mock->address(1)}}), 4, 'a connection per shard');
+
+    $client->shutdown;
+
+    # max_concurrent_queries_per_node counts all of a node's connections together
+    $client= mock_client($mock, shard_aware => 1, max_concurrent_queries_per_node => 2);
+    $pool= $client->{pool};
+    for (1..50) {
+        $client->execute("select node, shard from t where id=?", [ $_ ]) for 1..40;
+        last if 12 == grep $_, map @{$pool->{shards}{$mock->address($_)} || []}, 1..3;
+    }
+    my $busiest= 0;
+    my @results= run_concurrently($client, 40, sub {
+        my ($id)= @_;
+        for my $node (1..3) {
+            my $in_flight= $pool->node_in_flight($mock->address($node));
+            $busiest= $in_flight if $in_flight > $busiest;
+        }
+        return ("select node, shard from t where id=?", [ $id ]);
+    });
+    is($busiest, 2, 'a node with shard connections stays within its limit');
+    is(0+(grep !$_->[0], @results), 40, 'and the queries wait for it');
+    $client->shutdown;
+
+    # The ring only has our datacenter, and queries skip the replicas we're not connected to
+    my $ring_pool= bless { policy => { datacenter => 'dc1' }, pool => {}, shards => {} }, 'Cassandra::Client::Pool';
+    $ring_pool->{network_status}{status}= {
+        a => { peer => 'a', data_center => 'dc1', tokens => [ '-9223372036854775808', '100' ] },
+        b => { peer => 'b', data_center => 'dc2', tokens => [ '50' ] },
+        c => { peer => 'c', data_center => 'dc1', tokens => [ '9223372036854775806' ] },
+    };
+    is($ring_pool->token_owner(40), 'a', 'other datacenters are not on the ring');
+    is($ring_pool->token_owner('9223372036854775806'), 'c', 'tokens at the top of the range');
+    is($ring_pool->token_owner('9223372036854775807'), 'a', 'ring wraps around from there');
+    ok(!$ring_pool->get_for_token(40), 'no connection without a connected replica');
+    $ring_pool->{pool}{c}= my $replica= { host => 'c' };
+    is($ring_pool->get_for_token(40), $replica, 'queries go to the next replica we are connected to');
+
+    my @sorted= sort map token_sort_key($_), '9223372036854775807', '-1', '9223372036854775806', '0', '-9223372036854775808';
+    is_deeply([ map unpack('H*', $_), @sorted ], [ map unpack('H*', token_sort_key($_)),
+        '-9223372036854775808', '-1', '0', '9223372036854775806', '9223372036854775807' ], 'token sort keys sort like the tokens');
+}
+
+# Rack awareness: queries stay in our rack, unless there's no other way
+{
+    my $mock= MockCassandra->new(
+        nodes      => 4,
+        racks      => [ 'r1', 'r2' ],
+        statements => [
+            [ qr/\Aselect node from t/, {
+                columns => [ [ node => TYPE_INT ] ],
+                rows    => sub { my ($params, $node)= @_; [ [ $node ] ] },
+            } ],
+        ],
+    )->start;
+
+    my $nodes_used= sub {
+        my ($client)= @_;
+        my %nodes;
+        for (1..100) {
+            my ($result)= $client->execute("select node from t");
+            $nodes{$result->rows->[0][0]}++;
+        }
+        return join ',', sort keys %nodes;
+    };
+
+    my $client= mock_client($mock,
+        max_connections       => 3,
+        load_balancing_policy => Cassandra::Client::Policy::LoadBalancing::RackAware->new(rack => 'r2'),
+    );
+    $client->execute("select node from t") for 1..10; # Let the pool fill up
+    is($client->{pool}{count}, 3, 'connected to three nodes');
+    is($nodes_used->($client), '2,4', 'queries go to our rack');
+    is($client->{load_balancing_policy}->get_distance($mock->address(1)), 'remote', 'other racks are remote');
+
+    # Busy nodes in our rack: the rest of the datacenter helps out
+    $client->{options}{max_concurrent_queries_per_node}= 1;
+    my %nodes;
+    $nodes{$_->[0] ? 'error' : $_->[1]->rows->[0][0]}++ for run_concurrently($client, 30, sub { "select node from t" });
+    ok(!$nodes{error}, 'no errors');
+    ok(($nodes{1} || $nodes{3}) && $nodes{2} && $nodes{4}, 'busy nodes in our rack overflow to the other');
+    $client->shutdown;
+
+    # Without a rack, we go with that of the first node
+    $client= mock_client($mock,
+        contact_points        => [ $mock->address(3) ],
+        max_connections       => 4,
+        load_balancing_policy => Cassandra::Client::Policy::LoadBalancing::RackAware->new,
+    );
+    $client->execute("select node from t") for 1..10;
+    is($client->{load_balancing_policy}{rack}, 'r1', 'rack of the first node');
+    is($nodes_used->($client), '1,3', 'queries go to that rack');
+    $client->shutdown;
+}
+
+# Tracing: the trace ID comes with the result, and the trace_hook gets the timings and the trace
+{
+    my @reports;
+    my $client= mock_client($mock, trace_hook => sub { push @reports, $_[0] });
+
+    my ($result)= $client->execute("select id, value from t where id=?", [ 7 ]);
+    ok(!defined $result->trace_id, 'no tracing by default');
+
+    my $traced= $mock->stats($client)->{traced} || 0;
+    ($result)= $client->execute("select id, value from t where id=?", [ 7 ], { tracing => 1 });
+    is($result->rows->[0][0], 7, 'traced query');
+    like($result->trace_id, qr/\A[0-9a-f]{8}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{12}\z/, 'trace_id');
+
+    my ($trace)= $client->get_trace($result->trace_id);
+    is($trace->{session}{duration}, 1234, 'get_trace waits for the session to complete');
+    is($trace->{session}{parameters}{query}, 'select id, value from t where id=?', 'session parameters');
+    is(0+@{$trace->{events}}, 2, 'trace events');
+
+    # The hook looks the trace up in the background, retrying while the session isn't complete
+    my $deadline= Time::HiRes::time() + 5;
+    while (!@reports && Time::HiRes::time() < $deadline) {
+        $client->execute("select id, value from t where id=?", [ 7 ], { tracing => 0 });
+    }
+    is(0+@reports, 1, 'trace_hook is called');
+    my $report= $reports[0];
+    is($report->{trace_id}, $result->trace_id, 'report has the trace ID');
+    ok($report->{node}, 'and the node');
+    is_deeply([ sort keys %{$report->{timings}} ], [ qw/decode encode queue server total write/ ], 'and the client-side timings');
+    ok(!(grep { $_ < 0 } values %{$report->{timings}}), 'which make sense');
+    is(0+@{$report->{events} || []}, 2, 'and the trace events');
+    is($mock->stats($client)->{traced}, $traced + 1, 'only the traced query was traced');
+    $client->shutdown;
+
+    $client= mock_client($mock, trace_sample_rate => 1);
+    $client->execute("select id, value from t where id=?", [ 7 ]) for 1..3;
+    $client->batch([ [ "insert into t (id) values (?)", [ 1 ] ] ]);
+    $client->execute("select id, value from t where id=?", [ 7 ], { tracing => 0 });
+    is($mock->stats($client)->{traced}, $traced + 5, 'sampled queries are traced, unless told otherwise');
+    $client->shutdown;
+
+    # Traced queries skip the result cache and coalescing, or there would be nothing to trace
+    $client= mock_client($mock, result_cache_size => 100000, coalesce_reads => 1);
+    $client->execute("select id, value from t where id=?", [ 7 ], { cache_ttl => 60 }) for 1..2; # Prepared first, then cached
+    $traced= $mock->stats($client)->{traced} || 0;
+    ($result)= $client->execute("select id, value from t where id=?", [ 7 ], { cache_ttl => 60, tracing => 1 });
+    ok($result->trace_id, 'traced queries skip the result cache');
+    my @traced= run_concurrently($client, 2, sub { ("select id, value from t where id=?", [ 8 ], { tracing => 1 }) });
+    my %trace_ids= map { ($_->[1] && $_->[1]->trace_id // '') => 1 } @traced;
+    ok(keys(%trace_ids) == 2 && !$trace_ids{''}, 'and are not merged');
+    is($mock->stats($client)->{traced}, $traced + 3, 'they all reach the server');
+    $client->shutdown;
+}
+
+done_testing;
@@ -0,0 +1,56 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use Test::More;
+use Cassandra::Client;
+
+my $streams= Cassandra::Client::StreamTablePtr->new(200);
+
+my @called;
+my @ids= map { my $n= $_; $streams->acquire(sub { push @called, $n }) } 1..3;
+is_deeply(\@ids, [ 0, 1, 2 ], 'IDs are handed out in order');
+is($streams->active, 3, 'three active streams');
+ok($streams->sent_at(1) > 0, 'send time is recorded');
+is($streams->sent_at(100), 0, 'no send time for unused streams');
+
+my $dismissed= 0;
+$streams->set_deadline(1, \$dismissed);
+$streams->release(1)->();
+is_deeply(\@called, [ 2 ], 'release returns the callback');
+is($dismissed, 1, 'release dismisses the deadline');
+is($streams->active, 2, 'two active streams');
+
+is($streams->acquire(sub {}), 3, 'released IDs go to the back of the line');
+
+# Timeouts keep the ID reserved until the server answers
+my $cb= $streams->timeout(0);
+ok($cb, 'timeout returns the callback');
+is($streams->orphaned, 1, 'stream is orphaned');
+ok(!defined $streams->timeout(0), 'no double timeouts');
+{
+    my @warnings;
+    local $SIG{__WARN__}= sub { push @warnings, @_ };
+    ok(!defined $streams->release(0), 'late answer has no callback');
+    is(0+@warnings, 0, 'late answer is not a bug');
+    ok(!defined $streams->release(150), 'unknown stream');
+    like($warnings[0], qr/unknown stream/, 'unknown stream warns');
+}
+is($streams->orphaned, 0, 'orphan is released by the late answer');
+
+# Growing up to the limit
+my %seen;
+my $active= $streams->active;
+while ((my $id= $streams->acquire(sub {})) >= 0) {
+    $seen{$id}++;
+}
+is($streams->active, 200, 'all IDs in use');
+is(0+(keys %seen), 200 - $active, 'every ID handed out once');
+is((sort { $b <=> $a } keys %seen)[0], 199, 'up to the limit');
+
+my @pending= $streams->drain;
+is(0+@pending, 200, 'drain returns all callbacks');
+is($streams->active, 0, 'nothing active after a drain');
+is($streams->acquire(sub {}), 0, 'IDs are available again');
+
+done_testing;
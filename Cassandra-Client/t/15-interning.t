@@ -0,0 +1,58 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use Test::More;
+use Cassandra::Client;
+use Cassandra::Client::Protocol qw/:constants pack_int pack_metadata unpack_metadata/;
+
+my $udt= [ TYPE_UDT, 'ks', 'address', [ [ street => [ TYPE_VARCHAR ] ], [ tags => [ TYPE_SET, [ TYPE_TEXT ] ] ] ] ];
+my $spec= { columns => [
+    [ 'ks', 'users', 'id', [ TYPE_INT ] ],
+    [ 'ks', 'users', 'home', $udt ],
+    [ 'ks', 'users', 'work', $udt ],
+    [ 'ks', 'users', 'scores', [ TYPE_MAP, [ TYPE_TEXT ], [ TYPE_INT ] ] ],
+] };
+my $row= [ 1, { street => 'Main', tags => [ 'a' ] }, { street => 'Side', tags => [] }, { x => 5 } ];
+
+sub roundtrip {
+    my ($rowmeta)= @_;
+    my $encoded= $rowmeta->encode($row);
+    substr($encoded, 0, 2, pack_int(1)); # Parameter list to row list
+    return $rowmeta->decode($encoded, 0)->[0];
+}
+
+my $metadata= pack_metadata(4, 1, $spec);
+my ($first)= unpack_metadata(4, 1, "$metadata");
+my ($second)= unpack_metadata(4, 1, "$metadata");
+is_deeply(roundtrip($first), $row, 'interned types encode and decode');
+is_deeply(roundtrip($second), $row, 'also when shared between statements');
+is_deeply($second->column_names, [ qw/id home work scores/ ], 'column names');
+
+eval { $second->column_names->[0]= 'oops' };
+like($@, qr/read-only/, 'shared column names are read-only');
+
+undef $first;
+is_deeply(roundtrip($second), $row, 'types outlive the statement that interned them');
+undef $second;
+
+# Metadata for the same statement over and over should not grow memory
+my $before;
+for my $i (1..200) {
+    my ($rowmeta)= unpack_metadata(4, 1, "$metadata");
+    roundtrip($rowmeta);
+    $before= Cassandra::Client::_sv_count() if $i == 100;
+}
+cmp_ok(Cassandra::Client::_sv_count(), '<=', $before, 'no leaks');
+
+# Lots of distinct names get swept once unused
+for my $i (1..3000) {
+    my ($rowmeta)= unpack_metadata(4, 1, pack_metadata(4, 1, { columns => [ [ 'ks', "t$i", "c$i", [ TYPE_INT ] ] ] }));
+}
+my $count= Cassandra::Client::_sv_count();
+for my $i (3001..6000) {
+    my ($rowmeta)= unpack_metadata(4, 1, pack_metadata(4, 1, { columns => [ [ 'ks', "t$i", "c$i", [ TYPE_INT ] ] ] }));
+}
+cmp_ok(Cassandra::Client::_sv_count(), '<', $count + 3000, 'unused names are swept');
+
+done_testing;
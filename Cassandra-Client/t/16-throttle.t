@@ -0,0 +1,55 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use Test::More;
+use Cassandra::Client;
+use Cassandra::Client::Policy::Throttle::Adaptive;
+use Cassandra::Client::Policy::Throttle::AdaptivePerNode;
+use Cassandra::Client::Error::Base;
+
+# Ring counter, with explicit times: 10 buckets of 1s
+my $ring= Cassandra::Client::RingCounterPtr->new(10, 10);
+is_deeply([ $ring->totals(100) ], [ 0, 0 ], 'starts empty');
+$ring->add(1, 100.5);
+$ring->add(0, 100.7);
+$ring->add(1, 103);
+is_deeply([ $ring->totals(105) ], [ 3, 2 ], 'counts within the window');
+is_deeply([ $ring->totals(110.5) ], [ 1, 1 ], 'old buckets expire');
+is_deeply([ $ring->totals(104) ], [ 1, 1 ], 'time never goes back');
+is_deeply([ $ring->totals(1000) ], [ 0, 0 ], 'everything expires after a long pause');
+
+$ring->add(1, 2000 + $_ / 1e6) for 1..100000;
+is_deeply([ $ring->totals(2000.5) ], [ 100000, 100000 ], 'lots of requests in one bucket');
+
+my $timeout= Cassandra::Client::Error::Base->new(message => 'timed out', is_timeout => 1);
+
+# Adaptive: healthy traffic never fails, timeouts make it throttle
+{
+    my $throttle= Cassandra::Client::Policy::Throttle::Adaptive->new;
+    $throttle->count(undef) for 1..1000;
+    ok(!(grep { $throttle->should_fail } 1..1000), 'no throttling while healthy');
+
+    $throttle->count($timeout) for 1..100000;
+    my $failed= grep { $throttle->should_fail } 1..1000;
+    ok($failed > 900, 'throttles when everything times out');
+}
+
+# Per node: only the struggling node gets throttled
+{
+    package FakeConnection;
+    sub new { bless { ip => $_[1] }, $_[0] }
+    sub ip_address { $_[0]{ip} }
+}
+{
+    my $throttle= Cassandra::Client::Policy::Throttle::AdaptivePerNode->new;
+    my ($good, $bad)= (FakeConnection->new('10.0.0.1'), FakeConnection->new('10.0.0.2'));
+    $throttle->count(undef, undef, $good) for 1..1000;
+    $throttle->count($timeout, undef, $bad) for 1..10000;
+
+    ok(!(grep { $throttle->should_fail($good) } 1..1000), 'healthy node is not throttled');
+    ok((grep { $throttle->should_fail($bad) } 1..1000) > 900, 'struggling node is throttled');
+    ok(!$throttle->should_fail(undef), 'no throttling without a node');
+}
+
+done_testing;
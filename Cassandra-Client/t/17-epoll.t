@@ -0,0 +1,135 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use Test::More;
+use Socket qw/AF_UNIX SOCK_STREAM PF_UNSPEC/;
+use IO::Handle;
+use Cassandra::Client;
+
+plan skip_all => "The epoll loop is only available on Linux" unless $^O eq 'linux';
+
+require Cassandra::Client::AsyncEpoll;
+
+# Stands in for a Connection: reads frames off the socket, and dismisses the deadline of every
+# stream it gets an answer for
+{
+    package FakeConnection;
+    sub new {
+        my ($class, $socket)= @_;
+        my $buffer= '';
+        return bless { socket => $socket, read_buffer => \$buffer, bytes_read => 0, log => [], deadlines => {} }, $class;
+    }
+    sub can_read {
+        my ($self)= @_;
+        push @{$self->{log}}, 'can_read';
+        my $buffer= $self->{read_buffer};
+        sysread($self->{socket}, $$buffer, 16384, length $$buffer);
+        while (length $$buffer >= 9) {
+            my ($stream, $length)= unpack('x2sxN', $$buffer);
+            last if length $$buffer < 9 + $length;
+            substr($$buffer, 0, 9 + $length, '');
+            push @{$self->{log}}, "frame $stream";
+            ${$self->{deadlines}{$stream}}= 1 if $self->{deadlines}{$stream};
+        }
+    }
+    sub can_write { push @{$_[0]{log}}, 'can_write'; }
+    sub can_timeout { push @{$_[0]{log}}, "timeout $_[1]"; }
+}
+
+sub frame {
+    my ($stream, $body)= @_;
+    return pack('CCsCN/a', 0x84, 0, $stream, 8, $body);
+}
+
+sub pair {
+    socketpair(my $ours, my $theirs, AF_UNIX, SOCK_STREAM, PF_UNSPEC) or die "socketpair: $!";
+    $_->blocking(0) for $ours, $theirs;
+    return ($ours, $theirs);
+}
+
+sub run_for {
+    my ($async, $seconds)= @_;
+    my $done= $async->wait(my $w);
+    $async->timer(sub { $done->() }, $seconds);
+    $w->();
+}
+
+my $async= Cassandra::Client::AsyncEpoll->new;
+
+# Timers fire in order, and the loop returns once there's nothing left to wait for
+{
+    my @fired;
+    $async->timer(sub { push @fired, 'b' }, 0.02);
+    $async->timer(sub { push @fired, 'a' }, 0.01);
+    $async->later(sub { push @fired, 'now' });
+    run_for($async, 0.03);
+    is_deeply(\@fired, [ qw/now a b/ ], 'timers fire in order');
+}
+
+# Read-ahead: Perl only hears about complete frames
+{
+    my ($ours, $theirs)= pair();
+    my $conn= FakeConnection->new($ours);
+    $async->register(fileno($ours), $conn);
+    $async->register_read(fileno($ours));
+
+    my $frame= frame(1, 'x' x 100);
+    syswrite($theirs, substr($frame, 0, 50));
+    run_for($async, 0.02);
+    is_deeply($conn->{log}, [], 'no can_read for half a frame');
+    is(length ${$conn->{read_buffer}}, 50, 'but it is buffered');
+
+    syswrite($theirs, substr($frame, 50));
+    run_for($async, 0.02);
+    is_deeply($conn->{log}, [ 'can_read', 'frame 1' ], 'can_read once the frame is complete');
+    is($conn->{bytes_read}, length $frame, 'read-ahead counts the bytes it read');
+
+    $async->register_write(fileno($ours));
+    run_for($async, 0.01);
+    ok((grep { $_ eq 'can_write' } @{$conn->{log}}), 'can_write');
+    $async->unregister_write(fileno($ours));
+    $async->unregister(fileno($ours));
+}
+
+# Deadlines: answers that are waiting in the socket count, even if we haven't dispatched them yet
+{
+    my ($ours, $theirs)= pair();
+    my $conn= FakeConnection->new($ours);
+    $async->register(fileno($ours), $conn); # Not watching for reads, so only the deadline wakes us
+
+    $conn->{deadlines}{$_}= $async->deadline(fileno($ours), $_, 0.01) for 5, 6;
+    syswrite($theirs, frame(5, 'answer'));
+    select(undef, undef, undef, 0.03);
+    run_for($async, 0.01);
+
+    is_deeply($conn->{log}, [ 'can_read', 'frame 5', 'timeout 6' ], 'read before timing out, once per connection');
+
+    my $dismissed= $async->deadline(fileno($ours), 7, 0.01);
+    $$dismissed= 1;
+    run_for($async, 0.03);
+    ok(!(grep { $_ eq 'timeout 7' } @{$conn->{log}}), 'dismissed deadlines do not fire');
+    $async->unregister(fileno($ours));
+}
+
+# Exceptions in callbacks go to $DIED, and don't stop the loop
+{
+    my @died;
+    local $Cassandra::Client::AsyncEpoll::DIED= sub { push @died, $@ };
+    my $after;
+    $async->timer(sub { die "oops\n" }, 0);
+    $async->timer(sub { $after= 1 }, 0.01);
+    run_for($async, 0.02);
+    is_deeply(\@died, [ "oops\n" ], 'DIED gets the exception');
+    ok($after, 'the loop kept going');
+    is($@, '', '$@ is cleared afterwards');
+}
+{
+    my @warnings;
+    local $SIG{__WARN__}= sub { push @warnings, @_ };
+    $async->timer(sub { die "oops\n" }, 0);
+    run_for($async, 0.01);
+    like($warnings[0], qr/error in callback \(ignoring\): oops/, 'the default DIED warns');
+}
+
+done_testing;
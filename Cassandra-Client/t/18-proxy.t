@@ -0,0 +1,148 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use File::Basename qw//; use lib File::Basename::dirname(__FILE__).'/lib';
+use Test::More;
+use MockCassandra;
+use MockClient;
+use Cassandra::Client;
+use Cassandra::Client::Protocol qw/:constants/;
+use Cassandra::Client::Proxy;
+use File::Temp ();
+use POSIX ();
+use Time::HiRes ();
+
+my $statements= [
+    [ qr/\Aselect id, value from t where id=\?/, {
+        params  => [ [ id => TYPE_INT ] ],
+        columns => [ [ id => TYPE_INT ], [ value => TYPE_VARCHAR ] ],
+        rows    => sub { my ($params, $node)= @_; [ [ unpack('l>', $params->[0]), "node $node" ] ] },
+    } ],
+    [ qr/\Ainsert into t/, { params => [ [ id => TYPE_INT ] ] } ],
+];
+
+my $mock= eval {
+    MockCassandra->new(nodes => 2, statements => $statements)->start;
+} or plan skip_all => "Unable to start the mock server: $@";
+
+my $dir= File::Temp->newdir;
+
+# Runs a proxy in a child process, in front of the given mock
+sub start_proxy {
+    my ($mock, $name)= @_;
+    my $path= "$dir/$name.sock";
+
+    my $pid= fork;
+    die "fork: $!" unless defined $pid;
+    if (!$pid) {
+        $SIG{TERM}= sub { POSIX::_exit(0) };
+        eval {
+            Cassandra::Client::Proxy->new(
+                socket         => $path,
+                contact_points => $mock->contact_points,
+                port           => $mock->port,
+                %loop,
+            )->run;
+            1;
+        } or warn "Proxy died: $@";
+        POSIX::_exit(0);
+    }
+
+    my $deadline= Time::HiRes::time() + 10;
+    Time::HiRes::sleep(0.01) until -S $path || Time::HiRes::time() > $deadline;
+    return ($pid, $path);
+}
+
+sub stop_proxy {
+    my ($pid)= @_;
+    kill 'TERM', $pid;
+    waitpid($pid, 0);
+}
+
+sub worker {
+    my ($path, %args)= @_;
+    my $client= Cassandra::Client->new(proxy => $path, request_timeout => 2, %loop, %args);
+    $client->connect;
+    return $client;
+}
+
+my ($pid, $path)= start_proxy($mock, 'main');
+ok(-S $path, 'proxy is listening');
+
+# Queries, batches and prepared statements go through, and workers share the proxy's statements
+{
+    my $client= worker($path);
+    my ($result)= $client->execute("select id, value from t where id=?", [ 5 ]);
+    is($result->rows->[0][0], 5, 'proxied query');
+    like($result->rows->[0][1], qr/\Anode [12]\z/, 'answered by the cluster');
+
+    $client->batch([ [ "insert into t (id) values (?)", [ 1 ] ], [ "insert into t (id) values (?)", [ 2 ] ] ]);
+    my $stats= $mock->stats($client);
+    is($stats->{batch}, 1, 'proxied batch');
+
+    my $other= worker($path);
+    ($result)= $other->execute("select id, value from t where id=?", [ 6 ]);
+    is($result->rows->[0][0], 6, 'second worker');
+    is($mock->stats($other)->{prepare}, $stats->{prepare}, 'the proxy answered its PREPARE');
+
+    # Request flags are forwarded: the trace ID makes it back to the worker
+    my $traced= $mock->stats($client)->{traced} || 0;
+    ($result)= $client->execute("select id, value from t where id=?", [ 7 ], { tracing => 1 });
+    like($result->trace_id, qr/\A[0-9a-f]{8}-/, 'tracing through the proxy');
+    is($mock->stats($client)->{traced}, $traced + 1, 'the server got the tracing flag');
+    ($result)= $client->execute("select id, value from t where id=?", [ 7 ]);
+    ok(!defined $result->trace_id, 'untraced queries stay untraced');
+
+    # Errors
+    my ($error)= $client->call_execute("select nothing from nowhere");
+    like($error, qr/Unknown statement/, 'errors are relayed');
+    is(eval { $error->code }, 0x2200, 'with their error code');
+
+    my ($use_error)= $client->call_execute("use other_keyspace");
+    like($use_error, qr/USE is not supported/, 'USE is refused');
+
+    $mock->forget_prepared($client);
+    ($error, $result)= $client->call_execute("select id, value from t where id=?", [ 8 ]);
+    ok(!$error, 'the proxy prepares statements the cluster forgot about');
+    is($result->rows->[0][0], 8, 'and runs them');
+
+    $other->shutdown;
+
+    # A worker that goes away with queries in flight doesn't take the proxy with it
+    my $leaving= worker($path);
+    $leaving->future_call_execute("select id, value from t where id=?", [ $_ ]) for 1..5;
+    $leaving->shutdown;
+    ($error, $result)= $client->call_execute("select id, value from t where id=?", [ 9 ]);
+    ok(!$error, 'the proxy survives a worker disconnecting');
+    is($result->rows->[0][0], 9, 'and keeps serving the others');
+
+    $client->shutdown;
+}
+
+# Errors with details (here: unavailable) reach the worker as the server sent them
+{
+    my $failing= MockCassandra->new(nodes => 1, statements => $statements, errors => { unavailable => 1 })->start;
+    my ($failing_pid, $failing_path)= start_proxy($failing, 'failing');
+    my $client= worker($failing_path);
+    my ($error)= $client->call_execute("select id, value from t where id=?", [ 1 ]);
+    is(eval { $error->code }, 0x1000, 'unavailable error is relayed');
+    is(eval { $error->{required} }, 1, 'with its details');
+    $client->shutdown;
+    stop_proxy($failing_pid);
+    $failing->stop;
+}
+
+# When the proxy goes away, queries fail instead of hanging
+{
+    local $SIG{PIPE}= 'IGNORE';
+    my $client= worker($path);
+    stop_proxy($pid);
+    my $start= Time::HiRes::time();
+    my ($error)= $client->call_execute("select id, value from t where id=?", [ 1 ]);
+    ok($error, 'queries fail once the proxy is gone');
+    ok(Time::HiRes::time() - $start < 5, 'and quickly');
+    $client->shutdown;
+}
+
+done_testing;
@@ -0,0 +1,128 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use File::Basename qw//; use lib File::Basename::dirname(__FILE__).'/lib';
+use Test::More;
+use MockCassandra;
+use Cassandra::Client;
+use Cassandra::Client::Protocol qw/:constants/;
+use Time::HiRes ();
+
+# Load generator against MockCassandra: keeps a fixed number of queries in flight and reports
+# throughput and latency percentiles, so pool, retry, throttling and queueing behaviour can be
+# compared without a cluster.
+#
+#   MOCK_LOAD=1                    run it
+#   MOCK_LOAD_REQUESTS=5000        queries per scenario
+#   MOCK_LOAD_CONCURRENCY=100      queries in flight
+#   MOCK_LOAD_SCENARIO=regex       only run matching scenarios
+#   MOCK_LOAD_LOOP=epoll|anyevent  event loop for the client (default: the client's default)
+
+plan skip_all => "Set MOCK_LOAD=1 to run the load generator" unless $ENV{MOCK_LOAD};
+
+my $requests= $ENV{MOCK_LOAD_REQUESTS} || 5000;
+my $concurrency= $ENV{MOCK_LOAD_CONCURRENCY} || 100;
+my $filter= $ENV{MOCK_LOAD_SCENARIO};
+my %loop= (
+    ($ENV{MOCK_LOAD_LOOP} // '') eq 'epoll'    ? (epoll => 1) :
+    ($ENV{MOCK_LOAD_LOOP} // '') eq 'anyevent' ? (anyevent => 1) :
+    ()
+);
+
+my @statements= (
+    [ qr/\Aselect id, value from t where id=\?/, {
+        params  => [ [ id => TYPE_INT ] ],
+        columns => [ [ id => TYPE_INT ], [ value => TYPE_VARCHAR ] ],
+        rows    => [ [ 1, "value" ] ],
+    } ],
+);
+
+my @scenarios= (
+    [ 'baseline, 1 node' => { nodes => 1 }, {} ],
+    [ 'baseline, 3 nodes' => { nodes => 3 }, {} ],
+    [ 'log-normal latency' => { nodes => 3, latency => { median => 0.001, p99 => 0.010 } }, {} ],
+    [ 'one slow node' => { nodes => 3, latency => sub { $_[1] == 1 ? 0.020 : 0.001 } }, {} ],
+    [ '1% unavailable' => { nodes => 3, errors => { unavailable => 0.01 } }, {} ],
+    [ '1% overloaded' => { nodes => 3, errors => { overloaded => 0.01 } }, {} ],
+    [ '1% unprepared' => { nodes => 3, errors => { unprepared => 0.01 } }, {} ],
+    [ '0.1% dropped' => { nodes => 3, errors => { drop => 0.001 } }, { request_timeout => 0.5 } ],
+);
+
+sub percentile {
+    my ($sorted, $p)= @_;
+    return 0 unless @$sorted;
+    my $i= int($p * @$sorted);
+    $i= $#$sorted if $i > $#$sorted;
+    return $sorted->[$i];
+}
+
+sub run_load {
+    my ($client)= @_;
+
+    my (@latencies, %errors);
+    my ($started, $completed)= (0, 0);
+    my $finish= $client->{async_io}->wait(my $run);
+
+    my $issue;
+    $issue= sub {
+        return if $started >= $requests;
+        my $id= $started++;
+        my $t0= Time::HiRes::time();
+        $client->_execute(sub {
+            my ($error)= @_;
+            push @latencies, Time::HiRes::time() - $t0;
+            if ($error) {
+                (my $kind= "$error") =~ s/\n.*//s;
+                $kind= substr($kind, 0, 60);
+                $errors{$kind}++;
+            }
+            $completed++;
+            if ($completed == $requests) {
+                $finish->();
+            } else {
+                $issue->();
+            }
+        }, "select id, value from t where id=?", [ $id ]);
+    };
+
+    my $t0= Time::HiRes::time();
+    $issue->() for 1..$concurrency;
+    $run->();
+    my $elapsed= Time::HiRes::time() - $t0;
+    undef $issue;
+
+    return (\@latencies, \%errors, $elapsed);
+}
+
+for my $scenario (@scenarios) {
+    my ($name, $mock_args, $client_args)= @$scenario;
+    next if $filter && $name !~ /$filter/;
+
+    my $mock= MockCassandra->new(%$mock_args, statements => \@statements)->start;
+    my $client= Cassandra::Client->new(
+        contact_points          => $mock->contact_points,
+        port                    => $mock->port,
+        max_concurrent_queries  => $concurrency,
+        %loop,
+        %$client_args,
+    );
+    $client->connect;
+    $client->execute("select id, value from t where id=?", [ 0 ]); # Prepare
+
+    my ($latencies, $errors, $elapsed)= run_load($client);
+    my @sorted= sort { $a <=> $b } @$latencies;
+    my $error_count= 0;
+    $error_count += $_ for values %$errors;
+
+    ok(@sorted == $requests, sprintf("%-20s %8.0f q/s  p50 %7.2fms  p99 %7.2fms  p999 %7.2fms  max %7.2fms  errors %d",
+        $name, $requests / $elapsed,
+        1000 * percentile(\@sorted, 0.5), 1000 * percentile(\@sorted, 0.99), 1000 * percentile(\@sorted, 0.999),
+        1000 * $sorted[-1], $error_count));
+    diag sprintf("  %5d x %s", $errors->{$_}, $_) for sort keys %$errors;
+
+    $client->shutdown;
+    $mock->stop;
+}
+
+done_testing;
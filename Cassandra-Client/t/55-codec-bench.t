@@ -0,0 +1,209 @@
+#!perl
+use 5.010;
+use strict;
+use warnings;
+use Test::More;
+use Cassandra::Client;
+use Cassandra::Client::Connection;
+use Cassandra::Client::Metadata;
+use Cassandra::Client::Protocol qw/:constants pack_int pack_metadata unpack_metadata/;
+use IO::Handle;
+use JSON::PP ();
+use Socket qw/AF_UNIX SOCK_STREAM PF_UNSPEC/;
+use Time::HiRes ();
+
+# Codec benchmarks that don't need a Cassandra server. Reports rows/sec and allocated SVs per row
+# for encoding and decoding of each type, collection shape and row width, as well as for the
+# response path (frame parsing, metadata and decoding) and compression.
+#
+#   CODEC_BENCH=1                  run the benchmarks
+#   CODEC_BENCH_TIME=0.5           seconds to spend on each benchmark
+#   CODEC_BENCH_FILTER=regex       only run matching benchmarks
+#   CODEC_BENCH_SAVE=file          store the results as a baseline
+#   CODEC_BENCH_BASELINE=file      compare against a stored baseline, failing on regressions
+#   CODEC_BENCH_TOLERANCE=0.25     fraction of the baseline's throughput we may lose
+
+plan skip_all => "Set CODEC_BENCH=1 to run the codec benchmarks" unless $ENV{CODEC_BENCH};
+
+my $min_time= $ENV{CODEC_BENCH_TIME} || 0.5;
+my $filter= $ENV{CODEC_BENCH_FILTER};
+my %results;
+
+sub bench {
+    my ($name, $rows_per_call, $code)= @_;
+    return if $filter && $name !~ /$filter/;
+
+    # Warm up, then count the SVs that stay alive in the result of a single call
+    $code->() for 1..3;
+    my $before= Cassandra::Client::_sv_count();
+    my $kept= $code->();
+    my $svs= Cassandra::Client::_sv_count() - $before;
+    undef $kept;
+
+    my ($calls, $batch, $elapsed)= (0, 1, 0);
+    $before= Cassandra::Client::_sv_count();
+    my $t0= Time::HiRes::time();
+    while ($elapsed < $min_time) {
+        $code->() for 1..$batch;
+        $calls += $batch;
+        $batch *= 2 if $batch < 1024;
+        $elapsed= Time::HiRes::time() - $t0;
+    }
+    my $leaked= Cassandra::Client::_sv_count() - $before;
+
+    my $rate= $calls * $rows_per_call / $elapsed;
+    $results{$name}= { rows_per_sec => $rate, svs_per_row => $svs / $rows_per_call };
+    ok($leaked < $calls, sprintf("%-36s %12.0f rows/s %8.1f SVs/row", $name, $rate, $svs / $rows_per_call))
+        or diag("$name leaked $leaked SVs in $calls calls");
+}
+
+sub rowmeta {
+    my ($types)= @_;
+    my $i= 0;
+    my ($rowmeta)= unpack_metadata(4, 1, pack_metadata(4, 1, {
+        columns => [ map { [ 'schema', 'table', 'c'.($i++), $_ ] } @$types ],
+    }));
+    return $rowmeta;
+}
+
+# A RESULT body holding the given rows, minus the result kind
+sub rows_body {
+    my ($rowmeta, $rows)= @_;
+    my $body= pack_int(0+@$rows);
+    for my $row (@$rows) {
+        $body .= substr($rowmeta->encode($row), 2);
+    }
+    return $body;
+}
+
+sub bench_codec {
+    my ($name, $types, $row)= @_;
+    my $rowmeta= rowmeta($types);
+    my $rows= [ ($row) x 100 ];
+    my $body= rows_body($rowmeta, $rows);
+
+    bench("encode $name", 1, sub { $rowmeta->encode($row) });
+    bench("decode $name", 100, sub { $rowmeta->decode($body, 0) });
+    bench("decode hashes $name", 100, sub { $rowmeta->decode($body, 1) });
+}
+
+# Primitive types, ten columns each
+my @primitives= (
+    [ int       => TYPE_INT,       123456 ],
+    [ bigint    => TYPE_BIGINT,    "1234567890123" ],
+    [ varchar   => TYPE_VARCHAR,   "some text value" ],
+    [ blob      => TYPE_BLOB,      "\0\1\2\3" x 8 ],
+    [ boolean   => TYPE_BOOLEAN,   1 ],
+    [ double    => TYPE_DOUBLE,    3.14159 ],
+    [ float     => TYPE_FLOAT,     2.5 ],
+    [ uuid      => TYPE_UUID,      "01234567-89ab-cdef-0123-456789abcdef" ],
+    [ timestamp => TYPE_TIMESTAMP, "1500000000000" ],
+    [ inet      => TYPE_INET,      "192.168.0.1" ],
+    [ date      => TYPE_DATE,      "2020-02-29" ],
+    [ time      => TYPE_TIME,      "12:34:56.789" ],
+    [ decimal   => TYPE_DECIMAL,   "12345.6789" ],
+    [ varint    => TYPE_VARINT,    "1234567" ],
+    [ bigvarint => TYPE_VARINT,    "123456789012345678901234567890123456789" ],
+    [ bigdecimal => TYPE_DECIMAL,  "1234567890123456789012345678901234.56789" ],
+);
+for my $primitive (@primitives) {
+    my ($name, $type, $value)= @$primitive;
+    bench_codec("10x $name", [ ([ $type ]) x 10 ], [ ($value) x 10 ]);
+}
+
+# Row widths
+for my $width (1, 10, 50) {
+    bench_codec("${width}x int+varchar", [ ([ TYPE_INT ], [ TYPE_VARCHAR ]) x $width ], [ (42, "hello world") x $width ]);
+}
+
+# Collection shapes
+bench_codec("list<int>[10]", [ [ TYPE_LIST, [ TYPE_INT ] ] ], [ [ 1..10 ] ]);
+bench_codec("list<int>[1000]", [ [ TYPE_LIST, [ TYPE_INT ] ] ], [ [ 1..1000 ] ]);
+bench_codec("set<varchar>[10]", [ [ TYPE_SET, [ TYPE_VARCHAR ] ] ], [ [ map { "value $_" } 1..10 ] ]);
+bench_codec("map<varchar,int>[10]", [ [ TYPE_MAP, [ TYPE_VARCHAR ], [ TYPE_INT ] ] ], [ { map { ("key $_" => $_) } 1..10 } ]);
+bench_codec("map<varchar,varchar>[200]", [ [ TYPE_MAP, [ TYPE_VARCHAR ], [ TYPE_VARCHAR ] ] ], [ { map { ("attribute $_" => "value $_") } 1..200 } ]);
+bench_codec("map<int,list<int>>[10]", [ [ TYPE_MAP, [ TYPE_INT ], [ TYPE_LIST, [ TYPE_INT ] ] ] ], [ { map { ($_ => [ 1..5 ]) } 1..10 } ]);
+bench_codec("tuple<int,varchar,double>", [ [ TYPE_TUPLE, [ [ TYPE_INT ], [ TYPE_VARCHAR ], [ TYPE_DOUBLE ] ] ] ], [ [ 1, "two", 3.5 ] ]);
+bench_codec("udt{a,b,c}", [ [ TYPE_UDT, 'schema', 'udt', [ [ a => [ TYPE_INT ] ], [ b => [ TYPE_VARCHAR ] ], [ c => [ TYPE_BIGINT ] ] ] ] ], [ { a => 1, b => "two", c => 3 } ]);
+
+# Response path: frame parsing, result metadata and decoding, through Connection::can_read
+{
+    my $rowmeta= rowmeta([ [ TYPE_INT ], [ TYPE_VARCHAR ], [ TYPE_DOUBLE ] ]);
+    my $metadata= pack_metadata(4, 1, { columns => [
+        [ 'schema', 'table', 'id', [ TYPE_INT ] ],
+        [ 'schema', 'table', 'name', [ TYPE_VARCHAR ] ],
+        [ 'schema', 'table', 'value', [ TYPE_DOUBLE ] ],
+    ] });
+    my $body= pack_int(RESULT_ROWS).$metadata.rows_body($rowmeta, [ map { [ $_, "name $_", $_ / 3 ] } 1..10 ]);
+    my $frames= join '', map { pack('CCsCN/a', 0x84, 0, $_, OPCODE_RESULT, $body) } 0..99;
+
+    socketpair(my $sock, my $other, AF_UNIX, SOCK_STREAM, PF_UNSPEC) or die "socketpair: $!";
+    $sock->blocking(0);
+
+    my $connection= Cassandra::Client::Connection->new(
+        options  => { request_timeout => 10, protocol_version => 4 },
+        metadata => Cassandra::Client::Metadata->new,
+        host     => 'localhost',
+    );
+    $connection->{socket}= $sock;
+    $connection->{protocol_version}= 4;
+
+    my $row_count= 0;
+    my $on_result= sub {
+        my ($error, $opcode)= @_;
+        die $error if $error;
+        $connection->decode_result(sub { $row_count += @{$_[1]->rows} }, undef, $_[2]);
+    };
+
+    bench("parse+decode 100 frames x 10 rows", 1000, sub {
+        # A fresh table hands out stream IDs 0..99, matching our frames
+        my $streams= $connection->{streams}= Cassandra::Client::StreamTablePtr->new(32768);
+        $streams->acquire($on_result) for 0..99;
+        ${$connection->{read_buffer}}= $frames;
+        $connection->can_read;
+        return;
+    });
+}
+
+# Compression, as done by Connection for outgoing and incoming frames
+{
+    my $rowmeta= rowmeta([ [ TYPE_INT ], [ TYPE_VARCHAR ] ]);
+    my $payload= rows_body($rowmeta, [ map { [ $_, "some fairly repetitive text $_" ] } 1..2000 ]);
+    my %available= (
+        lz4    => scalar eval { require Compress::LZ4; 1 },
+        snappy => scalar eval { require Compress::Snappy; 1 },
+    );
+    for my $type (qw/lz4 snappy/) {
+        next unless $available{$type};
+        my $compress= Cassandra::Client::Connection->can("compress_$type");
+        my $decompress= Cassandra::Client::Connection->can("decompress_$type");
+        my $compressed= $payload;
+        $compress->($compressed);
+
+        bench("compress $type 2000 rows", 2000, sub { my $data= $payload; $compress->($data); return; });
+        bench("decompress $type 2000 rows", 2000, sub { my $data= $compressed; $decompress->($data); return; });
+    }
+}
+
+if (my $file= $ENV{CODEC_BENCH_SAVE}) {
+    open my $fh, '>', $file or die "Unable to write $file: $!";
+    print $fh JSON::PP->new->canonical->pretty->encode(\%results);
+    close $fh;
+    note "Saved baseline to $file";
+}
+
+if (my $file= $ENV{CODEC_BENCH_BASELINE}) {
+    open my $fh, '<', $file or die "Unable to read $file: $!";
+    my $baseline= JSON::PP->new->decode(do { local $/; <$fh> });
+    close $fh;
+
+    my $tolerance= $ENV{CODEC_BENCH_TOLERANCE} // 0.25;
+    for my $name (sort keys %results) {
+        my $old= $baseline->{$name} or next;
+        my $ratio= $results{$name}{rows_per_sec} / $old->{rows_per_sec};
+        ok($ratio >= 1 - $tolerance, sprintf("%-36s %+6.1f%% rows/s, %+.1f SVs/row vs baseline",
+            $name, ($ratio - 1) * 100, $results{$name}{svs_per_row} - $old->{svs_per_row}));
+    }
+}
+
+done_testing;
@@ -0,0 +1,483 @@
+package MockCassandra;
+
+# A small stand-in for a Cassandra cluster, speaking native protocol v4. It runs in a forked
+# child, answers the handshake, system.local/system.peers and whatever statements the test
+# registers, and can add latency and inject errors.
+#
+#   my $mock= MockCassandra->new(
+#       nodes      => 3,                                   # listens on 127.0.0.1 .. 127.0.0.3
+#       latency    => { median => 0.001, p99 => 0.010 },   # see _latency
+#       errors     => { unavailable => 0.01, unprepared => 0.001, drop => 0.0001 },
+#       shards     => 4,                                   # like Scylla, see _shard
+#       statements => [
+#           [ qr/select value from t where id=\?/, { params => [ [ id => TYPE_INT ] ], columns => [ [ value => TYPE_VARCHAR ] ], rows => [ [ "x" ] ] } ],
+#       ],
+#   )->start;
+#   my $client= Cassandra::Client->new(contact_points => $mock->contact_points, port => $mock->port);
+
+use 5.010;
+use strict;
+use warnings;
+
+use Digest::MD5 qw/md5/;
+use Errno qw/EAGAIN EINTR/;
+use IO::Select;
+use IO::Socket::INET;
+use POSIX ();
+use Time::HiRes ();
+
+use Cassandra::Client;
+use Cassandra::Client::Protocol qw/
+    :constants
+    pack_int
+    pack_metadata
+    pack_shortbytes
+    pack_string
+    pack_stringmultimap
+    unpack_metadata
+/;
+
+# Injectable errors, and the body each one is sent with. 'unprepared' and 'drop' are special:
+# the former also makes the node forget the statement, the latter never sends a response at all.
+my %error_body= (
+    unavailable   => sub { (0x1000, pack('nl>l>', 1, 1, 0)) },
+    overloaded    => sub { (0x1001, '') },
+    write_timeout => sub { (0x1100, pack('nl>l>', 1, 0, 1).pack_string('SIMPLE')) },
+    read_timeout  => sub { (0x1200, pack('nl>l>C', 1, 0, 1, 0)) },
+    server_error  => sub { (0x0000, '') },
+);
+
+sub new {
+    my ($class, %args)= @_;
+
+    my $errors= $args{errors} || {};
+    for (keys %$errors) {
+        die "Unknown error type: $_" unless $error_body{$_} || $_ eq 'unprepared' || $_ eq 'drop';
+    }
+
+    my $self= bless {
+        nodes       => $args{nodes} || 1,
+        datacenter  => $args{datacenter} || 'dc1',
+        racks       => $args{racks} || [ 'rack1' ],
+        statements  => [],
+        latency     => $args{latency},
+        errors      => $errors,
+        supported   => $args{supported} || {},
+        shards      => $args{shards} || 0,
+        stats       => {},
+        prepared    => {}, # Per node and shared by its connections, like Cassandra's
+        traces      => {},
+        port        => undef,
+        pid         => undef,
+    }, $class;
+
+    $self->statement(qr/\A\s*select .* from system\.local/si, columns => [
+        [ key => TYPE_VARCHAR ], [ data_center => TYPE_VARCHAR ], [ host_id => TYPE_UUID ],
+        [ broadcast_address => TYPE_INET ], [ rack => TYPE_VARCHAR ], [ release_version => TYPE_VARCHAR ],
+        [ tokens => [ TYPE_SET, [ TYPE_VARCHAR ] ] ], [ schema_version => TYPE_UUID ],
+    ], rows => sub {
+        my ($params, $node)= @_;
+        return [ $self->_node_row($node, 'local') ];
+    });
+    $self->statement(qr/\A\s*select .* from system\.peers/si, columns => [
+        [ peer => TYPE_INET ], [ data_center => TYPE_VARCHAR ], [ host_id => TYPE_UUID ],
+        [ preferred_ip => TYPE_INET ], [ rack => TYPE_VARCHAR ], [ release_version => TYPE_VARCHAR ],
+        [ tokens => [ TYPE_SET, [ TYPE_VARCHAR ] ] ], [ schema_version => TYPE_UUID ],
+    ], rows => sub {
+        my ($params, $node)= @_;
+        return [ map { $self->_node_row($_) } grep { $_ != $node } 1..$self->{nodes} ];
+    });
+
+    # The server runs in another process, so it reports its counters through a query
+    $self->statement(qr/\A\s*select .* from mock\.stats/si, columns => [
+        [ name => TYPE_VARCHAR ], [ value => TYPE_BIGINT ],
+    ], rows => sub {
+        return [ map { [ $_, $self->{stats}{$_} ] } sort keys %{$self->{stats}} ];
+    });
+    $self->statement(qr/\A\s*select .* from mock\.forget_prepared/si, columns => [
+        [ forgotten => TYPE_INT ],
+    ], rows => sub {
+        my $forgotten= 0;
+        $forgotten += keys %$_ for values %{$self->{prepared}};
+        %{$self->{prepared}}= ();
+        return [ [ $forgotten ] ];
+    });
+
+    # Traced requests. The session is complete from the second time it's looked at, as the
+    # server writes traces in the background.
+    $self->statement(qr/\A\s*select .* from system_traces\.sessions/si, params => [ [ session_id => TYPE_UUID ] ], columns => [
+        [ coordinator => TYPE_INET ], [ duration => TYPE_INT ], [ request => TYPE_VARCHAR ],
+        [ parameters => [ TYPE_MAP, [ TYPE_VARCHAR ], [ TYPE_VARCHAR ] ] ], [ started_at => TYPE_TIMESTAMP ],
+    ], rows => sub {
+        my ($params)= @_;
+        my $trace= $self->{traces}{$params->[0]} or return [];
+        return [ [ $self->address($trace->{node}), ($trace->{lookups}++ ? 1234 : undef), 'Execute CQL3 query', { query => $trace->{query} }, 1700000000000 ] ];
+    });
+    $self->statement(qr/\A\s*select .* from system_traces\.events/si, params => [ [ session_id => TYPE_UUID ] ], columns => [
+        [ activity => TYPE_VARCHAR ], [ source => TYPE_INET ], [ source_elapsed => TYPE_INT ], [ thread => TYPE_VARCHAR ],
+    ], rows => sub {
+        my ($params)= @_;
+        my $trace= $self->{traces}{$params->[0]} or return [];
+        return [
+            [ 'Parsing '.$trace->{query}, $self->address($trace->{node}), 100, 'Native-Transport-Requests-1' ],
+            [ 'Read 1 live rows', $self->address($trace->{node}), 900, 'ReadStage-2' ],
+        ];
+    });
+
+    $self->statement($_->[0], %{$_->[1]}) for @{$args{statements} || []};
+
+    return $self;
+}
+
+# Registers a statement: queries matching $match get the given bind parameters and result columns.
+# rows => sub { my ($params, $node_number, $shard)= @_; return [ [...], ... ] }, or an arrayref of rows.
+# pk => [ ... ] lists the bind parameters that make up the partition key. Statements without
+# columns return a VOID result. Must be called before start().
+sub statement {
+    my ($self, $match, %spec)= @_;
+    unshift @{$self->{statements}}, { match => $match, params => [], columns => [], %spec };
+    return $self;
+}
+
+sub address {
+    my ($self, $node)= @_;
+    return "127.0.0.".(($node || 1) + 0);
+}
+
+sub contact_points {
+    my ($self)= @_;
+    return [ map { $self->address($_) } 1..$self->{nodes} ];
+}
+
+sub port { $_[0]{port} }
+
+# Fetches the server's counters (requests, options, prepare, execute, query, batch, and one per
+# injected error) through the given client
+sub stats {
+    my ($self, $client)= @_;
+    my ($result)= $client->execute("select name, value from mock.stats");
+    return { map { @$_ } @{$result->rows} };
+}
+
+# Makes every node forget its prepared statements, as if it restarted
+sub forget_prepared {
+    my ($self, $client)= @_;
+    $client->execute("select forgotten from mock.forget_prepared");
+    return;
+}
+
+sub _node_row {
+    my ($self, $node, $local)= @_;
+    my $racks= $self->{racks};
+    my @tokens= map { "".(($node * 1000 + $_) * 1000000000000) } 1..4;
+    return [
+        ($local ? 'local' : $self->address($node)),
+        $self->{datacenter},
+        sprintf('00000000-0000-0000-0000-%012d', $node),
+        $self->address($node),
+        $racks->[($node-1) % @$racks],
+        '4.0.0',
+        \@tokens,
+        '00000000-0000-0000-0000-000000000001',
+    ];
+}
+
+sub start {
+    my ($self)= @_;
+
+    my @listeners;
+    my $port= 0;
+    for my $node (1..$self->{nodes}) {
+        my $listener= IO::Socket::INET->new(
+            LocalAddr => $self->address($node),
+            LocalPort => $port,
+            Listen    => 128,
+            ReuseAddr => 1,
+            Proto     => 'tcp',
+        ) or die "Unable to listen on ".$self->address($node).": $!";
+        $port ||= $listener->sockport;
+        push @listeners, [ $listener, $node ];
+    }
+    $self->{port}= $port;
+
+    my $pid= fork;
+    die "fork: $!" unless defined $pid;
+    if ($pid) {
+        $self->{pid}= $pid;
+        $self->{owner}= $$;
+        $_->[0]->close for @listeners;
+        return $self;
+    }
+
+    $SIG{TERM}= sub { POSIX::_exit(0) };
+    eval { $self->_serve(\@listeners); 1 } or warn "MockCassandra died: $@";
+    POSIX::_exit(0);
+}
+
+sub stop {
+    my ($self)= @_;
+    if (my $pid= delete $self->{pid}) {
+        kill 'TERM', $pid;
+        waitpid($pid, 0);
+    }
+    return;
+}
+
+sub DESTROY {
+    local ($@, $?);
+    $_[0]->stop if $_[0]{pid} && $_[0]{owner} == $$;
+}
+
+# Seconds to wait before answering. The latency option is one of:
+#   0.002                           fixed
+#   [ 0.001, 0.003 ]                uniform between the two
+#   { median => 0.001, p99 => 0.02 }  log-normal, for a realistic long tail
+#   sub { my ($opcode, $node, $query)= @_; ... }  anything else, such as a single slow node or statement
+sub _latency {
+    my ($self, $opcode, $node, $query)= @_;
+    my $latency= $self->{latency};
+    return 0 unless $latency;
+    return $latency->($opcode, $node, $query) if ref $latency eq 'CODE';
+    return $latency->[0] + rand($latency->[1] - $latency->[0]) if ref $latency eq 'ARRAY';
+    if (ref $latency eq 'HASH') {
+        my $sigma= log($latency->{p99} / $latency->{median}) / 2.326;
+        my $normal= sqrt(-2 * log(1 - rand())) * cos(2 * 3.14159265358979 * rand());
+        return $latency->{median} * exp($sigma * $normal);
+    }
+    return $latency;
+}
+
+sub _serve {
+    my ($self, $listeners)= @_;
+
+    my $select= IO::Select->new;
+    my %node_of;
+    my %conns;
+    for (@$listeners) {
+        $_->[0]->blocking(0);
+        $select->add($_->[0]);
+        $node_of{$_->[0]->fileno}= $_->[1];
+    }
+    my %is_listener= map { $_->[0]->fileno => 1 } @$listeners;
+
+    my @delayed; # [ time, conn, data ]
+
+    while (1) {
+        my $timeout= @delayed ? $delayed[0][0] - Time::HiRes::time() : undef;
+        $timeout= 0 if defined $timeout && $timeout < 0;
+
+        my @ready= $select->can_read($timeout);
+        for my $fh (@ready) {
+            if ($is_listener{$fh->fileno}) {
+                while (my $client= $fh->accept) {
+                    $client->blocking(0);
+                    $select->add($client);
+                    $conns{$client->fileno}= { fh => $client, buffer => '', node => $node_of{$fh->fileno}, shard => $self->_shard($client) };
+                }
+                next;
+            }
+
+            my $conn= $conns{$fh->fileno};
+            my $read= sysread($fh, $conn->{buffer}, 65536, length $conn->{buffer});
+            if (!$read) {
+                next if !defined($read) && ($! == EAGAIN || $! == EINTR);
+                $select->remove($fh);
+                delete $conns{$fh->fileno};
+                $fh->close;
+                $conn->{closed}= 1;
+                next;
+            }
+
+            while (length($conn->{buffer}) >= 9) {
+                my ($version, $flags, $stream, $opcode, $length)= unpack('CCsCN', $conn->{buffer});
+                last if length($conn->{buffer}) < 9 + $length;
+                substr($conn->{buffer}, 0, 9, '');
+                my $body= substr($conn->{buffer}, 0, $length, '');
+
+                $self->{stats}{requests}++;
+                my ($rop, $rbody)= $self->_respond($conn, $opcode, $body);
+                next unless defined $rop; # Dropped
+
+                my $rflags= 0;
+                if ($flags & 0x02) {
+                    # Tracing: the response starts with the session ID. Only successful requests are
+                    # counted, as a traced query that gets UNPREPARED on a new node is retried.
+                    $self->{stats}{traced}++ unless $rop == OPCODE_ERROR;
+                    my $id= md5(rand().$self->{stats}{requests});
+                    $self->{traces}{$id}= { node => $conn->{node}, query => $conn->{last_query} // '' };
+                    $rbody= $id.$rbody;
+                    $rflags |= 0x02;
+                }
+                my $data= pack('CCsCN/a', 0x80 | $version, $rflags, $stream, $rop, $rbody);
+
+                my $query= ($opcode == OPCODE_QUERY || $opcode == OPCODE_EXECUTE) ? $conn->{last_query} : undef;
+                my $latency= ($opcode == OPCODE_STARTUP || $opcode == OPCODE_OPTIONS) ? 0 : $self->_latency($opcode, $conn->{node}, $query);
+                if ($latency > 0) {
+                    my $at= Time::HiRes::time() + $latency;
+                    my $i= @delayed;
+                    $i-- while $i > 0 && $delayed[$i-1][0] > $at;
+                    splice @delayed, $i, 0, [ $at, $conn, $data ];
+                } else {
+                    _write($conn, $data);
+                }
+            }
+        }
+
+        my $now= Time::HiRes::time();
+        while (@delayed && $delayed[0][0] <= $now) {
+            my (undef, $conn, $data)= @{shift @delayed};
+            _write($conn, $data) unless $conn->{closed};
+        }
+    }
+}
+
+# With shards, every port is a shard-aware port as Scylla has them: connections go to the shard
+# that their source port maps to
+sub _shard {
+    my ($self, $client)= @_;
+    return undef unless $self->{shards};
+    return $client->peerport % $self->{shards};
+}
+
+sub _write {
+    my ($conn, $data)= @_;
+    $conn->{fh}->blocking(1);
+    syswrite($conn->{fh}, $data) // warn "write: $!";
+    $conn->{fh}->blocking(0);
+}
+
+sub _error {
+    my ($code, $message, $extra)= @_;
+    return (OPCODE_ERROR, pack_int($code).pack_string($message).($extra // ''));
+}
+
+sub _find_statement {
+    my ($self, $query)= @_;
+    for my $statement (@{$self->{statements}}) {
+        return $statement if $query =~ $statement->{match};
+    }
+    return;
+}
+
+sub _metadata {
+    my ($columns, $is_result, $pk)= @_;
+    my $meta= pack_metadata(4, 1, {
+        columns => [ map { [ 'ks', 'table', $_->[0], (ref $_->[1] ? $_->[1] : [ $_->[1] ]) ] } @$columns ],
+    });
+    return $meta if $is_result;
+
+    # Prepared statement metadata has a partition key index list after the column count
+    substr($meta, 8, 0, pack('l>n*', 0+@{$pk || []}, @{$pk || []}));
+    return $meta;
+}
+
+# Picks an error to inject, if any. Rates can also be a coderef($node), to single out nodes.
+sub _injected_error {
+    my ($self, $node)= @_;
+    my $errors= $self->{errors};
+    for my $type (sort keys %$errors) {
+        my $rate= ref $errors->{$type} ? $errors->{$type}->($node) : $errors->{$type};
+        return $type if rand() < $rate;
+    }
+    return;
+}
+
+sub _respond {
+    my ($self, $conn, $opcode, $body)= @_;
+
+    if ($opcode == OPCODE_OPTIONS) {
+        $self->{stats}{options}++;
+        return (OPCODE_SUPPORTED, pack_stringmultimap({
+            CQL_VERSION => [ '3.4.5' ],
+            COMPRESSION => [],
+            ($self->{shards} ? (
+                SCYLLA_SHARD => [ $conn->{shard} ],
+                SCYLLA_NR_SHARDS => [ $self->{shards} ],
+                SCYLLA_SHARDING_ALGORITHM => [ 'biased-token-round-robin' ],
+                SCYLLA_SHARDING_IGNORE_MSB => [ 12 ],
+                SCYLLA_SHARD_AWARE_PORT => [ $self->{port} ],
+            ) : ()),
+            %{$self->{supported}},
+        }));
+    }
+    return (OPCODE_READY, '') if $opcode == OPCODE_STARTUP || $opcode == OPCODE_REGISTER;
+
+    if ($opcode == OPCODE_PREPARE) {
+        $self->{stats}{prepare}++;
+        my $query= unpack('l>/a', $body);
+        my $statement= $self->_find_statement($query);
+        return _error(0x2200, "Unknown statement: $query") unless $statement || $query =~ /\A\s*use\s/i;
+        $statement ||= { params => [], columns => [] };
+
+        my $id= md5($query);
+        $self->{prepared}{$conn->{node}}{$id}= $query;
+        return (OPCODE_RESULT, pack_int(RESULT_PREPARED).pack_shortbytes($id)
+            ._metadata($statement->{params}, 0, $statement->{pk})
+            ._metadata($statement->{columns}, 1));
+    }
+
+    my ($query, $values, $id);
+    if ($opcode == OPCODE_EXECUTE) {
+        $self->{stats}{execute}++;
+        $id= unpack('n/a', $body);
+        $query= $self->{prepared}{$conn->{node}}{$id};
+        return _error(0x2500, "Prepared statement not found", pack_shortbytes($id)) unless $query;
+        $values= substr($body, 2 + length $id);
+    } elsif ($opcode == OPCODE_QUERY) {
+        $self->{stats}{query}++;
+        $query= unpack('l>/a', $body);
+        $values= substr($body, 4 + length $query);
+    } elsif ($opcode == OPCODE_BATCH) {
+        $self->{stats}{batch}++;
+        return (OPCODE_RESULT, pack_int(RESULT_VOID));
+    } else {
+        return _error(0x000A, "Unsupported opcode $opcode");
+    }
+
+    $conn->{last_query}= $query;
+    if ($query =~ /\A\s*use\s+"?(\w+)"?/i) {
+        return (OPCODE_RESULT, pack_int(RESULT_SET_KEYSPACE).pack_string($1));
+    }
+
+    # Leave the client's own bookkeeping alone, so it can always connect
+    if ($query !~ /\bfrom\s+(?:system|mock)\./i and my $error= $self->_injected_error($conn->{node})) {
+        $self->{stats}{$error}++;
+        return if $error eq 'drop';
+        if ($error eq 'unprepared') {
+            return (OPCODE_RESULT, pack_int(RESULT_VOID)) unless defined $id;
+            delete $self->{prepared}{$conn->{node}}{$id};
+            return _error(0x2500, "Prepared statement not found", pack_shortbytes($id));
+        }
+        my ($code, $extra)= $error_body{$error}->();
+        return _error($code, "Injected $error", $extra);
+    }
+
+    my $statement= $self->_find_statement($query) or return _error(0x2200, "Unknown statement: $query");
+    return (OPCODE_RESULT, pack_int(RESULT_VOID)) unless @{$statement->{columns}};
+
+    my ($consistency, $qflags)= unpack('nC', $values);
+    my @params;
+    if ($qflags & 0x01) {
+        my $count= unpack('n', substr($values, 3, 2));
+        my $pos= 5;
+        for (1..$count) {
+            my $len= unpack('l>', substr($values, $pos, 4));
+            push @params, $len < 0 ? undef : substr($values, $pos+4, $len);
+            $pos += 4 + ($len > 0 ? $len : 0);
+        }
+    }
+
+    my $rows= ref $statement->{rows} eq 'CODE' ? $statement->{rows}->(\@params, $conn->{node}, $conn->{shard}) : ($statement->{rows} || []);
+
+    my $meta= _metadata($statement->{columns}, 1);
+    my ($encoder)= unpack_metadata(4, 1, my $meta_copy= $meta);
+    my $data= '';
+    for my $row (@$rows) {
+        my $encoded= $encoder->encode($row);
+        $data .= substr($encoded, 2);
+    }
+
+    return (OPCODE_RESULT, pack_int(RESULT_ROWS).$meta.pack_int(scalar @$rows).$data);
+}
+
+1;
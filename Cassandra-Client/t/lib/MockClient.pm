@@ -0,0 +1,51 @@
+package MockClient;
+
+# Shared fixtures for the tests that run against MockCassandra.
+#
+#   my $client= mock_client($mock, request_timeout => 2);    # Connected, and on our own event loop where we can
+#   my @results= run_concurrently($client, 20, sub {         # All at once, from a single event loop run
+#       my ($i)= @_;
+#       return ("select id from t where id=?", [ $i ]);      # Arguments to _execute, after the callback
+#   });                                                       # [ $error, $result ] pairs, in order of completion
+
+use 5.010;
+use strict;
+use warnings;
+
+use Exporter 'import';
+our @EXPORT= qw/mock_client run_concurrently %loop/;
+
+use Cassandra::Client;
+
+# Our own event loop needs nothing beyond the XS part, unlike EV and AnyEvent
+our %loop= ($^O eq 'linux' ? (epoll => 1) : ());
+
+sub mock_client {
+    my ($mock, %args)= @_;
+    my $client= Cassandra::Client->new(
+        contact_points  => $mock->contact_points,
+        port            => $mock->port,
+        %loop,
+        %args,
+    );
+    $client->connect;
+    return $client;
+}
+
+sub run_concurrently {
+    my ($client, $count, $cb)= @_;
+
+    my (@results, $pending);
+    my $done= $client->{async_io}->wait(my $run);
+    for my $i (1..$count) {
+        $pending++;
+        $client->_execute(sub {
+            push @results, [ @_ ];
+            $done->() unless --$pending;
+        }, $cb->($i));
+    }
+    $run->();
+    return @results;
+}
+
+1;
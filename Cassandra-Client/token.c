@@ -0,0 +1,112 @@
+#define PERL_NO_GET_CONTEXT
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+
+#include <stdint.h>
+#include "token.h"
+
+/* Token of a partition key under Cassandra's Murmur3Partitioner: the first half of MurmurHash3
+ * x64_128 with seed 0. Cassandra's port of it reads the tail bytes as signed, so for keys whose
+ * length isn't a multiple of 16 the result differs from the reference implementation, and we
+ * have to do the same to find the same replicas. */
+
+#define CC_ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t cc_fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= UINT64_C(0xff51afd7ed558ccd);
+    k ^= k >> 33;
+    k *= UINT64_C(0xc4ceb9fe1a85ec53);
+    k ^= k >> 33;
+    return k;
+}
+
+static uint64_t cc_getblock64(const unsigned char *p)
+{
+    return ((uint64_t)p[0])       | ((uint64_t)p[1] << 8)  | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24)
+         | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+/* A tail byte, sign-extended like Java's (long)byte */
+#define TAIL(i) ((uint64_t)(int64_t)(int8_t)tail[i])
+
+int64_t cc_murmur3_token(const unsigned char *key, STRLEN len)
+{
+    const uint64_t c1 = UINT64_C(0x87c37b91114253d5);
+    const uint64_t c2 = UINT64_C(0x4cf5ad432745937f);
+    const unsigned char *tail;
+    uint64_t h1 = 0, h2 = 0, k1 = 0, k2 = 0;
+    STRLEN i, nblocks;
+    int64_t token;
+
+    if (len == 0)
+        return INT64_MIN;
+
+    nblocks = len / 16;
+    for (i = 0; i < nblocks; i++) {
+        k1 = cc_getblock64(key + (i * 16));
+        k2 = cc_getblock64(key + (i * 16) + 8);
+
+        k1 *= c1; k1 = CC_ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = CC_ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = CC_ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = CC_ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    tail = key + (nblocks * 16);
+    k1 = 0;
+    k2 = 0;
+    switch (len & 15) {
+        case 15: k2 ^= TAIL(14) << 48; /* fallthrough */
+        case 14: k2 ^= TAIL(13) << 40; /* fallthrough */
+        case 13: k2 ^= TAIL(12) << 32; /* fallthrough */
+        case 12: k2 ^= TAIL(11) << 24; /* fallthrough */
+        case 11: k2 ^= TAIL(10) << 16; /* fallthrough */
+        case 10: k2 ^= TAIL(9) << 8; /* fallthrough */
+        case 9:  k2 ^= TAIL(8);
+                 k2 *= c2; k2 = CC_ROTL64(k2, 33); k2 *= c1; h2 ^= k2; /* fallthrough */
+        case 8:  k1 ^= TAIL(7) << 56; /* fallthrough */
+        case 7:  k1 ^= TAIL(6) << 48; /* fallthrough */
+        case 6:  k1 ^= TAIL(5) << 40; /* fallthrough */
+        case 5:  k1 ^= TAIL(4) << 32; /* fallthrough */
+        case 4:  k1 ^= TAIL(3) << 24; /* fallthrough */
+        case 3:  k1 ^= TAIL(2) << 16; /* fallthrough */
+        case 2:  k1 ^= TAIL(1) << 8; /* fallthrough */
+        case 1:  k1 ^= TAIL(0);
+                 k1 *= c1; k1 = CC_ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= (uint64_t)len;
+    h2 ^= (uint64_t)len;
+    h1 += h2;
+    h2 += h1;
+    h1 = cc_fmix64(h1);
+    h2 = cc_fmix64(h2);
+    h1 += h2;
+
+    token = (int64_t)h1;
+    /* The minimum token is reserved */
+    return token == INT64_MIN ? INT64_MAX : token;
+}
+
+/* The shard of a Scylla node that owns a token, for the biased-token-round-robin algorithm: the
+ * token is moved into unsigned space, the ignored most significant bits are shifted out, and the
+ * result is scaled to the shard count, which is the top 64 bits of a 64x32 bit multiplication. */
+int32_t cc_scylla_shard(int64_t token, int32_t nr_shards, int32_t ignore_msb)
+{
+    uint64_t biased, hi, lo;
+
+    if (nr_shards <= 1)
+        return 0;
+
+    biased = (uint64_t)token + (UINT64_C(1) << 63);
+    if (ignore_msb > 0 && ignore_msb < 64)
+        biased <<= ignore_msb;
+
+    hi = (biased >> 32) * (uint64_t)nr_shards;
+    lo = (biased & UINT64_C(0xffffffff)) * (uint64_t)nr_shards;
+    return (int32_t)((hi + (lo >> 32)) >> 32);
+}
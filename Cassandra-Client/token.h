@@ -0,0 +1,11 @@
+#include <stdint.h>
+#define PERL_NO_GET_CONTEXT
+#include "perl.h"
+
+#ifndef CC_TOKEN_H
+#define CC_TOKEN_H
+
+int64_t cc_murmur3_token(const unsigned char *key, STRLEN len);
+int32_t cc_scylla_shard(int64_t token, int32_t nr_shards, int32_t ignore_msb);
+
+#endif
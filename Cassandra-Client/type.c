@@ -241,3 +241,187 @@ void cc_type_destroy(pTHX_ struct cc_type *type)
         }
     }
 }
+
+/* Interning.
+ *
+ * Every prepared statement has its metadata unpacked twice (for the encoder and the decoder), and
+ * many statements share column types, sometimes big UDTs. So instead of building a type tree per
+ * column, we keep one per distinct serialized type, refcounted, and give columns a shallow copy.
+ * A cache hit only needs a pass over the bytes to find where the type ends.
+ *
+ * Names (keyspaces, tables, columns) get the same treatment, minus the refcounting: they're small
+ * and there aren't many, so the table is only swept when it has doubled in size.
+ *
+ * Both tables live in PL_modglobal, so every interpreter has its own. */
+
+#define CC_NAME_SWEEP_MIN 1024
+
+static HV *cc_intern_table(pTHX_ const char *key)
+{
+    SV **svp = hv_fetch(PL_modglobal, key, strlen(key), 1);
+    if (!SvROK(*svp))
+        sv_setsv(*svp, sv_2mortal(newRV_noinc((SV*)newHV())));
+    return (HV*)SvRV(*svp);
+}
+
+/* Finds the end of a serialized type, without building it */
+static int skip_type(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos)
+{
+    uint16_t type_id, count;
+    char *str;
+    STRLEN str_len;
+    int i;
+
+    if (UNLIKELY(unpack_short_nocroak(aTHX_ input, len, pos, &type_id) != 0))
+        return -1;
+
+    if (type_id > 0 && type_id < 0x20)
+        return 0;
+
+    switch (type_id) {
+    case CC_TYPE_CUSTOM:
+        return unpack_string_nocroak(aTHX_ input, len, pos, &str, &str_len);
+    case CC_TYPE_LIST:
+    case CC_TYPE_SET:
+        return skip_type(aTHX_ input, len, pos);
+    case CC_TYPE_MAP:
+        if (skip_type(aTHX_ input, len, pos) != 0)
+            return -1;
+        return skip_type(aTHX_ input, len, pos);
+    case CC_TYPE_UDT:
+        if (unpack_string_nocroak(aTHX_ input, len, pos, &str, &str_len) != 0 ||
+            unpack_string_nocroak(aTHX_ input, len, pos, &str, &str_len) != 0 ||
+            unpack_short_nocroak(aTHX_ input, len, pos, &count) != 0)
+            return -1;
+        for (i = 0; i < count; i++) {
+            if (unpack_string_nocroak(aTHX_ input, len, pos, &str, &str_len) != 0 ||
+                skip_type(aTHX_ input, len, pos) != 0)
+                return -1;
+        }
+        return 0;
+    case CC_TYPE_TUPLE:
+        if (unpack_short_nocroak(aTHX_ input, len, pos, &count) != 0)
+            return -1;
+        for (i = 0; i < count; i++) {
+            if (skip_type(aTHX_ input, len, pos) != 0)
+                return -1;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Like unpack_type, but shares the result with every other column of the same type. Primitive
+ * types have nothing worth sharing, so for those we return NULL and only fill in the type id. */
+struct cc_type_entry *cc_type_intern(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_type *output)
+{
+    STRLEN start, end;
+    uint16_t type_id;
+    struct cc_type_entry *entry;
+    HV *cache;
+    SV **svp;
+
+    start = end = *pos;
+    if (UNLIKELY(unpack_short_nocroak(aTHX_ input, len, &end, &type_id) != 0))
+        croak("unpack_type: invalid input. Data corrupted?");
+    if (type_id > 0 && type_id < 0x20) {
+        output->type_id = type_id;
+        *pos = end;
+        return NULL;
+    }
+
+    end = start;
+    if (UNLIKELY(skip_type(aTHX_ input, len, &end) != 0))
+        croak("unpack_type: invalid input. Data corrupted?");
+
+    cache = cc_intern_table(aTHX_ "Cassandra::Client::types");
+    svp = hv_fetch(cache, (char*)input + start, end - start, 0);
+    if (svp) {
+        entry = INT2PTR(struct cc_type_entry*, SvIV(*svp));
+        entry->refcount++;
+        *output = entry->type;
+        *pos = end;
+        return entry;
+    }
+
+    entry = (struct cc_type_entry*)safecalloc(1, sizeof(struct cc_type_entry) + (end - start));
+    if (UNLIKELY(unpack_type_nocroak(aTHX_ input, len, pos, &entry->type) != 0)) {
+        cc_type_destroy(aTHX_ &entry->type);
+        Safefree(entry);
+        croak("unpack_type: invalid input. Data corrupted?");
+    }
+    entry->refcount = 1;
+    entry->key_len = end - start;
+    memcpy(entry->key, input + start, end - start);
+    hv_store(cache, entry->key, entry->key_len, newSViv(PTR2IV(entry)), 0);
+
+    *output = entry->type;
+    return entry;
+}
+
+void cc_type_release(pTHX_ struct cc_type_entry *entry)
+{
+    SV **svp;
+
+    if (--entry->refcount > 0)
+        return;
+
+    /* During global destruction the table may already be gone */
+    svp = hv_fetchs(PL_modglobal, "Cassandra::Client::types", 0);
+    if (svp && SvROK(*svp))
+        hv_delete((HV*)SvRV(*svp), entry->key, entry->key_len, G_DISCARD);
+
+    cc_type_destroy(aTHX_ &entry->type);
+    Safefree(entry);
+}
+
+/* Drops the names nobody holds on to anymore, once the table has doubled since the last sweep */
+static void cc_name_sweep(pTHX_ HV *names)
+{
+    SV *sweep_at = *hv_fetchs(PL_modglobal, "Cassandra::Client::names_sweep_at", 1);
+    AV *unused;
+    HE *he;
+
+    if (SvIOK(sweep_at) && HvUSEDKEYS(names) < (STRLEN)SvIV(sweep_at))
+        return;
+
+    unused = (AV*)sv_2mortal((SV*)newAV());
+    hv_iterinit(names);
+    while ((he = hv_iternext(names)) != NULL) {
+        if (SvREFCNT(HeVAL(he)) == 1)
+            av_push(unused, newSVsv(hv_iterkeysv(he)));
+    }
+    while (av_len(unused) >= 0)
+        hv_delete_ent(names, sv_2mortal(av_pop(unused)), G_DISCARD, 0);
+
+    sv_setiv(sweep_at, HvUSEDKEYS(names) * 2);
+}
+
+/* Returns a new reference to the (read-only) name SV */
+SV *cc_name_intern(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, U32 *hashout)
+{
+    char *str;
+    STRLEN str_len;
+    HV *names;
+    SV **svp, *name;
+    U32 hash;
+
+    unpack_string(aTHX_ input, len, pos, &str, &str_len);
+    PERL_HASH(hash, str, str_len);
+    if (hashout)
+        *hashout = hash;
+
+    names = cc_intern_table(aTHX_ "Cassandra::Client::names");
+    svp = hv_common_key_len(names, str, str_len, HV_FETCH_JUST_SV, NULL, hash);
+    if (svp)
+        return SvREFCNT_inc(*svp);
+
+    if (UNLIKELY(HvUSEDKEYS(names) >= CC_NAME_SWEEP_MIN))
+        cc_name_sweep(aTHX_ names);
+
+    name = newSVpvn_utf8(str, str_len, 1);
+    SvREADONLY_on(name);
+    hv_common_key_len(names, str, str_len, HV_FETCH_ISSTORE, name, hash);
+    return SvREFCNT_inc(name);
+}
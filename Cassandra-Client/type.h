@@ -4,3 +4,6 @@
 void cc_type_destroy(pTHX_ struct cc_type *type);
 int unpack_type_nocroak(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_type *output);
 void unpack_type(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_type *output);
+struct cc_type_entry *cc_type_intern(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, struct cc_type *output);
+void cc_type_release(pTHX_ struct cc_type_entry *entry);
+SV *cc_name_intern(pTHX_ unsigned char *input, STRLEN len, STRLEN *pos, U32 *hashout);
@@ -163,6 +163,12 @@ result set in memory.
 It is important to keep in mind that this mode can cause errors while fetching
 rows, as extra queries may be executed by the driver internally.
 
+The next page is requested as soon as the current one arrives, so it is
+usually there by the time the rows before it have been read. C<fetchall_arrayref>
+and C<fetchall_hashref> (and so the C<selectall_*> methods) take the rows a page
+at a time rather than one C<fetch> at a time, which makes them the fastest way
+to read large result sets.
+
 =back
 
 =back
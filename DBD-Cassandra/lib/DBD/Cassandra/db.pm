@@ -14,16 +14,18 @@ $DBD::Cassandra::db::imp_data_size = 0;
 sub prepare {
     my ($dbh, $statement, $attribs)= @_;
 
+    my $prepared;
     if ($attribs->{server_side_prepare}) {
         my $client= $dbh->{cass_client};
 
-        my ($error)= $client->call_prepare($statement);
+        (my $error, $prepared)= $client->call_prepare_statement($statement);
         if ($error) {
             return $dbh->set_err($DBI::stderr, $error);
         }
     }
 
     my ($outer, $sth)= DBI::_new_sth($dbh, { Statement => $statement });
+    $sth->{cass_statement}= $prepared;
     $sth->{cass_consistency}= $attribs->{consistency} || $attribs->{Consistency};
     $sth->{cass_page_size}= $attribs->{perpage} || $attribs->{PerPage} || $attribs->{per_page};
     $sth->{cass_async}= $attribs->{async};
@@ -6,7 +6,7 @@ use 5.010;
 use strict;
 use warnings;
 
-use Cassandra::Client 0.14_001;
+use Cassandra::Client 0.22;
 
 # "*FIX ME* Explain what the imp_data_size is, so that implementors aren't
 #  practicing cargo-cult programming" - DBI::DBD docs
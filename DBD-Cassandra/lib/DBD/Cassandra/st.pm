@@ -20,6 +20,16 @@ sub execute {
     my ($sth, @bind_values)= @_;
 
     $sth->{cass_bind}= (@bind_values ? \@bind_values : $sth->{cass_params});
+    delete $sth->{cass_prefetch};
+    delete $sth->{cass_next_page};
+
+    if (!$sth->{cass_statement} && $sth->{cass_executed}++) {
+        # The handle is being reused, so from now on skip looking up the query by its text
+        my ($error, $statement)= $sth->{Database}{cass_client}->call_prepare_statement($sth->{Statement});
+        return $sth->set_err($DBI::stderr, $error) if $error;
+        $sth->{cass_statement}= $statement;
+    }
+
     &start_async;
     $sth->STORE('Active', 1);
     if (!$sth->{cass_async}) {
@@ -32,11 +42,16 @@ sub execute {
 sub start_async {
     my ($sth)= @_;
 
-    $sth->{cass_future}= $sth->{Database}{cass_client}->future_call_execute($sth->{Statement}, $sth->{cass_bind}, {
+    my $attribs= {
         consistency => $sth->{cass_consistency},
         page_size => $sth->{cass_page_size},
         page => $sth->{cass_next_page},
-    });
+    };
+    if (my $statement= $sth->{cass_statement}) {
+        $sth->{cass_future}= $statement->future_call_execute($sth->{cass_bind}, $attribs);
+    } else {
+        $sth->{cass_future}= $sth->{Database}{cass_client}->future_call_execute($sth->{Statement}, $sth->{cass_bind}, $attribs);
+    }
 }
 
 sub x_finish_async {
@@ -55,7 +70,14 @@ sub x_finish_async {
     my $names= ($result && $result->column_names) || [];
     my $page= ($result && $result->next_page);
 
+    if ($sth->FETCH('ChopBlanks')) {
+        for my $row (@$rows) {
+            for (@$row) { s/\s+$// if defined && !ref; }
+        }
+    }
+
     $sth->{rows}= $rows;
+    $sth->{row_index}= 0;
     $sth->{row_count}= 0+@$rows;
 
     if (!@$rows && !@$names) {
@@ -68,9 +90,35 @@ sub x_finish_async {
     $sth->{NAME}= $names;
     $sth->{cass_next_page}= $page;
 
+    if ($page) {
+        # Ask for the next page right away, so it's on its way while this one is being read
+        &start_async;
+        $sth->{cass_prefetch}= delete $sth->{cass_future};
+    }
+
     return ((0+@$rows) || '0E0');
 }
 
+# Makes sure there's a row left at $sth->{row_index}, moving on to the next page when needed.
+# Returns false once the result set is exhausted, or on error.
+sub _load_rows {
+    my ($sth)= @_;
+    if ($sth->{cass_future}) {
+        return undef unless &x_finish_async;
+    }
+
+    while ($sth->{row_index} >= @{$sth->{rows} || []}) {
+        my $prefetch= delete $sth->{cass_prefetch};
+        if (!$prefetch) {
+            $sth->STORE('Active', 0);
+            return undef;
+        }
+        $sth->{cass_future}= $prefetch;
+        return undef unless &x_finish_async;
+    }
+    return 1;
+}
+
 sub execute_for_fetch {
     die 'Not implemented'; #TODO
 }
@@ -81,31 +129,104 @@ sub bind_param_array {
 
 sub fetchrow_arrayref {
     my ($sth)= @_;
+    return undef unless &_load_rows;
+
+    # _set_fbav also takes care of the bound columns
+    return $sth->_set_fbav($sth->{rows}[$sth->{row_index}++]);
+}
+
+*fetch = \&fetchrow_arrayref;
+
+sub bind_col {
+    my ($sth, @args)= @_;
+    $sth->{cass_bound_cols}= 1;
+    return $sth->SUPER::bind_col(@args);
+}
+
+# The rows decoded from a page are fresh arrays that nothing else holds on to, so the fetchall
+# methods hand them out whole instead of copying them one fetch at a time like DBI does. Column
+# slices and bound columns are left to DBI.
+sub fetchall_arrayref {
+    my ($sth, $slice, $max_rows)= @_;
+
+    my $mode= (!defined $slice ? 'ARRAY'
+        : ref $slice eq 'ARRAY' && !@$slice ? 'ARRAY'
+        : ref $slice eq 'HASH' && !%$slice ? 'HASH'
+        : undef);
+    if (!$mode || $sth->{cass_bound_cols}) {
+        return $sth->SUPER::fetchall_arrayref($slice, $max_rows);
+    }
+
+    # Same as DBI: with max_rows, a handle that's done gives undef rather than an empty list
+    return undef if $max_rows and not $sth->FETCH('Active');
     if ($sth->{cass_future}) {
-        return undef unless &x_finish_async;
+        return [] unless &x_finish_async;
     }
 
-    my $row= shift @{$sth->{rows}};
-    if (!$row && $sth->{cass_next_page}) {
-        &start_async;
-        if (!&x_finish_async) {
-            return undef;
+    my $left= ($max_rows && $max_rows > 0 ? $max_rows : undef);
+    my $names= ($mode eq 'HASH' ? $sth->FETCH($sth->FETCH('FetchHashKeyName') || 'NAME') : undef);
+
+    my @all;
+    while ((!defined $left || $left > 0) && &_load_rows) {
+        my $rows= $sth->{rows};
+        my $from= $sth->{row_index};
+        my $to= $#$rows;
+        $to= $from + $left - 1 if defined $left && $to - $from >= $left;
+        $sth->{row_index}= $to + 1;
+        $left -= ($to - $from + 1) if defined $left;
+
+        if ($names) {
+            push @all, map { my %row; @row{@$names}= @$_; \%row } @$rows[$from..$to];
+        } elsif ($from == 0 && $to == $#$rows) {
+            push @all, @$rows;
+        } else {
+            push @all, @$rows[$from..$to];
         }
-        $row= shift @{$sth->{rows}};
     }
-    if ($row) {
-        if ($sth->FETCH('ChopBlanks')) {
-            map { $_ =~ s/\s+$//; } @$row;
+
+    return \@all;
+}
+
+sub fetchall_hashref {
+    my ($sth, $key_field)= @_;
+    if ($sth->{cass_future}) {
+        return undef unless &x_finish_async;
+    }
+
+    my $names= $sth->FETCH($sth->FETCH('FetchHashKeyName') || 'NAME');
+    my %index;
+    @index{@$names}= (0..$#$names);
+
+    my @key_indexes;
+    for my $key (ref $key_field ? @$key_field : $key_field) {
+        my $index= $index{$key};
+        if (!defined $index && DBI::looks_like_number($key) && $key >= 1 && $key <= @$names) {
+            $index= $key - 1;
         }
+        return $sth->set_err($DBI::stderr, "Field '$key' does not exist (not one of @{[ sort keys %index ]})")
+            unless defined $index;
+        push @key_indexes, $index;
+    }
 
-        return $sth->_set_fbav($row);
+    my %all;
+    while (&_load_rows) {
+        my $rows= $sth->{rows};
+        for my $row (@$rows[$sth->{row_index}..$#$rows]) {
+            my $ref= \%all;
+            $ref= ($ref->{$row->[$_]} ||= {}) for @key_indexes;
+            @$ref{@$names}= @$row;
+        }
+        $sth->{row_index}= @$rows;
     }
 
-    $sth->STORE('Active', 0);
-    return undef;
+    return \%all;
 }
 
-*fetch = \&fetchrow_arrayref;
+sub finish {
+    my ($sth)= @_;
+    delete $sth->{cass_prefetch};
+    return $sth->SUPER::finish;
+}
 
 sub rows {
     my $sth= shift;
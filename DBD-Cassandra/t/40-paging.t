@@ -6,7 +6,7 @@ use TestCassandra;
 use Test::More;
 
 plan skip_all => "Missing Cassandra test environment" unless TestCassandra->is_ok;
-plan tests => 101;
+plan tests => 105;
 
 my $dbh= TestCassandra->get(undef, Warn => 1, PrintWarn => 0, PrintError => 0);
 ok($dbh);
@@ -31,4 +31,21 @@ for (1..50) {
     is($seen{$_}, 1);
 }
 
+$sth->execute;
+my $all= $sth->fetchall_arrayref;
+is_deeply([ sort { $a <=> $b } map $_->[0], @$all ], [ 1..50 ], 'fetchall_arrayref goes through all pages');
+
+$sth->execute;
+my @batches;
+while (my $batch= $sth->fetchall_arrayref({}, 7)) {
+    last unless @$batch;
+    push @batches, $batch;
+}
+is(0+@batches, 8, 'fetchall_arrayref with max_rows');
+is_deeply([ sort { $a <=> $b } map { map $_->{id}, @$_ } @batches ], [ 1..50 ], 'every row once, as hashes');
+
+$sth->execute;
+my $by_id= $sth->fetchall_hashref('id');
+is_deeply([ sort { $a <=> $b } keys %$by_id ], [ 1..50 ], 'fetchall_hashref goes through all pages');
+
 $dbh->disconnect;
@@ -0,0 +1,96 @@
+use 5.010;
+use warnings;
+use strict;
+use File::Basename qw//; use lib File::Basename::dirname(__FILE__).'/lib';
+use Test::More;
+
+plan skip_all => "DBI is not installed" unless eval { require DBI; 1 };
+plan tests => 17;
+
+require FakeCassandra;
+
+{
+    package PaddedObject;
+    use overload '""' => sub { "object   " }, fallback => 1;
+}
+my $padded_object= bless {}, 'PaddedObject';
+
+my $fake= FakeCassandra->install(
+    "select id, value from t where n=?" => sub {
+        my ($n)= @_;
+        return ([ qw/id value/ ], [ map [ $_, "row $_" ], 1..$n ]);
+    },
+    "select id, value, missing, list, object from blanks" => sub {
+        return ([ qw/id value missing list object/ ], [ [ 1, "padded   ", undef, [ " list " ], $padded_object ] ]);
+    },
+    "select k1, k2, value from pairs" => sub {
+        return ([ qw/k1 k2 value/ ], [ [ 1, 1, 'a' ], [ 1, 2, 'b' ], [ 2, 1, 'c' ], [ 2, 2, 'd' ] ]);
+    },
+);
+
+my $dbh= DBI->connect("dbi:Cassandra:host=localhost", undef, undef, { RaiseError => 1, PrintError => 0 });
+ok($dbh);
+
+sub ids { [ map $_->[0], @{$_[0]} ] }
+
+# max_rows, the way DBI does it: false means all rows, and a finished handle gives undef
+{
+    my $sth= $dbh->prepare("select id, value from t where n=?", { PerPage => 3 });
+    $sth->execute(12);
+    is_deeply(ids($sth->fetchall_arrayref(undef, 0)), [ 1..12 ], 'max_rows of zero reads everything');
+    ok(!defined $sth->fetchall_arrayref(undef, 5), 'max_rows on a finished handle gives undef');
+    is_deeply($sth->fetchall_arrayref, [], 'without max_rows it gives an empty list');
+
+    $sth->execute(12);
+    my @batches;
+    while (my $batch= $sth->fetchall_arrayref(undef, 5)) {
+        push @batches, ids($batch);
+    }
+    is_deeply(\@batches, [ [ 1..5 ], [ 6..10 ], [ 11, 12 ] ], 'max_rows batches until the handle is done');
+}
+
+# The page that was fetched ahead of time doesn't outlive the execute it belongs to
+{
+    my $sth= $dbh->prepare("select id, value from t where n=?", { PerPage => 3 });
+    $sth->execute(12);
+    is($sth->fetchrow_arrayref->[0], 1, 'first row');
+    $sth->execute(2);
+    is_deeply(ids($sth->fetchall_arrayref), [ 1, 2 ], 're-executing drops the prefetched page');
+
+    $sth->execute(12);
+    $sth->fetchrow_arrayref for 1..3;
+    $fake->{requests}= [];
+    $sth->finish;
+    ok(!$sth->{Active}, 'finished');
+    ok(!defined $sth->fetchrow_arrayref, 'finishing drops the prefetched page');
+    is_deeply($fake->{requests}, [], 'without asking for more');
+}
+
+# ChopBlanks leaves nulls and references alone
+{
+    my @warnings;
+    local $SIG{__WARN__}= sub { push @warnings, @_ };
+    my $sth= $dbh->prepare("select id, value, missing, list, object from blanks");
+    $sth->{ChopBlanks}= 1;
+    $sth->execute;
+    my $rows= $sth->fetchall_arrayref;
+    is_deeply($rows, [ [ 1, "padded", undef, [ " list " ], $padded_object ] ], 'ChopBlanks');
+    is(ref $rows->[0][4], 'PaddedObject', 'references are not turned into strings');
+    is_deeply(\@warnings, [], 'without warnings');
+}
+
+# fetchall_hashref with more than one key, across pages
+{
+    my $sth= $dbh->prepare("select k1, k2, value from pairs", { PerPage => 3 });
+    $sth->execute;
+    my $all= $sth->fetchall_hashref([ qw/k1 k2/ ]);
+    is_deeply([ sort keys %$all ], [ 1, 2 ], 'first key');
+    is_deeply($all->{2}{1}, { k1 => 2, k2 => 1, value => 'c' }, 'second key');
+    is($all->{2}{2}{value}, 'd', 'from the second page');
+
+    $sth->execute;
+    $all= $sth->fetchall_hashref([ 2, 1 ]);
+    is($all->{2}{1}{value}, 'b', 'keys by column number');
+}
+
+$dbh->disconnect;
@@ -0,0 +1,68 @@
+package FakeCassandra;
+use 5.010;
+use strict;
+use warnings;
+
+# Stands in for Cassandra::Client, so the statement handle can be tested without a cluster.
+#
+#   my $fake= FakeCassandra->install(
+#       "select id from t where n=?" => sub { my ($n)= @_; return ([ 'id' ], [ map [ $_ ], 1..$n ]) },
+#   );
+#   my $dbh= DBI->connect("dbi:Cassandra:host=localhost");
+#
+# Rows are paged by the page_size the statement asks for, and the offset of every page that was
+# requested ends up in $fake->{requests}.
+
+use Cassandra::Client;
+
+sub install {
+    my ($class, %queries)= @_;
+    my $self= bless { queries => \%queries, requests => [] }, $class;
+
+    no warnings 'redefine';
+    *Cassandra::Client::new= sub { $self };
+    return $self;
+}
+
+sub call_connect { return; }
+sub is_active { 1 }
+sub shutdown { }
+
+sub call_prepare_statement {
+    my ($self, $query)= @_;
+    return (undef, bless { client => $self, query => $query }, 'FakeCassandra::Statement');
+}
+
+sub future_call_execute {
+    my ($self, $query, $bind, $attribs)= @_;
+    my $handler= $self->{queries}{$query} or die "Unexpected query: $query";
+    my ($columns, $rows)= $handler->(@{$bind || []});
+
+    my $from= $attribs->{page} || 0;
+    my $size= $attribs->{page_size} || 5000;
+    my $to= ($from + $size < @$rows ? $from + $size : 0+@$rows);
+    push @{$self->{requests}}, $from;
+
+    my $result= bless {
+        # Fresh rows, like the ones a real result set decodes
+        rows => [ map [ @$_ ], @$rows[$from .. $to-1] ],
+        column_names => $columns,
+        next_page => ($to < @$rows ? $to : undef),
+    }, 'FakeCassandra::ResultSet';
+    return sub { (undef, $result) };
+}
+
+package FakeCassandra::Statement;
+
+sub future_call_execute {
+    my ($self, $bind, $attribs)= @_;
+    return $self->{client}->future_call_execute($self->{query}, $bind, $attribs);
+}
+
+package FakeCassandra::ResultSet;
+
+sub rows { $_[0]{rows} }
+sub column_names { $_[0]{column_names} }
+sub next_page { $_[0]{next_page} }
+
+1;